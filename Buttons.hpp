@@ -0,0 +1,167 @@
+#ifndef Buttons_hpp
+#define Buttons_hpp
+
+#include <Arduino.h>
+
+/**
+ * Max number of buttons
+ */
+#define BUTTONS_MAX             4
+
+/**
+ * Presses waiting to be read
+ */
+#define BUTTONS_QUEUE_SIZE      8
+
+/**
+ * Time a button must stay at the same level for it to count
+ */
+#define BUTTONS_DEBOUNCE_MS     10
+
+/**
+ * Reads push buttons (active low, with pull-ups) in the background.
+ *
+ * Edges are timestamped by the pin change interrupt, and Poll() runs a
+ * debounce state machine over them: once a button has been LOW for
+ * BUTTONS_DEBOUNCE_MS, a press goes to the event queue, no matter how
+ * long it is held. Presses made while loop() is busy (e.g. printing)
+ * are queued, not lost.
+ *
+ * The interrupt handler is bound to PCINT0, so buttons must be on port
+ * B (pins 8-13 of the Pro Mini).
+ *
+ * On the host build there are no pin change interrupts: Poll() samples
+ * the pins itself.
+ */
+class Buttons
+{
+public:
+
+    Buttons()
+    {
+        m_count = 0;
+        m_head = 0;
+        m_queued = 0;
+    }
+
+    /**
+     * Starts watching the buttons. Pins must already be INPUT_PULLUP.
+     *
+     * @param   pins    button pins; a button's id is its position here
+     * @param   count   up to BUTTONS_MAX
+     */
+    void Begin(const uint8_t *pins, uint8_t count)
+    {
+        if(count > BUTTONS_MAX) count = BUTTONS_MAX;
+
+        for(uint8_t i = 0; i < count; i++)
+        {
+            m_pins[i] = pins[i];
+            m_levels[i] = digitalRead(pins[i]);
+            m_changedAt[i] = millis();
+
+            // a button held now (e.g. since boot) only counts after release
+            m_stable[i] = LOW;
+
+#if defined(__AVR__)
+            *digitalPinToPCMSK(pins[i]) |= _BV(digitalPinToPCMSKbit(pins[i]));
+            PCICR |= _BV(digitalPinToPCICRbit(pins[i]));
+#endif
+        }
+
+        m_count = count;
+    }
+
+    /**
+     * Timestamps level changes. Pin change interrupt handler.
+     */
+    void OnChange()
+    {
+        unsigned long now = millis();
+
+        for(uint8_t i = 0; i < m_count; i++)
+        {
+            uint8_t level = digitalRead(m_pins[i]);
+            if(level == m_levels[i]) continue;
+
+            m_levels[i] = level;
+            m_changedAt[i] = now;
+        }
+    }
+
+    /**
+     * Queues the presses whose level has settled. Call it from loop().
+     */
+    void Poll()
+    {
+#if !defined(__AVR__)
+        OnChange();
+#endif
+
+        unsigned long now = millis();
+
+        for(uint8_t i = 0; i < m_count; i++)
+        {
+            noInterrupts();
+            uint8_t level = m_levels[i];
+            unsigned long changedAt = m_changedAt[i];
+            interrupts();
+
+            if(level == m_stable[i] || now - changedAt < BUTTONS_DEBOUNCE_MS) continue;
+
+            m_stable[i] = level;
+
+            if(level == LOW && m_queued < BUTTONS_QUEUE_SIZE)
+            {
+                m_queue[(m_head + m_queued) % BUTTONS_QUEUE_SIZE] = i;
+                m_queued++;
+            }
+        }
+    }
+
+    /**
+     * Takes the oldest press
+     *
+     * @param   button  id of the button pressed
+     *
+     * @return  false if there are no presses
+     */
+    bool Read(uint8_t &button)
+    {
+        if(m_queued == 0) return false;
+
+        button = m_queue[m_head];
+        m_head = (m_head + 1) % BUTTONS_QUEUE_SIZE;
+        m_queued--;
+
+        return true;
+    }
+
+private:
+    uint8_t m_pins[BUTTONS_MAX];
+    uint8_t m_count;
+
+    // written by the interrupt
+    volatile uint8_t m_levels[BUTTONS_MAX];
+    volatile unsigned long m_changedAt[BUTTONS_MAX];
+
+    uint8_t m_stable[BUTTONS_MAX];      // debounced level
+
+    uint8_t m_queue[BUTTONS_QUEUE_SIZE];
+    uint8_t m_head;
+    uint8_t m_queued;
+};
+
+/**
+ * Global instance of Buttons, bound to the PCINT0 interrupt
+ */
+Buttons g_buttons;
+
+#if defined(__AVR__)
+ISR(PCINT0_vect)
+{
+    g_buttons.OnChange();
+}
+#endif
+
+#endif
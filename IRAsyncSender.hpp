@@ -0,0 +1,312 @@
+#ifndef IRAsyncSender_hpp
+#define IRAsyncSender_hpp
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+#include "IRData.hpp"
+#include "IRWaveform.hpp"
+#include "IRStats.hpp"
+
+/**
+ * Frames that can be waiting, including the one being sent
+ */
+#define IRASYNC_QUEUE_SIZE      4
+
+/**
+ * Longest step programmed on the timer; longer gaps are split
+ */
+#define IRASYNC_MAX_STEP_USECS  30000
+
+static_assert(IRASYNC_QUEUE_SIZE >= IRDATA_MAX_FRAMES, "a whole code must fit on the queue");
+
+/**
+ * Sends IR frames in the background. Marks and spaces are played from
+ * the Timer1 compare interrupt, while the 38 kHz carrier comes from
+ * IRremote's Timer2 PWM on pin 3, switched on and off at each step.
+ *
+ * Frames are copied into a small queue, each one followed by its own
+ * gap, so the caller never waits for the IR LED. Poll() must be called
+ * from loop() to report sent frames. Frames of a multi-frame code are
+ * queued one by one, each followed by its IRData::nextGap.
+ *
+ * Codes (i.e. the last frame of a code and the next frame) are kept
+ * apart by at least the IRProtocol::FrameGapMs() of both frames: the
+ * gap after a code grows to its own protocol's, and a silence is
+ * played ahead of the next code if its protocol needs a longer one.
+ * Frames of a multi-frame code get that silence too, when their gap
+ * is shorter than the next frame's protocol needs for its receivers
+ * to tell both frames apart; the gaps stored with the code are kept.
+ *
+ * On the host build there is no timer: Poll() plays every step whose
+ * time has come, and records it on the IRsend given to Begin().
+ */
+class IRAsyncSender
+{
+public:
+
+    IRAsyncSender()
+    {
+        m_head = 0;
+        m_count = 0;
+        m_running = false;
+        m_sent = 0;
+        m_reported = 0;
+        m_callback = NULL;
+        m_irSender = NULL;
+        m_leadLeft = 0;
+        m_gapLeft = 0;
+        m_lastGapMs = 0;
+    }
+
+    /**
+     * Sets up the carrier and the step timer.
+     *
+     * @param   irSender    IRremote sender, for the carrier setup
+     */
+    void Begin(IRsend &irSender)
+    {
+        m_irSender = &irSender;
+
+        // Set IR carrier frequency (38 kHz), carrier off
+        irSender.enableIROut(38);
+
+#if defined(__AVR__)
+        // Timer1 in CTC mode, 1/8 prescaler, interrupt enabled on start
+        TCCR1A = 0;
+        TCCR1B = _BV(WGM12) | _BV(CS11);
+        TIMSK1 &= ~_BV(OCIE1A);
+#endif
+    }
+
+    /**
+     * Queues a frame, which is sent as soon as the ones before it.
+     *
+     * @param   irData  copied, so it may be discarded afterwards
+     * @param   gapMs   silence after the frame, before the next one.
+     *                  After the last frame of a code, 0 gives the
+     *                  shortest gap its protocols allow.
+     *
+     * @return  false if the queue is full or the frame is invalid
+     */
+    bool Enqueue(const IRData &irData, uint16_t gapMs)
+    {
+        if(!irData.isValid || irData.protocol == NULL || irData.nBits == 0) return false;
+
+        noInterrupts();
+        uint8_t count = m_count;
+        uint8_t slot = (m_head + count) % IRASYNC_QUEUE_SIZE;
+        interrupts();
+
+        if(count == IRASYNC_QUEUE_SIZE) return false;
+
+        // the interrupt doesn't touch slots past m_count
+        m_queue[slot] = irData;
+        m_gaps[slot] = gapMs;
+
+        noInterrupts();
+        m_count++;
+        if(!m_running) StartNext();
+        interrupts();
+
+        return true;
+    }
+
+    bool CanEnqueue() const { return m_count < IRASYNC_QUEUE_SIZE; }
+
+    /**
+     * @return  number of frames that can be queued right now
+     */
+    uint8_t Room() const { return IRASYNC_QUEUE_SIZE - m_count; }
+
+    /**
+     * @return  true while there are frames being sent or waiting
+     */
+    bool IsBusy() const { return m_count > 0; }
+
+    /**
+     * @return  number of frames sent so far (wraps around)
+     */
+    uint16_t SentCount()
+    {
+        noInterrupts();
+        uint16_t sent = m_sent;
+        interrupts();
+
+        return sent;
+    }
+
+    /**
+     * @param   callback    called from Poll() once per frame sent
+     */
+    void SetSentCallback(void (*callback)()) { m_callback = callback; }
+
+    /**
+     * Reports sent frames through the callback. Call it from loop().
+     */
+    void Poll()
+    {
+#if !defined(__AVR__)
+        while(m_running && (long)(micros() - m_hostDeadline) >= 0) OnTimer();
+#endif
+
+        uint16_t sent = SentCount();
+
+        while(m_reported != sent)
+        {
+            m_reported++;
+            IRSTATS(g_irStats.framesSent++);
+            if(m_callback != NULL) m_callback();
+        }
+    }
+
+    /**
+     * Plays the next step. Timer interrupt handler.
+     */
+    void OnTimer()
+    {
+        bool isMark = false;
+        uint16_t usecs = 0;
+
+        if(m_leadLeft > 0)
+        {
+            Play(false, TakeStep(m_leadLeft));
+        }
+        else if(m_waveform.Next(m_cursor, isMark, usecs))
+        {
+            Play(isMark, usecs);
+        }
+        else if(m_gapLeft > 0)
+        {
+            Play(false, TakeStep(m_gapLeft));
+        }
+        else
+        {
+            // frame and its gap are over
+            m_head = (m_head + 1) % IRASYNC_QUEUE_SIZE;
+            m_count--;
+            m_sent++;
+            StartNext();
+        }
+    }
+
+private:
+    IRData m_queue[IRASYNC_QUEUE_SIZE];
+    uint16_t m_gaps[IRASYNC_QUEUE_SIZE];    // milliseconds
+    volatile uint8_t m_head;    // frame being sent
+    volatile uint8_t m_count;
+    volatile bool m_running;
+    volatile uint16_t m_sent;
+    uint16_t m_reported;
+    void (*m_callback)();
+    IRsend *m_irSender;
+
+    // current frame, only used by the interrupt once running
+    IRWaveform m_waveform;
+    IRWaveform::Cursor m_cursor;
+    uint32_t m_leadLeft;        // microseconds, before the frame
+    uint32_t m_gapLeft;         // microseconds, after the frame
+    uint16_t m_lastGapMs;       // gap after the frame before
+
+#if !defined(__AVR__)
+    unsigned long m_hostDeadline;
+#endif
+
+    /**
+     * Starts the frame at m_head, if any. Interrupts must be off.
+     */
+    void StartNext()
+    {
+        if(m_count == 0 || !m_waveform.Compile(m_queue[m_head]))
+        {
+            Stop();
+            return;
+        }
+
+        const IRData &frame = m_queue[m_head];
+        uint8_t frameGapMs = frame.protocol->FrameGapMs();
+        uint16_t gapMs = m_gaps[m_head];
+
+        // a frame after another one, which its receivers may need more
+        // silence from
+        m_leadLeft = 0;
+        if(m_running && m_lastGapMs < frameGapMs)
+        {
+            m_leadLeft = (uint32_t) (frameGapMs - m_lastGapMs) * 1000;
+        }
+
+        if(frame.nextGap == 0 && gapMs < frameGapMs) gapMs = frameGapMs;
+        m_lastGapMs = gapMs;
+
+        m_waveform.Rewind(m_cursor);
+        m_gapLeft = (uint32_t) gapMs * 1000;
+
+#if !defined(__AVR__)
+        if(!m_running) m_hostDeadline = micros();
+#endif
+
+        m_running = true;
+        OnTimer();
+    }
+
+    /**
+     * @param   left    silence left, in microseconds
+     *
+     * @return  next step of it, taken from left
+     */
+    static uint16_t TakeStep(uint32_t &left)
+    {
+        uint16_t usecs = left > IRASYNC_MAX_STEP_USECS ? IRASYNC_MAX_STEP_USECS : left;
+        left -= usecs;
+
+        return usecs;
+    }
+
+    void Stop()
+    {
+        m_running = false;
+        m_count = 0;
+
+#if defined(__AVR__)
+        TIMSK1 &= ~_BV(OCIE1A);
+        TIMER_DISABLE_PWM;
+#endif
+    }
+
+    /**
+     * Switches the carrier and programs the timer for the next step.
+     */
+    void Play(bool isMark, uint16_t usecs)
+    {
+#if defined(__AVR__)
+        if(isMark) TIMER_ENABLE_PWM;
+        else TIMER_DISABLE_PWM;
+
+        OCR1A = usecs * (F_CPU / 8000000UL) - 1;
+
+        if(!(TIMSK1 & _BV(OCIE1A)))
+        {
+            TCNT1 = 0;
+            TIFR1 = _BV(OCF1A);
+            TIMSK1 |= _BV(OCIE1A);
+        }
+#else
+        if(m_irSender != NULL) m_irSender->hostRecord(isMark, usecs);
+        m_hostDeadline += usecs;
+#endif
+    }
+};
+
+/**
+ * Global instance of IRAsyncSender, bound to the Timer1 interrupt
+ */
+IRAsyncSender g_irAsyncSender;
+
+#if defined(__AVR__)
+ISR(TIMER1_COMPA_vect)
+{
+    g_irAsyncSender.OnTimer();
+}
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef IRCaptureRing_hpp
+#define IRCaptureRing_hpp
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+#include "IRTrace.hpp"
+
+/**
+ * Room for captures, in bytes. Most frames take a byte per width, so
+ * this holds two 32-bit frames, or one of up to about 80 bits. Longer
+ * ones wait on IRremote's buffer, as when the ring is full.
+ */
+#define IRCAPTURE_RING_BYTES    192
+
+/**
+ * Ring of raw captures waiting to be printed, so IRremote can be
+ * resumed as soon as a frame is captured, instead of after it was
+ * printed.
+ *
+ * Each capture is kept as an IRTrace record (varints, about a byte per
+ * width), followed by the frame decoded from it, so several captures
+ * take less RAM than a single rawbuf. Captures are read back in the
+ * order they were pushed: the trace record byte by byte, with read(),
+ * e.g. to print it in small chunks, and then the frame, with Pop().
+ */
+class IRCaptureRing
+{
+public:
+
+    IRCaptureRing()
+    {
+        m_tail = 0;
+        m_used = 0;
+        m_count = 0;
+        m_traceLeft = 0;
+    }
+
+    uint8_t Count() const { return m_count; }
+
+    /**
+     * Queues a capture
+     *
+     * @param   results     raw data, from IRremote
+     * @param   irData      frame decoded from it, or invalid
+     *
+     * @return  false if there's no room for it
+     */
+    bool Push(const decode_results *results, IRData &irData)
+    {
+        uint16_t traceSize = IRTrace::Size(results);
+        uint16_t frameSize = irData.isValid ? 3 + irData.Length() : 1;
+        Sink sink(*this);
+
+        if(2 + traceSize + frameSize > IRCAPTURE_RING_BYTES - m_used) return false;
+
+        sink.write(traceSize & 0xFF);
+        sink.write(traceSize >> 8);
+        IRTrace::Write(sink, results);
+
+        if(!irData.isValid)
+        {
+            sink.write(NoProtocol);
+        }
+        else
+        {
+            sink.write(irData.protocol - g_irProtocols.At(0));
+            sink.write(irData.nBits);
+            sink.write(irData.isRepeated);
+            for(uint8_t i = 0; i < irData.Length(); i++) sink.write(irData.data[i]);
+        }
+
+        m_count++;
+        return true;
+    }
+
+    /**
+     * Starts reading the oldest capture
+     *
+     * @return  false if there's none
+     */
+    bool Begin()
+    {
+        if(m_count == 0) return false;
+
+        m_traceLeft = Get();
+        m_traceLeft |= Get() << 8;
+        return true;
+    }
+
+    /**
+     * Reads the trace record of the capture, after Begin()
+     *
+     * @return  next byte, or -1 at the end of the record
+     */
+    int read()
+    {
+        if(m_traceLeft == 0) return -1;
+
+        m_traceLeft--;
+        return Get();
+    }
+
+    /**
+     * Takes the frame of the capture, after its trace record was read,
+     * and removes the capture from the ring
+     *
+     * @param   irData      destination, invalid if it wasn't decoded
+     */
+    void Pop(IRData &irData)
+    {
+        uint8_t index;
+
+        while(read() >= 0);
+
+        index = Get();
+        irData.isValid = index != NoProtocol;
+        irData.nextGap = 0;
+
+        if(irData.isValid)
+        {
+            irData.protocol = g_irProtocols.At(index);
+            irData.nBits = Get();
+            irData.isRepeated = Get();
+            for(uint8_t i = 0; i < irData.Length(); i++) irData.data[i] = Get();
+        }
+
+        m_count--;
+    }
+
+private:
+    static const uint8_t NoProtocol = 0xFF;
+
+    /**
+     * Appends bytes, for IRTrace::Write. Push() checks the room first.
+     */
+    struct Sink
+    {
+        IRCaptureRing &ring;
+
+        Sink(IRCaptureRing &r) : ring(r) {}
+
+        void write(uint8_t value)
+        {
+            ring.m_bytes[(ring.m_tail + ring.m_used) % IRCAPTURE_RING_BYTES] = value;
+            ring.m_used++;
+        }
+    };
+
+    uint8_t m_bytes[IRCAPTURE_RING_BYTES];
+    uint16_t m_tail;            // oldest byte
+    uint16_t m_used;
+    uint8_t m_count;            // captures
+    uint16_t m_traceLeft;       // bytes of the trace record being read
+
+    uint8_t Get()
+    {
+        uint8_t value = m_bytes[m_tail];
+
+        m_tail = (m_tail + 1) % IRCAPTURE_RING_BYTES;
+        m_used--;
+        return value;
+    }
+};
+
+#endif
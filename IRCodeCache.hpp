@@ -0,0 +1,157 @@
+#ifndef IRCodeCache_hpp
+#define IRCodeCache_hpp
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+#include "IRStorage.hpp"
+
+/**
+ * Max number of codes: 20 AC remotes with 4 codes each, plus 3
+ * projector codes
+ */
+#define IRCACHE_MAX_CODES   83
+
+/**
+ * Bytes of the EEPROM image kept in RAM, none by default: a code read
+ * from EEPROM takes a few microseconds more per byte, while the pool
+ * takes RAM for good. Define it before including this file to have
+ * the start of the image read from RAM; the rest, if any, is read
+ * from EEPROM when needed.
+ */
+#ifndef IRCACHE_POOL_SIZE
+#define IRCACHE_POOL_SIZE   0
+#endif
+
+/**
+ * Programmed codes, validated once (on boot), so sending a code never
+ * finds a broken one.
+ *
+ * With IRCACHE_POOL_SIZE set, the start of the image body (pointer
+ * table, records and patches) is also kept in RAM as it is on EEPROM,
+ * compressed, so the pool holds many more codes than a copy of each
+ * IRData would. Getting a code takes at most two records and a few
+ * XOR's.
+ *
+ * Get() parses the pointer, patch and record on every call: keeping
+ * them resolved would take RAM for every code, and on a button press
+ * it costs little, even for a patch past the pool (see ir-bench).
+ *
+ * @see     IRStorage for the image format
+ */
+class IRCodeCache
+{
+public:
+
+    IRCodeCache()
+    {
+        m_count = 0;
+        m_start = 0;
+        m_poolUsed = 0;
+    }
+
+    /**
+     * Loads the image body, and validates all codes.
+     *
+     * @param   start   EEPROM address of the body (pointer table)
+     * @param   length  of the body, in bytes
+     * @param   count   number of codes on the pointer table
+     *
+     * @return  number of invalid codes (not available afterwards)
+     */
+    uint8_t Load(uint16_t start, uint16_t length, uint8_t count)
+    {
+        IRData irData;
+        uint8_t invalid = 0;
+
+        if(count > IRCACHE_MAX_CODES) count = IRCACHE_MAX_CODES;
+
+        m_count = count;
+        m_start = start;
+        m_poolUsed = length > IRCACHE_POOL_SIZE ? IRCACHE_POOL_SIZE : length;
+
+#if IRCACHE_POOL_SIZE > 0
+        eeprom_read_block((void *) m_pool, (const void *)(size_t) start, m_poolUsed);
+#endif
+
+        for(uint8_t i = 0; i < sizeof(m_invalid); i++) m_invalid[i] = 0;
+
+        for(uint8_t i = 0; i < count; i++)
+        {
+            uint8_t frame = 0;
+
+            // all frames of multi-frame codes
+            while(IRStorage::ReadCode(*this, i, irData, frame) && irData.nextGap > 0) frame++;
+
+            if(irData.isValid) continue;
+
+            m_invalid[i / 8] |= 1 << (i % 8);
+            invalid++;
+        }
+
+        return invalid;
+    }
+
+    uint8_t Count() const { return m_count; }
+
+    /**
+     * @return  bytes of the pool in use
+     */
+    uint16_t PoolUsed() const { return m_poolUsed; }
+
+    /**
+     * Gets a code.
+     *
+     * @param   index   position on the pointer table
+     * @param   irData  destination; nextGap tells if there's another frame
+     * @param   frame   of a multi-frame code
+     *
+     * @return  false if there's no such code (or frame), or it's invalid
+     */
+    bool Get(uint8_t index, IRData &irData, uint8_t frame = 0) const
+    {
+        irData.isValid = false;
+
+        if(index >= m_count || (m_invalid[index / 8] & (1 << (index % 8)))) return false;
+
+        return IRStorage::ReadCode(*this, index, irData, frame);
+    }
+
+    /**
+     * Reads bytes of the image, from RAM if they're loaded.
+     * Reader for IRStorage::ReadCode.
+     */
+    bool Read(uint16_t address, void *destination, uint8_t size) const
+    {
+        if(address + size > E2END + 1) return false;
+
+#if IRCACHE_POOL_SIZE > 0
+        if(address >= m_start && address + size <= m_start + m_poolUsed)
+        {
+            memcpy(destination, &m_pool[address - m_start], size);
+            return true;
+        }
+#endif
+
+        eeprom_read_block(destination, (const void *)(size_t) address, size);
+
+        return true;
+    }
+
+private:
+#if IRCACHE_POOL_SIZE > 0
+    uint8_t m_pool[IRCACHE_POOL_SIZE];
+#endif
+    uint8_t m_invalid[(IRCACHE_MAX_CODES + 7) / 8];     // bit set if invalid
+    uint8_t m_count;
+    uint16_t m_start;       // EEPROM address of m_pool[0]
+    uint16_t m_poolUsed;
+};
+
+/**
+ * Global instance of IRCodeCache
+ */
+IRCodeCache g_irCodeCache;
+
+#endif
@@ -3,23 +3,40 @@
 
 #include <Arduino.h>
 #include <EEPROM.h>
+#include <avr/eeprom.h>
 #include "IRProtocols.hpp"
 
 #define IRDATA_MAX_VALUE_SIZE     20
 
+/**
+ * Max number of frames of a code. Codes longer than a single frame
+ * (e.g. AC protocols that send 280 to 440 bits, in 2 to 3 frames)
+ * are chained, one IRData per frame, so short codes don't pay for
+ * a bigger buffer.
+ */
+#define IRDATA_MAX_FRAMES         4
+
 class IRData
 {
     public:
-        IRProtocol *protocol;
+        /**
+         * Flags of the third byte on EEPROM
+         */
+        static const uint8_t RepeatedFlag = 0x01;
+        static const uint8_t NextFrameFlag = 0x02;
+
+        const IRProtocol *protocol;
         uint8_t data[IRDATA_MAX_VALUE_SIZE];
         uint8_t nBits;
         bool isValid;
         bool isRepeated;
+        uint8_t nextGap;    // ms before the next frame of the code, 0 if last
 
         IRData()
         {
             protocol = NULL;
             isValid = false;
+            nextGap = 0;
         }
 
         uint8_t MaxSize() { return IRDATA_MAX_VALUE_SIZE; }
@@ -34,10 +51,14 @@ class IRData
 
         /**
          * Writes the data packet on Arduino EEPROM if it's valid.
+         * Bytes that already hold the same value are not rewritten.
          *
          * First byte is nBits
          * Second byte is protocol ID
+         * Third byte is flags: RepeatedFlag, NextFrameFlag
          * Next n bytes are data
+         * If NextFrameFlag is set, a byte with nextGap, and then
+         * the next frame follows
          *
          * @param   address     starting address
          * @return  0 on failure
@@ -45,15 +66,14 @@ class IRData
         char WriteToEEPROM(uint16_t address)
         {
             if(Length() == 0 || !isValid) return 0;
+            if(address + SizeOnEEPROM() > E2END + 1) return 0;
 
-            EEPROM.write(address, nBits);
-            EEPROM.write(address + 1, protocol->GetId());
-            EEPROM.write(address + 2, isRepeated);
+            uint8_t header[3] = {nBits, (uint8_t) protocol->GetId(), Flags()};
 
-            for(uint8_t i = 0; i < Length(); i++)
-            {
-                EEPROM.write(address + 3 + i, data[i]);
-            }
+            eeprom_update_block((const void *)header, (void *)(size_t) address, sizeof(header));
+            eeprom_update_block((const void *)data, (void *)(size_t)(address + sizeof(header)), Length());
+
+            if(nextGap > 0) eeprom_update_byte((uint8_t *)(size_t)(address + sizeof(header) + Length()), nextGap);
 
             return 1;
         }
@@ -66,31 +86,38 @@ class IRData
          */
         char ReadFromEEPROM(uint16_t address)
         {
+            uint8_t header[3];  // nBits, protocol id, flags
+
             isValid = false;
 
-            nBits = EEPROM.read(address);
+            eeprom_read_block((void *)header, (const void *)(size_t) address, sizeof(header));
+
+            nBits = header[0];
             uint8_t size = Length();
 
             if(size == 0 || size > MaxSize())
             {
-                Serial.println("size mismatch");
+                Serial.println(F("size mismatch"));
                 return 0;
             }
 
-            protocol = g_irProtocols.GetProtocol((IRProtocol::Id) EEPROM.read(address + 1));
+            protocol = g_irProtocols.GetProtocol((IRProtocol::Id) header[1]);
 
             if(protocol == NULL)
             {
-                Serial.print("protocol mismatch");
-                Serial.println(EEPROM.read(address + 1), DEC);
+                Serial.print(F("protocol mismatch"));
+                Serial.println(header[1], DEC);
                 return 0;
             }
 
-            isRepeated = EEPROM.read(address + 2);
+            isRepeated = header[2] & RepeatedFlag;
 
-            for(uint8_t i = 0; i < size; i++)
+            eeprom_read_block((void *)data, (const void *)(size_t)(address + sizeof(header)), size);
+
+            nextGap = 0;
+            if(header[2] & NextFrameFlag)
             {
-                data[i] = EEPROM.read(address + 3 + i);
+                nextGap = eeprom_read_byte((const uint8_t *)(size_t)(address + sizeof(header) + size));
             }
 
             isValid = true;
@@ -104,7 +131,16 @@ class IRData
          */
         uint8_t SizeOnEEPROM()
         {
-            return Length() + 3;
+            return Length() + 3 + (nextGap > 0);
+        }
+
+        /**
+         * @see     WriteToEEPROM
+         * @return  third byte on EEPROM
+         */
+        uint8_t Flags() const
+        {
+            return (isRepeated ? RepeatedFlag : 0) | (nextGap > 0 ? NextFrameFlag : 0);
         }
 
         /**
@@ -113,44 +149,72 @@ class IRData
         void operator = (const IRData &copyFrom)
         {
             protocol = copyFrom.protocol;
-            for(char i = 0; i < IRDATA_MAX_VALUE_SIZE; ++i)
+            for(uint8_t i = 0; i < IRDATA_MAX_VALUE_SIZE; ++i)
             {
                 data[i] = copyFrom.data[i];
             }
             nBits = copyFrom.nBits;
             isValid = copyFrom.isValid;
             isRepeated = copyFrom.isRepeated;
+            nextGap = copyFrom.nextGap;
         }
 
         void ToString()
         {
-            Serial.print("Protocol ");
+            Serial.print(F("Protocol "));
             Serial.print(protocol->Name());
-            Serial.print(", ");
+            Serial.print(F(", "));
             Serial.print(nBits);
-            Serial.print(" bits, ");
+            Serial.print(F(" bits, "));
             Serial.print(Length());
-            Serial.print(" bytes, <");
+            Serial.print(F(" bytes, <"));
             for(uint8_t i = 0; i < Length(); i++)
             {
                 if(data[i] < 0x10) Serial.print('0');
                 Serial.print(data[i], HEX);
             }
-            Serial.print("> ");
-            if(!isRepeated) Serial.print("no ");
-            Serial.println("repeat");
+            Serial.print(F("> "));
+            if(!isRepeated) Serial.print(F("no "));
+            Serial.print(F("repeat"));
+            if(nextGap > 0)
+            {
+                Serial.print(F(", next frame after "));
+                Serial.print(nextGap);
+                Serial.print(F(" ms"));
+            }
+            Serial.println();
 
-            Serial.print(nBits);
-            Serial.print(' ');
+            PrintCode(Serial);
+        }
+
+        /**
+         * Prints the packet as a single line, in the same format
+         * used on codes.txt and to program the remote:
+         * number of bits, data bits in hex, protocol id, is repeated,
+         * and the gap before the next frame, if there's one (the next
+         * frame goes on the next line)
+         *
+         * @param   out     e.g. Serial
+         */
+        void PrintCode(Print &out)
+        {
+            out.print(nBits);
+            out.print(' ');
             for(uint8_t i = 0; i < Length(); i++)
             {
-                if(data[i] < 0x10) Serial.print('0');
-                Serial.print(data[i], HEX);
+                if(data[i] < 0x10) out.print('0');
+                out.print(data[i], HEX);
+            }
+            out.print(' ');
+            out.print((int) protocol->GetId());
+            out.print(' ');
+            out.print(isRepeated ? '1':'0');
+            if(nextGap > 0)
+            {
+                out.print(' ');
+                out.print(nextGap);
             }
-            Serial.print(' ');
-            Serial.print(protocol->GetId());
-            Serial.print(' ');
-            Serial.println(isRepeated ? '1':'0');
+            out.println();
         }
 };
 
@@ -4,6 +4,29 @@
 #include <Arduino.h>
 #include "IRProtocols.hpp"
 #include "IRData.hpp"
+#include "IRStats.hpp"
+
+/**
+ * Lowest confidence (0-100) of a frame accepted by default
+ *
+ * @see     IRDecoder::minConfidence
+ */
+#define IRDECODER_MIN_CONFIDENCE    20
+
+/**
+ * A protocol's walk over raw data, by its decoder (see IRDecodeSegment)
+ */
+struct IRDecodeWalk
+{
+    volatile unsigned int *rawbuf;
+    uint16_t rawLength;
+    uint16_t offset;        // next width, or the one that didn't match
+    uint32_t deviation;     // sum, see IRProtocol
+    uint16_t widths;        // matched
+    uint8_t nBits;
+    bool isRepeated;
+    uint8_t *data;          // where the bits go, NULL to only match
+};
 
 class IRDecoder
 {
@@ -17,30 +40,305 @@ public:
         DataOverflow,
         MarkMismatch,
         SpaceMismatch,
-        TrailMismatch
+        TrailMismatch,
+        LowConfidence
     };
 
     static uint16_t lastOffset;
 
+    /**
+     * Confidence of the last frame decoded (or rejected as
+     * LowConfidence): 100 if all widths were right at the protocol
+     * timings, down to 0 if they were at the edges of their ranges
+     */
+    static uint8_t lastConfidence;
+
+    /**
+     * Frames with a lower confidence are rejected
+     */
+    static uint8_t minConfidence;
+
     static String errorToString(Error error)
     {
         switch(error)
         {
-            case None:              return "none";
-            case NotEnoughData:     return "not enough data";
-            case HeaderMismatch:    return "header mismatch";
-            case DataOverflow:      return "data overflow";
-            case MarkMismatch:      return "mark mismatch";
-            case SpaceMismatch:     return "space mismatch";
-            case TrailMismatch:     return "trail mismatch";
+            case None:              return F("none");
+            case NotEnoughData:     return F("not enough data");
+            case HeaderMismatch:    return F("header mismatch");
+            case DataOverflow:      return F("data overflow");
+            case MarkMismatch:      return F("mark mismatch");
+            case SpaceMismatch:     return F("space mismatch");
+            case TrailMismatch:     return F("trail mismatch");
+            case LowConfidence:     return F("low confidence");
         }
+        return String();
     }
 
     static Error tryDecodeIR(decode_results *results, IRData &irData,
-                        IRProtocol *protocol);
+                        const IRProtocol *protocol);
+
+    static Error decodeBest(decode_results *results, IRData &irData,
+                        uint16_t candidates);
+
+private:
+
+    static Error Walk(IRDecodeWalk &walk, decode_results *results,
+                        const IRProtocol *protocol, uint8_t *data);
 };
 
+static_assert(IRDecoder::LowConfidence < IRSTATS_DECODE_ERRORS, "IRStats has no room for all errors");
+
 uint16_t IRDecoder::lastOffset = 1; // defines the static member variable
+uint8_t IRDecoder::lastConfidence = 0;
+uint8_t IRDecoder::minConfidence = IRDECODER_MIN_CONFIDENCE;
+
+
+/**
+ * Helpers of IRDecodeSegment
+ */
+class IRDecodeStep
+{
+protected:
+
+    /**
+     * Matches the width at walk.offset against a timing, and moves
+     * past it
+     *
+     * @return  false if it doesn't match
+     */
+    template <class Timing> static bool Take(IRDecodeWalk &walk)
+    {
+        uint16_t deviation = Timing::Deviation(walk.rawbuf[walk.offset]);
+
+        if(deviation == IRPROTOCOL_NO_MATCH) return false;
+
+        walk.deviation += deviation;
+        walk.widths++;
+        walk.offset++;
+        return true;
+    }
+
+    static bool OutOfData(const IRDecodeWalk &walk) { return walk.offset >= walk.rawLength; }
+
+    /**
+     * @param   canEnd  the frame may end where the raw data did
+     */
+    static IRDecoder::Error Finish(const IRDecodeWalk &walk, bool canEnd)
+    {
+        return canEnd && walk.nBits > 0 ? IRDecoder::None : IRDecoder::NotEnoughData;
+    }
+};
+
+/**
+ * Decoder of a protocol, from an op of its shape on (see IRShape),
+ * instantiated for each op with the op and the protocol timings as
+ * constants. Run() matches the widths of the op, accumulating their
+ * deviation, and goes on with the next op, following the shape as
+ * IRShape::Cursor does, so a protocol's decoder is a single function
+ * with no shape or timing lookups.
+ *
+ * Widths are matched as IRProtocol does; when a space matches both bit
+ * spaces, the closest one is taken.
+ *
+ * canEnd tells if the frame may end before the op.
+ *
+ * @return  None if the frame matched up to its end (or to a repeat,
+ *          the rest is ignored); NotEnoughData if the raw data ended
+ *          where the frame can't; otherwise why the width at
+ *          walk.offset didn't match
+ */
+template <uint8_t index, uint8_t pc, uint8_t op = IRStaticProtocol<index>::Op(pc)>
+class IRDecodeSegment;
+
+template <uint8_t index, uint8_t pc>
+class IRDecodeSegment<index, pc, IRShape::Header> : IRDecodeStep
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRDecodeSegment<index, Protocol::NextOp(pc)> Next;
+
+public:
+    static const bool canEnd = false;
+
+    static IRDecoder::Error Run(IRDecodeWalk &walk)
+    {
+        if(OutOfData(walk)) return Finish(walk, false);
+        if(!Take<typename Protocol::HeaderMark>(walk)) return IRDecoder::HeaderMismatch;
+
+        if(OutOfData(walk)) return Finish(walk, false);
+        if(!Take<typename Protocol::HeaderSpace>(walk)) return IRDecoder::HeaderMismatch;
+
+        return Next::Run(walk);
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRDecodeSegment<index, pc, IRShape::Bits> : IRDecodeStep
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRDecodeSegment<index, Protocol::NextOp(pc)> Next;
+
+    static const uint8_t count = Protocol::Op(pc + 1);
+
+public:
+    static const bool canEnd = false;
+
+    static IRDecoder::Error Run(IRDecodeWalk &walk)
+    {
+        for(uint8_t bits = 0; ; bits++)
+        {
+            if(OutOfData(walk)) return Finish(walk, false);
+            if(!Take<typename Protocol::BitMark>(walk)) return IRDecoder::MarkMismatch;
+
+            if(count != IRShape::AllBits && bits == count) return Next::Run(walk);
+
+            // AllBits end on any mark, so the next space may be the next op's
+            bool mayEnd = count == IRShape::AllBits && bits > 0;
+
+            if(OutOfData(walk)) return Finish(walk, mayEnd && Next::canEnd);
+
+            uint16_t ticks = walk.rawbuf[walk.offset];
+            uint16_t deviation;
+            bool isOne;
+
+            // ranges are checked first, as scoring takes longer
+            bool one = Protocol::BitOneSpace::Match(ticks);
+            bool zero = Protocol::BitZeroSpace::Match(ticks);
+
+            if(one && zero)
+            {
+                uint16_t oneDeviation = Protocol::BitOneSpace::Deviation(ticks);
+                uint16_t zeroDeviation = Protocol::BitZeroSpace::Deviation(ticks);
+
+                isOne = oneDeviation <= zeroDeviation;
+                deviation = isOne ? oneDeviation : zeroDeviation;
+            }
+            else if(one || zero)
+            {
+                isOne = one;
+                deviation = one ? Protocol::BitOneSpace::Deviation(ticks)
+                    : Protocol::BitZeroSpace::Deviation(ticks);
+            }
+            else if(mayEnd) return Next::Run(walk);
+            else return IRDecoder::SpaceMismatch;
+
+            if(walk.nBits >= IRDATA_MAX_VALUE_SIZE * 8) return IRDecoder::DataOverflow;
+
+            if(walk.data != NULL)
+            {
+                if(walk.nBits % 8 == 0) walk.data[walk.nBits / 8] = 0;
+                if(isOne) walk.data[walk.nBits / 8] |= 0x80 >> (walk.nBits % 8);
+            }
+
+            walk.deviation += deviation;
+            walk.widths++;
+            walk.offset++;
+            walk.nBits++;
+        }
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRDecodeSegment<index, pc, IRShape::Gap> : IRDecodeStep
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRDecodeSegment<index, Protocol::NextOp(pc)> Next;
+
+public:
+    static const bool canEnd = false;
+
+    static IRDecoder::Error Run(IRDecodeWalk &walk)
+    {
+        if(OutOfData(walk)) return Finish(walk, false);
+        if(!Take<typename Protocol::template GapSpace<Protocol::Op(pc + 1)> >(walk))
+        {
+            return IRDecoder::SpaceMismatch;
+        }
+
+        return Next::Run(walk);
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRDecodeSegment<index, pc, IRShape::Trail> : IRDecodeStep
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRDecodeSegment<index, Protocol::NextOp(pc)> Next;
+
+public:
+    static const bool canEnd = false;
+
+    static IRDecoder::Error Run(IRDecodeWalk &walk)
+    {
+        if(OutOfData(walk)) return Finish(walk, false);
+        if(!Take<typename Protocol::TrailSpace>(walk)) return IRDecoder::TrailMismatch;
+
+        if(OutOfData(walk)) return Finish(walk, false);
+        if(!Take<typename Protocol::BitMark>(walk)) return IRDecoder::MarkMismatch;
+
+        return Next::Run(walk);
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRDecodeSegment<index, pc, IRShape::RepeatFrom> : IRDecodeStep
+{
+    typedef IRStaticProtocol<index> Protocol;
+
+public:
+    static const bool canEnd = true;
+
+    static IRDecoder::Error Run(IRDecodeWalk &walk)
+    {
+        if(OutOfData(walk)) return Finish(walk, true);
+        if(!Take<typename Protocol::RepeatSpace>(walk)) return IRDecoder::SpaceMismatch;
+
+        walk.isRepeated = true;
+        return Finish(walk, true);
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRDecodeSegment<index, pc, IRShape::End> : IRDecodeStep
+{
+public:
+    static const bool canEnd = true;
+
+    static IRDecoder::Error Run(IRDecodeWalk &walk)
+    {
+        // anything past the end of the frame
+        return OutOfData(walk) ? Finish(walk, true) : IRDecoder::SpaceMismatch;
+    }
+};
+
+/**
+ * Decoder of g_irProtocolTable[index], for IRStaticProtocols::Dispatch
+ */
+template <uint8_t index> class IRDecodeKernel
+{
+public:
+    static IRDecoder::Error Run(IRDecodeWalk &walk) { return IRDecodeSegment<index, 0>::Run(walk); }
+};
+
+
+/**
+ * Walks raw data with the decoder of a protocol
+ *
+ * @param   data    where the bits go, NULL to only match the widths
+ */
+IRDecoder::Error IRDecoder::Walk(IRDecodeWalk &walk, decode_results *results,
+                        const IRProtocol *protocol, uint8_t *data)
+{
+    walk.rawbuf = results->rawbuf;
+    walk.rawLength = results->rawlen;
+    walk.offset = 1;
+    walk.deviation = 0;
+    walk.widths = 0;
+    walk.nBits = 0;
+    walk.isRepeated = false;
+    walk.data = data;
+
+    return IRStaticProtocols<>::Dispatch<IRDecodeKernel>(protocol->GetId(), HeaderMismatch, walk);
+}
 
 
 /**
@@ -48,106 +346,115 @@ uint16_t IRDecoder::lastOffset = 1; // defines the static member variable
  * a certain protocol.
  *
  * @see     IRProtocol class
+ * @see     decodeBest, with this protocol as the only candidate
  *
  * @param   results     obtained from IRremote library
  * @param   irData      destination data packet
  * @param   protocol
  *
- * @return  true if raw data match given protocol
+ * @return  None if raw data match given protocol
  */
 IRDecoder::Error IRDecoder::tryDecodeIR(
-    decode_results *results, IRData &irData, IRProtocol *protocol)
+    decode_results *results, IRData &irData, const IRProtocol *protocol)
 {
-    uint8_t nBits = 0;      // # of bits received (mark-space pairs)
-    uint16_t rawLength = results->rawlen;
-    unsigned int rawValue = 0;
-    uint8_t iData = 0;
-    uint8_t iBit = 0;
-    char repeatReached = 0;         // used on protocols that repeat its packet
+    return decodeBest(results, irData, 1 << (protocol - g_irProtocols.At(0)));
+}
+
 
+/**
+ * Decodes the raw data as the protocol it matches best, among the
+ * candidates.
+ *
+ * Each candidate walks the raw data with its own decoder (see
+ * IRDecodeSegment), accumulating the deviation of every width (see
+ * IRProtocol) until a width doesn't match it. Among those that match
+ * all widths, the one with the lowest average deviation wins,
+ * regardless of their order on the protocol table.
+ *
+ * Data bits are taken on the same walk, into whichever buffer doesn't
+ * hold the best candidate so far, so the raw data is walked once per
+ * candidate. (Walking all candidates in lockstep, a width at a time,
+ * was tried: saving and resuming each walk on every width made it
+ * slower than walking them one after another.) irData.data may be
+ * overwritten even if no candidate matches.
+ *
+ * @param   results     obtained from IRremote library
+ * @param   irData      destination data packet
+ * @param   candidates  bit n set to try g_irProtocols.At(n)
+ *
+ * @return  None if a candidate matched with at least minConfidence;
+ *          otherwise NotEnoughData if a candidate matched all the raw
+ *          data but its frame wasn't over, why the candidate that
+ *          matched the most widths was dropped (lastOffset is where;
+ *          the last one on the table, on ties), or LowConfidence
+ */
+IRDecoder::Error IRDecoder::decodeBest(
+    decode_results *results, IRData &irData, uint16_t candidates)
+{
+    IRDecodeWalk walk;
+    uint8_t spare[IRDATA_MAX_VALUE_SIZE];
+    uint8_t *data = spare;          // where the next candidate's bits go
+    uint32_t bestDeviation = 0;
+    uint16_t bestWidths = 0;
+    uint8_t bestBits = 0;
+    bool isRepeated = false;
+    Error error = HeaderMismatch;
+    bool cutShort = false;          // a candidate ran out of data
+    uint8_t best = IRPROTOCOLS_COUNT;
+
+    irData.isValid = false;
     lastOffset = 1;
+    lastConfidence = 0;
 
     // not sure if this could happen
-    if(rawLength <= 4) return NotEnoughData;
+    if(results->rawlen <= 4) return NotEnoughData;
 
-    // checks initial mark and space - please notice lastOffset++
-    if( !MATCH_MARK(results->rawbuf[lastOffset++], protocol->HeaderMark())
-        || !MATCH_SPACE(results->rawbuf[lastOffset++], protocol->HeaderSpace())
-        )
+    for(uint8_t i = 0; i < IRPROTOCOLS_COUNT; i++)
     {
-        return HeaderMismatch;
-    }
+        if(!(candidates & (1 << i))) continue;
 
-    // ignores start space, header mark and space, and last mark
-    nBits = (results->rawlen - 4)/2;
-    if(nBits > irData.MaxSize() * 8)
-    {
-        return DataOverflow;
-    }
-
-    // tries to decode each bit
-    for(iBit = 0; iBit < nBits; iBit++)
-    {
-        iData = iBit / 8;
-        rawValue = results->rawbuf[lastOffset];
+        Error result = Walk(walk, results, g_irProtocols.At(i), data);
 
-        // initialize data array
-        if(iBit % 8 == 0) irData.data[iData] = 0;
-
-        if(!MATCH_MARK(rawValue, protocol->BitMark()))
+        if(result == NotEnoughData)
         {
-            return MarkMismatch;
+            cutShort = true;
+            continue;
         }
 
-        lastOffset++;
-        rawValue = results->rawbuf[lastOffset];
-
-        if(MATCH_SPACE(rawValue, protocol->BitOneSpace()))
+        if(result != None)
         {
-            irData.data[iData] = (irData.data[iData] << 1) | 1;
-        }
-        else if(MATCH_SPACE(rawValue, protocol->BitZeroSpace()))
-        {
-            irData.data[iData] = (irData.data[iData] << 1);
-        }
-        else if(protocol->IsRepeated() && MATCH_SPACE(rawValue, protocol->RepeatSpace()))
-        {
-            repeatReached = 1;
-            irData.isRepeated = true;
-            break;
-        }
-        else if(protocol->HasTrail() && (lastOffset == rawLength - 2 || lastOffset == rawLength - 1))
-        {
-            if( ( lastOffset == rawLength - 2 && !MATCH_SPACE(rawValue, protocol->TrailSpace()) )
-                || (lastOffset == rawLength - 1 && !MATCH_MARK(rawValue, protocol->BitMark()))
-                )
+            if(walk.offset >= lastOffset)
             {
-                return TrailMismatch;
+                lastOffset = walk.offset;
+                error = result;
             }
+            continue;
         }
-        else
+
+        // lower average deviation, i.e. a / b < c / d
+        if(best == IRPROTOCOLS_COUNT || walk.deviation * bestWidths < bestDeviation * walk.widths)
         {
-            return SpaceMismatch;
+            best = i;
+            bestDeviation = walk.deviation;
+            bestWidths = walk.widths;
+            bestBits = walk.nBits;
+            isRepeated = walk.isRepeated;
+
+            // keep its bits, the next candidate takes the other buffer
+            data = data == spare ? irData.data : spare;
         }
-
-        lastOffset++;
     }
 
-    // If there is a repeat, nBits calculated previously is wrong.
-    // Here we update it to the real value, i.e. the number of
-    // bits processed so far, before reaching repeat space.
-    // Therefore, data is made of those first bits decoded.
-    if(repeatReached) nBits = iBit;
-    else irData.isRepeated = false;
+    if(best == IRPROTOCOLS_COUNT) return cutShort ? NotEnoughData : error;
 
-    // Align left last bits on last data byte
-    if(nBits % 8 > 0)
-    {
-        irData.data[(int)nBits/8] <<= 8 - (nBits % 8);
-    }
+    lastConfidence = 100 - bestDeviation * 100 / (bestWidths * (uint32_t) IRPROTOCOL_MAX_DEVIATION);
+    if(lastConfidence < minConfidence) return LowConfidence;
 
-    irData.nBits = nBits;
-    irData.protocol = protocol;
+    if(data == irData.data) memcpy(irData.data, spare, (bestBits + 7) / 8);
+
+    irData.nBits = bestBits;
+    irData.isRepeated = isRepeated;
+    irData.protocol = g_irProtocols.At(best);
     irData.isValid = true;
 
     return None;
@@ -155,8 +462,10 @@ IRDecoder::Error IRDecoder::tryDecodeIR(
 
 
 /**
- * Tries to decode the raw data by ckecking its timings against all
- * available protocols.
+ * Tries to decode the raw data by ckecking its timings against the
+ * available protocols. Only the protocols whose header matches
+ * are tried, as given by the header index of IRProtocols, and the one
+ * that matches best is taken (see IRDecoder::decodeBest).
  *
  * @see     IRProtocols class
  *
@@ -168,45 +477,76 @@ IRDecoder::Error IRDecoder::tryDecodeIR(
  */
 bool decodeIR(decode_results *results, IRData &data, char debug)
 {
-    IRProtocol *protocol = nullptr;
     IRDecoder::Error error = IRDecoder::None;
+    uint16_t candidates = 0;
 
     data.isValid = false;
 
-    // iterates over all protocols
-    g_irProtocols.First();
+    // header is rawbuf[1] (mark) and rawbuf[2] (space)
+    if(results->rawlen > 4)
+    {
+        candidates = g_irProtocols.HeaderCandidates(
+            results->rawbuf[1], results->rawbuf[2]);
+    }
 
-    while(!g_irProtocols.IsDone())
+    if(debug && candidates == 0)
     {
-        protocol = g_irProtocols.Current();
+        Serial.println(F("No protocol with this header"));
+    }
 
-        if(debug)
-        {
-            Serial.print("Trying ");
-            Serial.print(protocol->Name());
-            Serial.print(": ");
-        }
+    // each candidate on its own, to tell why the others don't match
+    for(uint8_t i = 0; debug && i < IRPROTOCOLS_COUNT; i++)
+    {
+        if(!(candidates & (1 << i))) continue;
+
+        const IRProtocol *protocol = g_irProtocols.At(i);
+
+        Serial.print(F("Trying "));
+        Serial.print(protocol->Name());
+        Serial.print(F(": "));
 
         error = IRDecoder::tryDecodeIR(results, data, protocol);
 
-        if(error == IRDecoder::None)
+        if(error == IRDecoder::None || error == IRDecoder::LowConfidence)
         {
-            if(debug) Serial.println("MATCH");
-            break;
+            Serial.print(error == IRDecoder::None ? F("MATCH") : F("low confidence"));
+            Serial.print(F(", confidence "));
+            Serial.println(IRDecoder::lastConfidence);
         }
         else
         {
-            if(debug)
-            {
-                Serial.print(IRDecoder::errorToString(error));
-                Serial.print(" - [");
-                Serial.print(IRDecoder::lastOffset);
-                Serial.print("] ");
-                Serial.println((unsigned long) results->rawbuf[IRDecoder::lastOffset]*USECPERTICK, DEC);
-            }
+            Serial.print(IRDecoder::errorToString(error));
+            Serial.print(F(" - ["));
+            Serial.print(IRDecoder::lastOffset);
+            Serial.print(F("] "));
+            Serial.println((unsigned long) results->rawbuf[IRDecoder::lastOffset]*USECPERTICK, DEC);
         }
+    }
+
+    IRSTATS(unsigned long start = micros());
+
+    if(candidates != 0) error = IRDecoder::decodeBest(results, data, candidates);
+    else if(results->rawlen > 4) error = IRDecoder::HeaderMismatch;
+    else error = IRDecoder::NotEnoughData;
+
+#if IRSTATS_ENABLED
+    g_irStats.AddDecode(micros() - start);
+    g_irStats.decodeErrors[error]++;
+
+    for(uint8_t i = 0; i < IRPROTOCOLS_COUNT; i++)
+    {
+        if(candidates & (1 << i)) g_irStats.decodeAttempts[i]++;
+    }
 
-        g_irProtocols.Next();
+    if(error == IRDecoder::None) g_irStats.decodeMatches[data.protocol - g_irProtocols.At(0)]++;
+#endif
+
+    if(debug && error == IRDecoder::None)
+    {
+        Serial.print(F("Best match: "));
+        Serial.print(data.protocol->Name());
+        Serial.print(F(", confidence "));
+        Serial.println(IRDecoder::lastConfidence);
     }
 
     return data.isValid;
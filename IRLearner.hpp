@@ -0,0 +1,164 @@
+#ifndef IRLearner_hpp
+#define IRLearner_hpp
+
+#include <Arduino.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+
+/**
+ * Captures of a button voted to learn its code. Odd numbers can't tie.
+ */
+#define IRLEARN_CAPTURES    3
+
+/**
+ * Learns a code from several captures of the same button, so a capture
+ * with a bit flipped by noise is outvoted instead of being programmed.
+ *
+ * Captures are added one at a time, as decoded by decodeIR(). Once
+ * there are IRLEARN_CAPTURES of them, most must agree on the protocol,
+ * number of bits and repeat; the code takes these, and each data bit
+ * by majority among the captures that agreed. Captures that weren't
+ * decoded are not counted.
+ */
+class IRLearner
+{
+public:
+
+    enum Error : char
+    {
+        None = 0,
+        Pending,            // more captures needed
+        NotDecoded,         // capture ignored
+        ProtocolMismatch,   // captures disagree on the protocol, bits or repeat
+        BitsMismatch        // a bit is tied among the captures that agree
+    };
+
+    static String errorToString(Error error)
+    {
+        switch(error)
+        {
+            case None:              return F("none");
+            case Pending:           return F("pending");
+            case NotDecoded:        return F("not decoded");
+            case ProtocolMismatch:  return F("protocol mismatch");
+            case BitsMismatch:      return F("bits mismatch");
+        }
+        return String();
+    }
+
+    IRLearner()
+    {
+        Reset();
+    }
+
+    /**
+     * Starts learning a new code
+     */
+    void Reset()
+    {
+        m_count = 0;
+        m_agreeing = 0;
+        m_outvotedBits = 0;
+    }
+
+    /**
+     * @return  captures added since the code was learned (or Reset)
+     */
+    uint8_t Count() const { return m_count; }
+
+    /**
+     * @return  captures the code was learned from, i.e. that agreed on
+     *          the protocol
+     */
+    uint8_t Agreeing() const { return m_agreeing; }
+
+    /**
+     * @return  data bits of the code where a capture was outvoted
+     */
+    uint8_t OutvotedBits() const { return m_outvotedBits; }
+
+    /**
+     * Adds a capture. When it's the last one, the captures are voted,
+     * and the learner starts over for the next code (or to try again,
+     * on a mismatch).
+     *
+     * @param   capture     decoded capture, may be invalid
+     * @param   irData      learned code, single frame, on None
+     *
+     * @return  None once the code is learned, Pending if more captures
+     *          are needed
+     */
+    Error Add(IRData &capture, IRData &irData)
+    {
+        if(!capture.isValid) return NotDecoded;
+
+        m_captures[m_count++] = capture;
+        if(m_count < IRLEARN_CAPTURES) return Pending;
+
+        m_count = 0;
+        return Vote(irData);
+    }
+
+private:
+    IRData m_captures[IRLEARN_CAPTURES];
+    uint8_t m_count;
+    uint8_t m_agreeing;
+    uint8_t m_outvotedBits;
+
+    static bool SameShape(const IRData &a, const IRData &b)
+    {
+        return a.protocol == b.protocol && a.nBits == b.nBits && a.isRepeated == b.isRepeated;
+    }
+
+    Error Vote(IRData &irData)
+    {
+        uint8_t first = 0;
+
+        m_agreeing = 0;
+        m_outvotedBits = 0;
+
+        // the protocol most captures agree on
+        for(uint8_t i = 0; i < IRLEARN_CAPTURES; i++)
+        {
+            uint8_t agreeing = 0;
+
+            for(uint8_t j = 0; j < IRLEARN_CAPTURES; j++)
+            {
+                if(SameShape(m_captures[i], m_captures[j])) agreeing++;
+            }
+
+            if(agreeing > m_agreeing)
+            {
+                m_agreeing = agreeing;
+                first = i;
+            }
+        }
+
+        if(m_agreeing * 2 <= IRLEARN_CAPTURES) return ProtocolMismatch;
+
+        irData = m_captures[first];
+        irData.nextGap = 0;
+
+        // padding bits too, they're the same on all captures
+        for(uint8_t bit = 0; bit < irData.Length() * 8; bit++)
+        {
+            uint8_t byte = bit / 8, mask = 1 << (bit % 8);
+            uint8_t ones = 0;
+
+            for(uint8_t i = 0; i < IRLEARN_CAPTURES; i++)
+            {
+                if(SameShape(m_captures[i], irData) && (m_captures[i].data[byte] & mask)) ones++;
+            }
+
+            if(ones * 2 == m_agreeing) return BitsMismatch;
+            if(ones != 0 && ones != m_agreeing) m_outvotedBits++;
+
+            if(ones * 2 > m_agreeing) irData.data[byte] |= mask;
+            else irData.data[byte] &= ~mask;
+        }
+
+        return None;
+    }
+};
+
+#endif
@@ -2,16 +2,56 @@
 #define IRProtocols_hpp
 
 #include <Arduino.h>
+#include <IRremoteInt.h>
+#include <avr/pgmspace.h>
 #include "Iterator.hpp"
+#include "IRShape.hpp"
 
 /**
- * Encapsulates protocol timings.
+ * Header index resolution: header marks and spaces are classified in
+ * buckets of IRPROTOCOLS_BUCKET_TICKS ticks. Longer widths fall in the
+ * last bucket.
+ */
+#define IRPROTOCOLS_BUCKET_SHIFT    3
+#define IRPROTOCOLS_BUCKET_TICKS    (1 << IRPROTOCOLS_BUCKET_SHIFT)
+#define IRPROTOCOLS_BUCKETS         32
+
+/**
+ * Scale of IRProtocol deviations, and the deviation of a width that
+ * doesn't match at all
+ */
+#define IRPROTOCOL_MAX_DEVIATION    255
+#define IRPROTOCOL_NO_MATCH         0xFFFF
+
+/**
+ * Shortest silence between frames of different codes, in ms, whatever
+ * their protocol: receivers such as IRremote only take a frame as over
+ * after a silence (_GAP) of 5 to 10 ms
+ */
+#define IRPROTOCOL_MIN_FRAME_GAP_MS 10
+
+/**
+ * Encapsulates protocol timings, and the shape of its frames (see
+ * IRShape), which tells where each timing goes.
+ *
+ * Protocols are constant data, kept in flash (see g_irProtocolTable).
+ * Along with each timing, its accepted range in IRremote ticks is
+ * computed at compile time, the same range MATCH_MARK and MATCH_SPACE
+ * accept, so decoding a mark or space is a plain integer comparison.
+ *
+ * As an IRProtocol lives in flash, all members are read with
+ * pgm_read_*(); never copy one to RAM.
  *
  * To add a new protocol, add a new entry on enum Id (and on Name member),
- * and create it on IRProtocols below
+ * and on g_irProtocolTable below
  */
 class IRProtocol
 {
+    friend class IRProtocols;
+    friend struct IRHeaderIndex;
+    template <uint8_t index> friend class IRStaticProtocol;
+    template <uint16_t width, int excess, bool isGap> friend class IRStaticTiming;
+
     public:
 
         /**
@@ -28,40 +68,116 @@ class IRProtocol
             NEC
         };
 
-        IRProtocol(Id i, uint16_t headerMark, uint16_t headerSpace,
+        /**
+         * @param   shape   program of IRShape ops, in flash. Trail and
+         *                  repeat spaces are only used if it has Trail
+         *                  and RepeatFrom ops.
+         */
+        constexpr IRProtocol(Id i, const uint8_t *shape, uint16_t headerMark, uint16_t headerSpace,
                     uint16_t bitMark, uint16_t bitZeroSpace, uint16_t bitOneSpace,
                     uint16_t trailSpace, uint16_t repeatSpace)
-        {
-            m_id = i;
-            m_headerMark = headerMark;
-            m_headerSpace = headerSpace;
-            m_bitMark = bitMark;
-            m_bitZeroSpace = bitZeroSpace;
-            m_bitOneSpace = bitOneSpace;
-            m_trailSpace = trailSpace;
-            m_repeatSpace = repeatSpace;
-        }
+            : m_id(i),
+              m_shape(shape),
+              m_headerMark(headerMark, MARK_EXCESS),
+              m_headerSpace(headerSpace, -MARK_EXCESS),
+              m_bitMark(bitMark, MARK_EXCESS),
+              m_bitZeroSpace(bitZeroSpace, -MARK_EXCESS),
+              m_bitOneSpace(bitOneSpace, -MARK_EXCESS),
+              m_trailSpace(trailSpace, -MARK_EXCESS),
+              m_repeatSpace(repeatSpace, -MARK_EXCESS),
+              m_bitSpaceHigh(Widest(Timing::High(bitZeroSpace, -MARK_EXCESS),
+                                    Timing::High(bitOneSpace, -MARK_EXCESS))),
+              m_frameGapMs(FrameGap(Widest(Widest(headerSpace, Widest(bitZeroSpace, bitOneSpace)),
+                                           Widest(Widest(trailSpace, repeatSpace),
+                                                  IRShape::WidestGapUsecs(shape)))))
+        {}
 
-        IRProtocol(Id i, uint16_t headerMark, uint16_t headerSpace,
+        constexpr IRProtocol(Id i, const uint8_t *shape, uint16_t headerMark, uint16_t headerSpace,
                     uint16_t bitMark, uint16_t bitZeroSpace, uint16_t bitOneSpace)
-            : IRProtocol(i, headerMark, headerSpace,
+            : IRProtocol(i, shape, headerMark, headerSpace,
                             bitMark, bitZeroSpace, bitOneSpace, 0, 0) {};
 
-        Id GetId()              { return m_id; };
-        uint16_t HeaderMark()   { return m_headerMark; }
-        uint16_t HeaderSpace()  { return m_headerSpace; }
-        uint16_t BitMark()      { return m_bitMark; }
-        uint16_t BitZeroSpace() { return m_bitZeroSpace; }
-        uint16_t BitOneSpace()  { return m_bitOneSpace; }
-        uint16_t TrailSpace()   { return m_trailSpace; }
-        uint16_t RepeatSpace()  { return m_repeatSpace; }
+        Id GetId() const              { return (Id) pgm_read_byte(&m_id); };
+        const uint8_t *Shape() const  { return (const uint8_t *) pgm_read_ptr(&m_shape); }
+        uint16_t HeaderMark() const   { return pgm_read_word(&m_headerMark.usecs); }
+        uint16_t HeaderSpace() const  { return pgm_read_word(&m_headerSpace.usecs); }
+        uint16_t BitMark() const      { return pgm_read_word(&m_bitMark.usecs); }
+        uint16_t BitZeroSpace() const { return pgm_read_word(&m_bitZeroSpace.usecs); }
+        uint16_t BitOneSpace() const  { return pgm_read_word(&m_bitOneSpace.usecs); }
+        uint16_t TrailSpace() const   { return pgm_read_word(&m_trailSpace.usecs); }
+        uint16_t RepeatSpace() const  { return pgm_read_word(&m_repeatSpace.usecs); }
 
-        bool HasTrail()     { return m_trailSpace > 0; }
-        bool IsRepeated()   { return m_repeatSpace > 0; }
+        /**
+         * @return  silence needed between a frame of this protocol and
+         *          a frame of another code, in ms, for its receivers to
+         *          tell them apart: twice its widest space, so it can't
+         *          be taken for one, and at least
+         *          IRPROTOCOL_MIN_FRAME_GAP_MS
+         */
+        uint8_t FrameGapMs() const    { return pgm_read_byte(&m_frameGapMs); }
 
-        String Name()
+        /**
+         * Checks a measured width, in ticks, against a timing. Unused
+         * timings (trail and repeat spaces set to 0) never match.
+         */
+        bool MatchHeaderMark(uint16_t ticks) const    { return Match(m_headerMark, ticks); }
+        bool MatchHeaderSpace(uint16_t ticks) const   { return Match(m_headerSpace, ticks); }
+        bool MatchBitMark(uint16_t ticks) const       { return Match(m_bitMark, ticks); }
+        bool MatchBitZeroSpace(uint16_t ticks) const  { return Match(m_bitZeroSpace, ticks); }
+        bool MatchBitOneSpace(uint16_t ticks) const   { return Match(m_bitOneSpace, ticks); }
+        bool MatchTrailSpace(uint16_t ticks) const    { return Match(m_trailSpace, ticks); }
+        bool MatchRepeatSpace(uint16_t ticks) const   { return Match(m_repeatSpace, ticks); }
+
+        /**
+         * Measures how far a width, in ticks, is from a timing, relative
+         * to its accepted range: 0 at the center of the range, up to
+         * IRPROTOCOL_MAX_DEVIATION at its edges. Used to score matches.
+         *
+         * @return  IRPROTOCOL_NO_MATCH if the width doesn't match
+         */
+        uint16_t HeaderMarkDeviation(uint16_t ticks) const    { return Deviation(m_headerMark, ticks); }
+        uint16_t HeaderSpaceDeviation(uint16_t ticks) const   { return Deviation(m_headerSpace, ticks); }
+        uint16_t BitMarkDeviation(uint16_t ticks) const       { return Deviation(m_bitMark, ticks); }
+        uint16_t BitZeroSpaceDeviation(uint16_t ticks) const  { return Deviation(m_bitZeroSpace, ticks); }
+        uint16_t BitOneSpaceDeviation(uint16_t ticks) const   { return Deviation(m_bitOneSpace, ticks); }
+        uint16_t TrailSpaceDeviation(uint16_t ticks) const    { return Deviation(m_trailSpace, ticks); }
+        uint16_t RepeatSpaceDeviation(uint16_t ticks) const   { return Deviation(m_repeatSpace, ticks); }
+
+        /**
+         * Same as above, for the spaces of IRShape::Gap ops, whose range
+         * is computed on each call. The stream decoder calls it from its
+         * interrupt, so it takes integer math only, instead of the
+         * floating point TICKS_LOW and TICKS_HIGH; decoders instantiated
+         * for a protocol take the same range (see IRStaticProtocol).
+         *
+         * @param   usecs   nominal width
+         */
+        static bool MatchGap(uint16_t usecs, uint16_t ticks)
         {
-            switch(m_id)
+            return ticks >= GapLow(usecs) && ticks <= GapHigh(usecs);
+        }
+
+        static constexpr uint16_t GapLow(uint16_t usecs)
+        {
+            return (uint32_t) (usecs - MARK_EXCESS) * (100 - TOLERANCE) / (100 * USECPERTICK);
+        }
+
+        static constexpr uint16_t GapHigh(uint16_t usecs)
+        {
+            return (uint32_t) (usecs - MARK_EXCESS) * (100 + TOLERANCE) / (100 * USECPERTICK) + 1;
+        }
+
+        /**
+         * Widest spaces accepted, in ticks
+         */
+        uint16_t HeaderSpaceHigh() const { return pgm_read_word(&m_headerSpace.high); }
+        uint16_t BitSpaceHigh() const    { return pgm_read_word(&m_bitSpaceHigh); }
+        uint16_t TrailSpaceHigh() const  { return pgm_read_word(&m_trailSpace.high); }
+        uint16_t RepeatSpaceHigh() const { return pgm_read_word(&m_repeatSpace.high); }
+
+        String Name() const
+        {
+            switch(GetId())
             {
                 case Junco:     return String(F("Junco"));
                 case Yawl:      return String(F("Yawl"));
@@ -75,66 +191,290 @@ class IRProtocol
         }
 
     private:
+
+        /**
+         * A nominal width, and the range of ticks accepted for it
+         */
+        struct Timing
+        {
+            uint16_t usecs;
+            uint16_t low;       // greater than high if unused
+            uint16_t high;
+            uint16_t scale;     // deviation per tick off center, 8.8 fixed point
+
+            /**
+             * @param   excess  MARK_EXCESS for marks, -MARK_EXCESS for spaces
+             */
+            constexpr Timing(uint16_t width, int excess)
+                : usecs(width), low(Low(width, excess)), high(High(width, excess)),
+                  scale(Scale(Low(width, excess), High(width, excess))) {}
+
+            static constexpr uint16_t Low(uint16_t width, int excess)
+            {
+                return width ? TICKS_LOW(width + excess) : 0xFFFF;
+            }
+
+            static constexpr uint16_t High(uint16_t width, int excess)
+            {
+                return width ? TICKS_HIGH(width + excess) : 0;
+            }
+
+            /**
+             * Off-center distances are doubled, so the range edges are
+             * at high - low
+             */
+            static constexpr uint16_t Scale(uint16_t low, uint16_t high)
+            {
+                return high > low ? ((uint32_t) IRPROTOCOL_MAX_DEVIATION << 8) / (high - low) : 0;
+            }
+        };
+
         Id  m_id;
-        uint16_t m_headerMark;
-        uint16_t m_headerSpace;
-        uint16_t m_bitMark;
-        uint16_t m_bitZeroSpace;
-        uint16_t m_bitOneSpace;
-        uint16_t m_trailSpace;
-        uint16_t m_repeatSpace;
+        const uint8_t *m_shape;
+        Timing m_headerMark;
+        Timing m_headerSpace;
+        Timing m_bitMark;
+        Timing m_bitZeroSpace;
+        Timing m_bitOneSpace;
+        Timing m_trailSpace;
+        Timing m_repeatSpace;
+        uint16_t m_bitSpaceHigh;
+        uint8_t m_frameGapMs;
+
+        static constexpr uint16_t Widest(uint16_t a, uint16_t b) { return a > b ? a : b; }
+
+        /**
+         * @param   widestSpace     in microseconds
+         */
+        static constexpr uint8_t FrameGap(uint16_t widestSpace)
+        {
+            return Widest(IRPROTOCOL_MIN_FRAME_GAP_MS, (2 * (uint32_t) widestSpace + 999) / 1000);
+        }
+
+        static bool Match(const Timing &timing, uint16_t ticks)
+        {
+            return ticks >= pgm_read_word(&timing.low) && ticks <= pgm_read_word(&timing.high);
+        }
+
+        static uint16_t Deviation(const Timing &timing, uint16_t ticks)
+        {
+            uint16_t low = pgm_read_word(&timing.low), high = pgm_read_word(&timing.high);
+
+            if(ticks < low || ticks > high) return IRPROTOCOL_NO_MATCH;
+
+            return Deviation(low, high, pgm_read_word(&timing.scale), ticks);
+        }
+
+        static uint16_t Deviation(uint16_t low, uint16_t high, uint16_t scale, uint16_t ticks)
+        {
+            // doubled, so the center needs no rounding
+            uint16_t offCenter = abs((int16_t) (2 * ticks - low - high));
+            return ((uint32_t) offCenter * scale) >> 8;
+        }
 };
 
 
 /**
- * Collection of protocols to encode and decode IRData.
+ * All protocols used in this project, in flash. Their order is the
+ * order decoders try them.
+ */
+constexpr IRProtocol g_irProtocolTable[] PROGMEM =
+{
+    IRProtocol(IRProtocol::Junco, g_irShapePlain, 9000, 4500, 550, 550, 1650),
+    IRProtocol(IRProtocol::Yawl, g_irShapePlain, 3350, 1700, 350, 450, 1300),
+    IRProtocol(IRProtocol::Draftee, g_irShapeTrail, 6000, 7400, 450, 650, 1700, 7400, 0),
+    IRProtocol(IRProtocol::Ampul, g_irShapeRepeat, 4350, 4450, 450, 600, 1700, 0, 5450),
+    IRProtocol(IRProtocol::Marl, g_irShapePlain, 3100, 8900, 450, 550, 1600),
+    IRProtocol(IRProtocol::Pomander, g_irShapePlain, 8850, 4500, 500, 700, 1650),
+    IRProtocol(IRProtocol::NEC, g_irShapePlain, 4400, 4400, 500, 600, 1700)
+};
+
+#define IRPROTOCOLS_COUNT   (sizeof(g_irProtocolTable) / sizeof(g_irProtocolTable[0]))
+
+static_assert(IRPROTOCOLS_COUNT <= 16, "header index holds up to 16 protocols");
+
+
+/**
+ * Header index of g_irProtocolTable, computed at compile time: bit n of
+ * a bucket is set if the header mark (or space) of protocol n may fall
+ * in it, i.e. if its timing window overlaps the bucket
+ */
+struct IRHeaderIndex
+{
+    static constexpr uint8_t Bucket(uint16_t ticks)
+    {
+        return (ticks >> IRPROTOCOLS_BUCKET_SHIFT) < IRPROTOCOLS_BUCKETS
+            ? ticks >> IRPROTOCOLS_BUCKET_SHIFT : IRPROTOCOLS_BUCKETS - 1;
+    }
+
+    static constexpr bool Overlaps(const IRProtocol::Timing &timing, uint8_t bucket)
+    {
+        return timing.low <= timing.high && Bucket(timing.low) <= bucket && bucket <= Bucket(timing.high);
+    }
+
+    static constexpr uint16_t Candidates(bool isMark, uint8_t bucket, uint8_t i = 0)
+    {
+        return i == IRPROTOCOLS_COUNT ? 0
+            : (Overlaps(isMark ? g_irProtocolTable[i].m_headerMark : g_irProtocolTable[i].m_headerSpace,
+                        bucket) ? 1 << i : 0)
+              | Candidates(isMark, bucket, i + 1);
+    }
+};
+
+#define IRHEADER_INDEX_4(isMark, bucket) \
+    IRHeaderIndex::Candidates(isMark, bucket), IRHeaderIndex::Candidates(isMark, bucket + 1), \
+    IRHeaderIndex::Candidates(isMark, bucket + 2), IRHeaderIndex::Candidates(isMark, bucket + 3)
+
+#define IRHEADER_INDEX_ROW(isMark) \
+    { \
+        IRHEADER_INDEX_4(isMark, 0), IRHEADER_INDEX_4(isMark, 4), \
+        IRHEADER_INDEX_4(isMark, 8), IRHEADER_INDEX_4(isMark, 12), \
+        IRHEADER_INDEX_4(isMark, 16), IRHEADER_INDEX_4(isMark, 20), \
+        IRHEADER_INDEX_4(isMark, 24), IRHEADER_INDEX_4(isMark, 28) \
+    }
+
+static_assert(IRPROTOCOLS_BUCKETS == 32, "IRHEADER_INDEX_ROW lists 32 buckets");
+
+/**
+ * Header index in flash: header marks, then header spaces
+ */
+constexpr uint16_t g_irHeaderIndex[2][IRPROTOCOLS_BUCKETS] PROGMEM =
+{
+    IRHEADER_INDEX_ROW(true),
+    IRHEADER_INDEX_ROW(false)
+};
+
+
+/**
+ * A timing known at compile time, with the same range and deviation
+ * IRProtocol computes for it, as constants
  *
- * Add a new protocol on class constructor
+ * @param   width   nominal width, in microseconds
+ * @param   excess  MARK_EXCESS for marks, -MARK_EXCESS for spaces
+ * @param   isGap   space of an IRShape::Gap op (see IRProtocol::MatchGap)
  */
-class IRProtocols : public Iterator<IRProtocol *>
+template <uint16_t width, int excess, bool isGap = false> class IRStaticTiming
 {
-    private:
-        IRProtocol *m_protocols[10];
+public:
+    static const uint16_t usecs = width;
+    static const uint16_t low = isGap ? IRProtocol::GapLow(width) : IRProtocol::Timing::Low(width, excess);
+    static const uint16_t high = isGap ? IRProtocol::GapHigh(width) : IRProtocol::Timing::High(width, excess);
+    static const uint16_t scale = IRProtocol::Timing::Scale(low, high);
 
-    public:
-        IRProtocols()
-        {
-            m_count = 0;     // from Iterator
+    static bool Match(uint16_t ticks) { return ticks >= low && ticks <= high; }
 
-            m_protocols[m_count++] = new IRProtocol(
-                IRProtocol::Junco, 9000, 4500, 550, 550, 1650
-                );
+    /**
+     * @see     IRProtocol::HeaderMarkDeviation and the like
+     */
+    static uint16_t Deviation(uint16_t ticks)
+    {
+        if(!Match(ticks)) return IRPROTOCOL_NO_MATCH;
 
-            m_protocols[m_count++] = new IRProtocol(
-                IRProtocol::Yawl, 3350, 1700, 350, 450, 1300
-                );
+        return IRProtocol::Deviation(low, high, scale, ticks);
+    }
+};
 
-            m_protocols[m_count++] = new IRProtocol(
-                IRProtocol::Draftee, 6000, 7400, 450, 650, 1700, 7400, 0
-                );
+/**
+ * Compile-time view of g_irProtocolTable[index]: its id, timings and
+ * shape ops, as constants. Decoders and senders instantiated for a
+ * protocol (see IRStaticProtocols) fold them into their code, instead
+ * of reading them from flash on every width.
+ */
+template <uint8_t index> class IRStaticProtocol
+{
+public:
+    static const IRProtocol::Id id = g_irProtocolTable[index].m_id;
 
-            m_protocols[m_count++] = new IRProtocol(
-                IRProtocol::Ampul, 4350, 4450, 450, 600, 1700, 0, 5450
-                );
+    typedef IRStaticTiming<g_irProtocolTable[index].m_headerMark.usecs, MARK_EXCESS> HeaderMark;
+    typedef IRStaticTiming<g_irProtocolTable[index].m_headerSpace.usecs, -MARK_EXCESS> HeaderSpace;
+    typedef IRStaticTiming<g_irProtocolTable[index].m_bitMark.usecs, MARK_EXCESS> BitMark;
+    typedef IRStaticTiming<g_irProtocolTable[index].m_bitZeroSpace.usecs, -MARK_EXCESS> BitZeroSpace;
+    typedef IRStaticTiming<g_irProtocolTable[index].m_bitOneSpace.usecs, -MARK_EXCESS> BitOneSpace;
+    typedef IRStaticTiming<g_irProtocolTable[index].m_trailSpace.usecs, -MARK_EXCESS> TrailSpace;
+    typedef IRStaticTiming<g_irProtocolTable[index].m_repeatSpace.usecs, -MARK_EXCESS> RepeatSpace;
 
-            m_protocols[m_count++] = new IRProtocol(
-                IRProtocol::Marl, 3100, 8900, 450, 550, 1600
-                );
+    /**
+     * Space of an IRShape::Gap op
+     */
+    template <uint8_t units> using GapSpace = IRStaticTiming<units * IRShape::GapUnitUsecs, -MARK_EXCESS, true>;
 
-            m_protocols[m_count++] = new IRProtocol(
-                IRProtocol::Pomander, 8850, 4500, 500, 700, 1650
-                );
+    /**
+     * @return  byte of the shape program at pc
+     */
+    static constexpr uint8_t Op(uint8_t pc) { return g_irProtocolTable[index].m_shape[pc]; }
 
-            m_protocols[m_count++] = new IRProtocol(
-                IRProtocol::NEC, 4400, 4400, 500, 600, 1700
-                );
+    /**
+     * @return  offset of the op after the one at pc
+     */
+    static constexpr uint8_t NextOp(uint8_t pc) { return pc + 1 + IRShape::OperandCount(Op(pc)); }
+
+    /**
+     * @return  operand of the first RepeatFrom op, from pc on (0 if
+     *          there's none)
+     */
+    static constexpr uint8_t RepeatTarget(uint8_t pc = 0)
+    {
+        return Op(pc) == IRShape::End ? 0
+            : Op(pc) == IRShape::RepeatFrom ? Op(pc + 1) : RepeatTarget(NextOp(pc));
+    }
+};
+
+/**
+ * Compile-time list of the IRStaticProtocol types, from index to the
+ * end of g_irProtocolTable, to run a kernel instantiated for each
+ * protocol:
+ *
+ *     IRStaticProtocols<>::Dispatch<Kernel>(id, unknown, args...)
+ *
+ * calls Kernel<index>::Run(args...) for the protocol with that id.
+ * Ids are constants, so this is a switch on them, and each protocol
+ * gets its own code.
+ */
+template <uint8_t index = 0> class IRStaticProtocols
+{
+public:
+
+    /**
+     * @param   unknown     returned if no protocol has that id
+     */
+    template <template <uint8_t> class Kernel, class Result, class... Args>
+    static Result Dispatch(IRProtocol::Id id, Result unknown, Args &... args)
+    {
+        return id == IRStaticProtocol<index>::id ? Kernel<index>::Run(args...)
+            : IRStaticProtocols<index + 1>::template Dispatch<Kernel>(id, unknown, args...);
+    }
+};
+
+template <> class IRStaticProtocols<IRPROTOCOLS_COUNT>
+{
+public:
+    template <template <uint8_t> class Kernel, class Result, class... Args>
+    static Result Dispatch(IRProtocol::Id, Result unknown, Args &...)
+    {
+        return unknown;
+    }
+};
+
+
+/**
+ * Collection of protocols to encode and decode IRData.
+ *
+ * Add a new protocol on g_irProtocolTable
+ */
+class IRProtocols : public Iterator<const IRProtocol *>
+{
+    public:
+        IRProtocols()
+        {
+            m_count = IRPROTOCOLS_COUNT;     // from Iterator
+            m_iteratorIndex = 0;
         }
 
         void First()        // from Iterator
         {
             if(m_count == 0) return;
 
-            m_current = m_protocols[0];
+            m_current = &g_irProtocolTable[0];
             m_iteratorIndex = 0;
         }
 
@@ -143,12 +483,43 @@ class IRProtocols : public Iterator<IRProtocol *>
             if(IsDone()) return;
             m_iteratorIndex++;
             if(IsDone()) return;
-            m_current = m_protocols[m_iteratorIndex];
+            m_current = &g_irProtocolTable[m_iteratorIndex];
+        }
+
+        using Iterator<const IRProtocol *>::Count;
+        using Iterator<const IRProtocol *>::IsDone;
+        using Iterator<const IRProtocol *>::Current;
+
+        /**
+         * @param   index   0 to Count() - 1
+         */
+        const IRProtocol * At(uint8_t index) { return &g_irProtocolTable[index]; }
+
+        /**
+         * Looks up the protocols whose header may match the given one,
+         * in constant time regardless of the number of protocols.
+         *
+         * Candidates still have to be confirmed with MatchHeaderMark and
+         * MatchHeaderSpace, as buckets are coarser than timing windows.
+         *
+         * @param   markTicks   header mark width, in ticks
+         * @param   spaceTicks  header space width, in ticks
+         *
+         * @return  bit n set if At(n) is a candidate
+         */
+        uint16_t HeaderCandidates(uint16_t markTicks, uint16_t spaceTicks)
+        {
+            return pgm_read_word(&g_irHeaderIndex[0][IRHeaderIndex::Bucket(markTicks)])
+                & pgm_read_word(&g_irHeaderIndex[1][IRHeaderIndex::Bucket(spaceTicks)]);
         }
 
-        using Iterator<IRProtocol *>::Count;
-        using Iterator<IRProtocol *>::IsDone;
-        using Iterator<IRProtocol *>::Current;
+        /**
+         * @see     HeaderCandidates, for when only the mark is known
+         */
+        uint16_t HeaderMarkCandidates(uint16_t markTicks)
+        {
+            return pgm_read_word(&g_irHeaderIndex[0][IRHeaderIndex::Bucket(markTicks)]);
+        }
 
 
         /**
@@ -158,7 +529,7 @@ class IRProtocols : public Iterator<IRProtocol *>
          *
          * @return  null if not found
          */
-        IRProtocol * GetProtocol(IRProtocol::Id id)
+        const IRProtocol * GetProtocol(IRProtocol::Id id)
         {
             First();
             while(!IsDone())
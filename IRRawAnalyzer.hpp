@@ -5,120 +5,353 @@
 #include "IRData.hpp"
 #include "IRProtocols.hpp"
 
-#define MAX_DIFFERENT_VALUES 30
+/**
+ * Timing histogram resolution: widths are counted in bins of
+ * IRANALYZER_BIN_TICKS ticks, up to IRANALYZER_BINS bins (12.8 ms).
+ * Longer widths are only counted, as they're usually gaps.
+ */
+#define IRANALYZER_BIN_TICKS    4
+#define IRANALYZER_BINS         64
+#define IRANALYZER_CLUSTERS     8
 
 /**
- * Register a new timing found, updating two other related arrays
- * (in our case, 'count' and 'polarity').
+ * Widths of a single polarity (marks or spaces), grouped in clusters
+ * of nearby values, in ascending order.
+ */
+struct IRTimingClusters
+{
+    uint8_t count;
+    uint16_t ticks[IRANALYZER_CLUSTERS];    // mean width
+    uint8_t hits[IRANALYZER_CLUSTERS];      // number of occurrences
+    uint8_t firstBin[IRANALYZER_CLUSTERS];
+    uint8_t lastBin[IRANALYZER_CLUSTERS];
+
+    /**
+     * @return  cluster holding a width, or -1 if none
+     */
+    int8_t Find(unsigned int width) const
+    {
+        unsigned int bin = width / IRANALYZER_BIN_TICKS;
+
+        for(uint8_t i = 0; i < count; i++)
+        {
+            if(bin >= firstBin[i] && bin <= lastBin[i]) return i;
+        }
+        return -1;
+    }
+
+    /**
+     * @return  cluster with most occurrences, ignoring up to two of them
+     */
+    int8_t MostFrequent(int8_t except1, int8_t except2) const
+    {
+        return MostFrequent(hits, except1, except2);
+    }
+
+    /**
+     * @param   counts  occurrences of each cluster (e.g. only some of them)
+     *
+     * @return  cluster with most occurrences, ignoring up to two of
+     *          them, or -1 if none occurs
+     */
+    int8_t MostFrequent(const uint8_t *counts, int8_t except1, int8_t except2) const
+    {
+        int8_t best = -1;
+
+        for(uint8_t i = 0; i < count; i++)
+        {
+            if(i == except1 || i == except2 || counts[i] == 0) continue;
+            if(best < 0 || counts[i] > counts[best]) best = i;
+        }
+        return best;
+    }
+};
+
+/**
+ * Counts the widths of a polarity on the histogram bins
  *
- * Insertion sort used.
- * 
- * @param  target       the timing array
- * @param  value        new timing to be inserted
- * @param  lastFree     last free position
- * @param  related1     array whose data is related to target
- * @param  related2     idem
- * 
- * @return              index where 'value' was inserted
+ * @param   results     raw data
+ * @param   isMark      polarity counted (marks are on odd offsets)
+ * @param   binCount    destination, occurrences on each bin
+ *
+ * @return  widths too long for the bins
  */
-char addTiming(unsigned int *target, unsigned int value, unsigned char lastFree,
-    unsigned char *related1, unsigned char *related2
-    )
+uint8_t countTimings(decode_results *results, bool isMark, uint8_t *binCount)
 {
-    unsigned int temp = 0;
+    uint8_t longCount = 0;
+
+    memset(binCount, 0, IRANALYZER_BINS);
+
+    // Skip initial space
+    for(uint16_t offset = isMark ? 1 : 2; offset < results->rawlen; offset += 2)
+    {
+        unsigned int bin = results->rawbuf[offset] / IRANALYZER_BIN_TICKS;
+
+        if(bin >= IRANALYZER_BINS)
+        {
+            if(longCount < 255) longCount++;
+        }
+        else if(binCount[bin] < 255)
+        {
+            binCount[bin]++;
+        }
+    }
+
+    return longCount;
+}
 
-    target[lastFree] = value;
+/**
+ * Groups the histogram bins of a polarity. Neighbouring bins belong to
+ * the same cluster while their widths are within the decoder tolerance
+ * of each other (or two bins apart, for short widths, as receiver jitter
+ * doesn't scale with them), so jitter doesn't split a timing in two.
+ * Bins are compared by their middle width; the mean of each cluster is
+ * measured afterwards, on the raw data (see measureClusters).
+ *
+ * @param   binCount    occurrences on each bin
+ * @param   clusters    destination
+ */
+void clusterTimings(const uint8_t *binCount, IRTimingClusters &clusters)
+{
+    uint16_t firstMiddle = 0;
+    bool open = false;
 
-    // returns if it's the first value being inserted
-    if(lastFree == 0) return 0;
+    clusters.count = 0;
 
-    for(char i = lastFree - 1; i >= 0; i--)
+    for(uint8_t bin = 0; bin <= IRANALYZER_BINS; bin++)
     {
-        if(target[i] <= target[i + 1]) return i + 1;
+        bool empty = bin == IRANALYZER_BINS || binCount[bin] == 0;
+        uint16_t middle = bin * IRANALYZER_BIN_TICKS + IRANALYZER_BIN_TICKS / 2;
 
-        temp = target[i];
-        target[i] = target[i+1];
-        target[i+1] = temp;
+        if(!empty && open
+            && (middle - firstMiddle <= 2 * IRANALYZER_BIN_TICKS
+                || (uint32_t) middle * (100 - TOLERANCE) <= (uint32_t) firstMiddle * (100 + TOLERANCE)))
+        {
+            continue;
+        }
 
-        temp = related1[i];
-        related1[i] = related1[i+1];
-        related1[i+1] = temp;
+        // closes the current cluster
+        if(open && clusters.count < IRANALYZER_CLUSTERS)
+        {
+            clusters.lastBin[clusters.count] = bin - 1;
+            clusters.count++;
+        }
+
+        open = !empty;
+        if(empty) continue;
 
-        temp = related2[i];
-        related2[i] = related2[i+1];
-        related2[i+1] = temp;
+        // and starts a new one
+        firstMiddle = middle;
+        if(clusters.count < IRANALYZER_CLUSTERS) clusters.firstBin[clusters.count] = bin;
     }
+}
 
-    return 0;
+/**
+ * Measures the mean width and occurrences of each cluster, over the
+ * widths of its polarity on the raw data
+ *
+ * @param   results     raw data
+ * @param   isMark      polarity of the clusters
+ * @param   clusters    clusters found by clusterTimings
+ */
+void measureClusters(decode_results *results, bool isMark, IRTimingClusters &clusters)
+{
+    for(uint8_t i = 0; i < clusters.count; i++)
+    {
+        uint32_t sum = 0;
+        uint16_t hits = 0;
+
+        for(uint16_t offset = isMark ? 1 : 2; offset < results->rawlen; offset += 2)
+        {
+            if(clusters.Find(results->rawbuf[offset]) != i) continue;
+
+            sum += results->rawbuf[offset];
+            hits++;
+        }
+
+        clusters.ticks[i] = (sum + hits / 2) / hits;
+        clusters.hits[i] = hits < 255 ? hits : 255;
+    }
 }
 
 /**
- * Counts the occurrences of each timing, and prints
- * in ascending order.
- * 
- * @param results   raw data
+ * @return  nominal width, in microseconds, of a mark (or space) measured
+ *          in ticks, rounded to the nearest cluster if there's one
  */
-void analyze(decode_results *results)
+uint16_t nominalWidth(const IRTimingClusters &clusters, unsigned int width, bool isMark)
 {
-    uint8_t offset = 1;     // Skip initial space
-    uint8_t nBits = 0;      // # of bits received (mark-space pairs)
-    uint8_t rawLength = results->rawlen;
-    unsigned char i;
+    int8_t cluster = clusters.Find(width);
+    uint16_t usecs = (cluster < 0 ? width : clusters.ticks[cluster]) * USECPERTICK;
 
-    unsigned int values[MAX_DIFFERENT_VALUES] = {0};    // time width
-    unsigned char count[MAX_DIFFERENT_VALUES] = {0};    // number of occurrences
-    unsigned char polarity[MAX_DIFFERENT_VALUES] = {0}; // if it's a mark or space
-    unsigned int value = 0;
-    unsigned char occupied = 1;     // number of different timings found
-    unsigned char pol = 1;          // 1 for mark, 0 for space
+    return isMark ? usecs - MARK_EXCESS : usecs + MARK_EXCESS;
+}
+
+/**
+ * Infers the timings of an unknown protocol from a single capture, and
+ * prints them as an IRProtocol entry for g_irProtocolTable.
+ *
+ * The header is the first mark and space; the bit mark is the most
+ * frequent mark; the two most frequent spaces between the header and
+ * the space before the last mark (other than the header space) are the
+ * zero (shorter) and one spaces, so a trail or gap isn't taken for a
+ * bit. A capture whose bits all have the same value doesn't tell both
+ * spaces apart. Any other space is a trail, if it's right before the
+ * last mark, or a repeat, if followed by a header mark, which tells the
+ * shape (see IRShape).
+ *
+ * @param   results     raw data
+ * @param   marks       clusters of all marks
+ * @param   spaces      clusters of all spaces
+ */
+void synthesizeProtocol(decode_results *results,
+    const IRTimingClusters &marks, const IRTimingClusters &spaces)
+{
+    uint16_t rawLength = results->rawlen;
+    uint16_t trailSpace = 0, repeatSpace = 0;
+    uint8_t bitHits[IRANALYZER_CLUSTERS] = {0};
+    uint8_t nBits = 0;
 
-    values[0] = results->rawbuf[offset];
-    count[0] = 1;
-    polarity[0] = pol;  // first timing is a mark
+    if(rawLength < 6)
+    {
+        Serial.println(F("too short to infer a protocol"));
+        return;
+    }
 
-    for(offset = 2; offset < rawLength; offset++)
+    // spaces of the bits, up to (not including) the trail position
+    for(uint16_t offset = 4; offset < rawLength - 2; offset += 2)
     {
-        value = results->rawbuf[offset];
+        int8_t space = spaces.Find(results->rawbuf[offset]);
 
-        pol = pol ? 0 : 1;      // flip polarity i.e. if the last was a mark,
-                                // this is a space
+        if(space >= 0 && bitHits[space] < 255) bitHits[space]++;
+    }
+
+    int8_t headerMark = marks.Find(results->rawbuf[1]);
+    int8_t headerSpace = spaces.Find(results->rawbuf[2]);
+    int8_t bitMark = marks.MostFrequent(-1, -1);
+    int8_t zeroSpace = spaces.MostFrequent(bitHits, headerSpace, -1);
+    int8_t oneSpace = spaces.MostFrequent(bitHits, headerSpace, zeroSpace);
+
+    if(bitMark < 0 || zeroSpace < 0)
+    {
+        Serial.println(F("no bit timings found"));
+        return;
+    }
+
+    if(oneSpace < 0)
+    {
+        Serial.println(F("bits are all alike, capture a code with both values"));
+        return;
+    }
+
+    if(spaces.ticks[oneSpace] < spaces.ticks[zeroSpace])
+    {
+        int8_t temp = oneSpace;
+        oneSpace = zeroSpace;
+        zeroSpace = temp;
+    }
+
+    // bits are mark-space pairs after the header
+    for(uint16_t offset = 3; offset + 1 < rawLength; offset += 2)
+    {
+        unsigned int width = results->rawbuf[offset + 1];
+        int8_t space = spaces.Find(width);
 
-        // see if the timing was found before
-        for(i = 0; i < occupied; i++)
+        if(space == zeroSpace || space == oneSpace)
         {
-            // if found before, add to count
-            if(value == values[i] && pol == polarity[i])
-            {
-                count[i]++;
-                break;
-            }
+            nBits++;
         }
+        else if(offset + 2 == rawLength - 1)
+        {
+            trailSpace = nominalWidth(spaces, width, false);
+        }
+        else if(headerMark >= 0 && marks.Find(results->rawbuf[offset + 2]) == headerMark)
+        {
+            repeatSpace = nominalWidth(spaces, width, false);
+            break;
+        }
+        else
+        {
+            Serial.print(F("unexpected space at "));
+            Serial.println(offset + 1);
+            return;
+        }
+    }
+
+    Serial.print(F("Protocol: IRProtocol(IRProtocol::NewProtocol, "));
+
+    // the shape that has the widths found
+    if(trailSpace) Serial.print(F("g_irShapeTrail, "));
+    else if(repeatSpace) Serial.print(F("g_irShapeRepeat, "));
+    else Serial.print(F("g_irShapePlain, "));
+
+    Serial.print(nominalWidth(marks, results->rawbuf[1], true));
+    Serial.print(F(", "));
+    Serial.print(nominalWidth(spaces, results->rawbuf[2], false));
+    Serial.print(F(", "));
+    Serial.print(marks.ticks[bitMark] * USECPERTICK - MARK_EXCESS);
+    Serial.print(F(", "));
+    Serial.print(spaces.ticks[zeroSpace] * USECPERTICK + MARK_EXCESS);
+    Serial.print(F(", "));
+    Serial.print(spaces.ticks[oneSpace] * USECPERTICK + MARK_EXCESS);
+    Serial.print(F(", "));
+    Serial.print(trailSpace);
+    Serial.print(F(", "));
+    Serial.print(repeatSpace);
+    Serial.println(F("),"));
+
+    Serial.print(F("bits "));
+    Serial.println(nBits);
+}
+
+/**
+ * Counts the occurrences of each timing, grouping nearby widths in
+ * clusters, and prints them in ascending order, marks first. Then
+ * infers a protocol from them.
+ *
+ * A polarity at a time, with a byte per histogram bin, so the stack
+ * only takes the bins of one polarity and the clusters of both (about
+ * 150 bytes). Each cluster takes a pass over the raw data to measure
+ * its mean, plus one to infer the protocol: a few ms, even for noisy
+ * captures.
+ *
+ * @param results   raw data
+ */
+void analyze(decode_results *results)
+{
+    uint8_t binCount[IRANALYZER_BINS];
+    uint8_t longCount = 0;
+    IRTimingClusters clusters[2];           // [0] spaces, [1] marks
 
-        // otherwise, insert a new timing
-        if(i == occupied)
+    for(uint8_t pol = 2; pol-- > 0; )
+    {
+        uint8_t longs = countTimings(results, pol, binCount);
+
+        longCount = longCount + longs < 255 ? longCount + longs : 255;
+        clusterTimings(binCount, clusters[pol]);
+        measureClusters(results, pol, clusters[pol]);
+    }
+
+    // prints the timing frequency, marks first
+    for(uint8_t pol = 2; pol-- > 0; )
+    {
+        for(uint8_t i = 0; i < clusters[pol].count; i++)
         {
-            // values[i] = value
-            i = addTiming(values, value, i, count, polarity);
-            count[i] = 1;
-            polarity[i] = pol;
-            occupied++;
-
-            if(occupied == MAX_DIFFERENT_VALUES)
-            {
-                Serial.println("overflow");
-                return;
-            }
+            Serial.print( pol ? '+' : '-' );
+            Serial.print((unsigned long) clusters[pol].ticks[i]*USECPERTICK, DEC);
+            Serial.print(' ');
+            Serial.println(clusters[pol].hits[i], DEC);
         }
     }
 
-    // prints the timing frequency
-    for(i = 0; i < occupied; i++)
+    if(longCount > 0)
     {
-        Serial.print( polarity[i] ? '+' : '-' );
-        Serial.print((unsigned long) values[i]*USECPERTICK, DEC);
-        Serial.print(" ");
-        Serial.println(count[i], DEC);
+        Serial.print(F("longer than "));
+        Serial.print((unsigned long) IRANALYZER_BINS*IRANALYZER_BIN_TICKS*USECPERTICK, DEC);
+        Serial.print(F(": "));
+        Serial.println(longCount, DEC);
     }
+
+    synthesizeProtocol(results, clusters[1], clusters[0]);
 }
 
 
@@ -131,9 +364,9 @@ void analyze(decode_results *results)
 void dumpRaw(decode_results *results)
 {
     // Print Raw data
-    Serial.print("Timing[");
+    Serial.print(F("Timing["));
     Serial.print(results->rawlen-1, DEC);
-    Serial.println("]: ");
+    Serial.println(F("]: "));
 
     for (int i = 1;  i < results->rawlen;  i++)
     {
@@ -141,28 +374,28 @@ void dumpRaw(decode_results *results)
 
         if (!(i & 1))   // Even
         {
-            Serial.print("-");
-            if (x < 1000)  Serial.print(" ") ;
-            if (x < 100)   Serial.print(" ") ;
+            Serial.print('-');
+            if (x < 1000)  Serial.print(' ') ;
+            if (x < 100)   Serial.print(' ') ;
             Serial.print(x, DEC);
         }
         else            // Odd
         {
-            Serial.print("     ");
-            Serial.print("+");
-            if (x < 1000)  Serial.print(" ") ;
-            if (x < 100)   Serial.print(" ") ;
+            Serial.print(F("     "));
+            Serial.print('+');
+            if (x < 1000)  Serial.print(' ') ;
+            if (x < 100)   Serial.print(' ') ;
             Serial.print(x, DEC);
-            if (i < results->rawlen-1) Serial.print(", "); //',' not needed for last one
+            if (i < results->rawlen-1) Serial.print(F(", ")); //',' not needed for last one
         }
 
-        if (!(i % 8))  Serial.println("");
+        if (!(i % 8))  Serial.println();
     }
 
-    Serial.println("");                    // Newline
-    if(results->overflow) Serial.println("Overflow occurred");
+    Serial.println();                    // Newline
+    if(results->overflow) Serial.println(F("Overflow occurred"));
 
-    Serial.println("============================================");
+    Serial.println(F("============================================"));
 }
 
 
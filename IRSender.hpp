@@ -4,85 +4,219 @@
 #include <Arduino.h>
 #include "IRProtocols.hpp"
 #include "IRData.hpp"
+#include "IRStats.hpp"
 
 void sendIR(IRsend &irSender, IRData &irData);
 void sendIRBlock(IRsend &irSender, IRData &irData);
 
 /**
- * Sends infrared data with given IRsend. Based on sendNEC
- * function from IRremote library.
- * 
- * @param   irSender    sender object from IRremote library
- * @param   irData      to be sent
+ * A frame being sent by its protocol's sender (see IRSendSegment)
  */
-void sendIR(IRsend &irSender, IRData &irData)
+struct IRSendWalk
 {
-    // Set IR carrier frequency (38 kHz)
-    irSender.enableIROut(38);
+    const uint8_t *bits;
+    uint8_t nBits;
+    uint8_t bit;            // next one
+    bool repeat;            // RepeatFrom ops are taken
+    bool repeating;         // a RepeatFrom op was taken
+};
 
-    if (!irData.isValid || irData.protocol == NULL)
-        return;
+/**
+ * Sender of a protocol, from an op of its shape on (see IRShape),
+ * instantiated for each op with the op and the protocol timings as
+ * constants, so it plays the same marks and spaces as IRWaveform with
+ * no shape or timing lookups between them.
+ *
+ * A taken RepeatFrom op stops the walk, with walk.repeating set, and
+ * IRSendKernel starts it again from the op it repeats.
+ */
+template <uint8_t index, uint8_t pc, uint8_t op = IRStaticProtocol<index>::Op(pc)>
+class IRSendSegment;
 
-    sendIRBlock(irSender, irData);
+template <uint8_t index, uint8_t pc>
+class IRSendSegment<index, pc, IRShape::Header>
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRSendSegment<index, Protocol::NextOp(pc)> Next;
 
-    if (irData.isRepeated)
+public:
+    template <class Sender> static void Run(Sender &irSender, IRSendWalk &walk)
     {
-        irSender.space(irData.protocol->RepeatSpace());
-        sendIRBlock(irSender, irData);
+        irSender.mark(Protocol::HeaderMark::usecs);
+        irSender.space(Protocol::HeaderSpace::usecs);
+
+        Next::Run(irSender, walk);
     }
-}
+};
 
-/**
- * Sends a single header and data block
- * 
- * @param irSender
- * @param irData
- */
-void sendIRBlock(IRsend &irSender, IRData &irData)
+template <uint8_t index, uint8_t pc>
+class IRSendSegment<index, pc, IRShape::Bits>
 {
-    // Header
-    irSender.mark(irData.protocol->HeaderMark());
-    irSender.space(irData.protocol->HeaderSpace());
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRSendSegment<index, Protocol::NextOp(pc)> Next;
 
-    uint8_t currentBit = 0;     // bit to be sent
-    uint8_t currentByte = 0;    // byte where the currentBit is located
-    uint8_t mask = 0;           // binary mask to extract currentBit from currentByte
+    static const uint8_t count = Protocol::Op(pc + 1);
 
-    for (uint8_t bitIndex = 0; bitIndex < irData.nBits; bitIndex++)
+public:
+    template <class Sender> static void Run(Sender &irSender, IRSendWalk &walk)
     {
-        // Same for both bit values
-        irSender.mark(irData.protocol->BitMark());
+        uint8_t left = walk.nBits - walk.bit;
 
-        currentByte = irData.data[(int) bitIndex/8];
+        if(count != IRShape::AllBits && count < left) left = count;
 
-        // bits are sent from MSB to LSB, i.e. given the same byte,
-        // the first bit is selected using the mask 0b10000000,
-        // and the last bit is selected using the mask 0b00000001
-        mask = 1 << (7 - (bitIndex % 8));
+        irSender.mark(Protocol::BitMark::usecs);
 
-        currentBit = currentByte & mask;
-
-        if (currentBit)
+        for(; left > 0; left--, walk.bit++)
         {
-            irSender.space(irData.protocol->BitOneSpace());
+            if(walk.bits[walk.bit >> 3] & (0x80 >> (walk.bit & 7)))
+            {
+                irSender.space(Protocol::BitOneSpace::usecs);
+            }
+            else
+            {
+                irSender.space(Protocol::BitZeroSpace::usecs);
+            }
+
+            irSender.mark(Protocol::BitMark::usecs);
         }
-        else
+
+        Next::Run(irSender, walk);
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRSendSegment<index, pc, IRShape::Gap>
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRSendSegment<index, Protocol::NextOp(pc)> Next;
+
+public:
+    template <class Sender> static void Run(Sender &irSender, IRSendWalk &walk)
+    {
+        irSender.space(Protocol::template GapSpace<Protocol::Op(pc + 1)>::usecs);
+
+        Next::Run(irSender, walk);
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRSendSegment<index, pc, IRShape::Trail>
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRSendSegment<index, Protocol::NextOp(pc)> Next;
+
+public:
+    template <class Sender> static void Run(Sender &irSender, IRSendWalk &walk)
+    {
+        irSender.space(Protocol::TrailSpace::usecs);
+        irSender.mark(Protocol::BitMark::usecs);
+
+        Next::Run(irSender, walk);
+    }
+};
+
+template <uint8_t index, uint8_t pc>
+class IRSendSegment<index, pc, IRShape::RepeatFrom>
+{
+    typedef IRStaticProtocol<index> Protocol;
+    typedef IRSendSegment<index, Protocol::NextOp(pc)> Next;
+
+public:
+    template <class Sender> static void Run(Sender &irSender, IRSendWalk &walk)
+    {
+        if(walk.repeat && !walk.repeating)
         {
-            irSender.space(irData.protocol->BitZeroSpace());
+            irSender.space(Protocol::RepeatSpace::usecs);
+            walk.repeating = true;
+            walk.bit = 0;
+            return;
         }
+
+        Next::Run(irSender, walk);
     }
+};
 
-    // Last mark
-    irSender.mark(irData.protocol->BitMark());
+template <uint8_t index, uint8_t pc>
+class IRSendSegment<index, pc, IRShape::End>
+{
+public:
+    template <class Sender> static void Run(Sender &, IRSendWalk &) {}
+};
+
+/**
+ * Sender of g_irProtocolTable[index], for IRStaticProtocols::Dispatch
+ */
+template <uint8_t index> class IRSendKernel
+{
+    typedef IRStaticProtocol<index> Protocol;
 
-    if (irData.protocol->HasTrail())
+public:
+    template <class Sender> static bool Run(Sender &irSender, IRSendWalk &walk)
     {
-        irSender.space(irData.protocol->TrailSpace());
-        irSender.mark(irData.protocol->BitMark());
+        IRSendSegment<index, 0>::Run(irSender, walk);
+
+        if(walk.repeating) IRSendSegment<index, Protocol::RepeatTarget()>::Run(irSender, walk);
+
+        // turn LED off
+        irSender.space(0);
+        return true;
     }
+};
+
+/**
+ * Sends a frame with the sender of its protocol
+ *
+ * @param   repeat  with the repeated block, if the protocol has one
+ *
+ * @return  false if irData can't be sent
+ */
+template <class Sender> bool sendFrame(Sender &irSender, const IRData &irData, bool repeat)
+{
+    IRSendWalk walk;
+
+    if(!irData.isValid || irData.protocol == NULL || irData.nBits == 0) return false;
+
+    walk.bits = irData.data;
+    walk.nBits = irData.nBits;
+    walk.bit = 0;
+    walk.repeat = repeat;
+    walk.repeating = false;
+
+    return IRStaticProtocols<>::Dispatch<IRSendKernel>(irData.protocol->GetId(), false, irSender, walk);
+}
+
+/**
+ * Sends infrared data with given IRsend. Based on sendNEC
+ * function from IRremote library.
+ *
+ * @see     sendFrame, the protocol's own sender plays the frame
+ * 
+ * @param   irSender    sender object from IRremote library
+ * @param   irData      to be sent
+ */
+void sendIR(IRsend &irSender, IRData &irData)
+{
+    // Set IR carrier frequency (38 kHz)
+    irSender.enableIROut(38);
+
+    IRSTATS(unsigned long start = micros());
+
+    if (!sendFrame(irSender, irData, irData.isRepeated))
+        return;
 
-    // turn LED off
-    irSender.space(0);
+    IRSTATS(g_irStats.framesSent++);
+    IRSTATS(g_irStats.sendMicros += micros() - start);
+}
+
+/**
+ * Sends a single header and data block
+ * 
+ * @param irSender
+ * @param irData
+ */
+void sendIRBlock(IRsend &irSender, IRData &irData)
+{
+    sendFrame(irSender, irData, false);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,320 @@
+#ifndef IRShape_hpp
+#define IRShape_hpp
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+
+/**
+ * Frame shape of a protocol: a short program of segment opcodes, kept
+ * in flash, telling the order of marks and spaces on a frame. Timings
+ * come from the IRProtocol; the shape only tells which one goes where.
+ *
+ *     Header               header mark, header space
+ *     Bits, n              n data bits, each a bit mark and a zero or
+ *                          one space, then a closing bit mark. With
+ *                          n = AllBits, as many bits as there are
+ *                          (at least one)
+ *     Gap, t               a space of t * GapUnitUsecs
+ *     Trail                trail space, bit mark
+ *     RepeatFrom, op       repeat space, then the frame again from op
+ *                          (an offset on the program), if the frame is
+ *                          repeated; nothing otherwise
+ *     End
+ *
+ * Each Bits op ends with a mark, so the op after it starts with a
+ * space (or is End).
+ *
+ * IRStreamDecoder and IRWaveform walk a shape with a Cursor, one width
+ * at a time; IRDecoder and sendIR() unroll it for each protocol at
+ * compile time (see IRDecodeSegment and IRSendSegment). Either way, a
+ * new frame shape is added as data, on the protocol table.
+ */
+class IRShape
+{
+public:
+
+    enum Op : uint8_t
+    {
+        End = 0,
+        Header,
+        Bits,
+        Gap,
+        Trail,
+        RepeatFrom
+    };
+
+    /**
+     * Widths of a frame, as told by a Cursor
+     */
+    enum Symbol : uint8_t
+    {
+        HeaderMark = 0,
+        HeaderSpace,
+        BitMark,
+        BitSpace,       // zero or one space
+        TrailSpace,
+        RepeatSpace,
+        GapSpace,       // see Cursor::GapUsecs
+        Done            // the frame is over
+    };
+
+    /**
+     * Operand of Bits
+     */
+    static const uint8_t AllBits = 0;
+
+    static const uint16_t GapUnitUsecs = 100;
+
+    static bool IsMark(Symbol symbol) { return symbol == HeaderMark || symbol == BitMark; }
+
+    /**
+     * @param   shape   program, readable at compile time
+     * @param   pc      offset of the op to start from
+     *
+     * @return  widest space of the Gap ops, in microseconds
+     */
+    static constexpr uint16_t WidestGapUsecs(const uint8_t *shape, uint8_t pc = 0)
+    {
+        return shape[pc] == End ? 0
+            : Widest(shape[pc] == Gap ? shape[pc + 1] * GapUnitUsecs : 0,
+                     WidestGapUsecs(shape, pc + 1 + OperandCount(shape[pc])));
+    }
+
+    static constexpr uint8_t OperandCount(uint8_t op)
+    {
+        return op == Bits || op == Gap || op == RepeatFrom ? 1 : 0;
+    }
+
+    static constexpr uint16_t Widest(uint16_t a, uint16_t b) { return a > b ? a : b; }
+
+    /**
+     * Position on a frame. Expect() tells the next width, and Advance()
+     * moves past it, once it was sent or received.
+     *
+     * When decoding, the length of AllBits ops is only known from the
+     * widths: a space that is not a bit space may end them (EndBits).
+     */
+    class Cursor
+    {
+    public:
+
+        /**
+         * Starts walking a shape to decode a frame
+         *
+         * @param   shape   program, in flash
+         */
+        void BeginDecode(const uint8_t *shape)
+        {
+            Begin(shape, 0, false, true);
+        }
+
+        /**
+         * Starts walking a shape to send a frame
+         *
+         * @param   shape   program, in flash
+         * @param   nBits   data bits of the frame
+         * @param   repeat  if RepeatFrom ops are taken
+         */
+        void BeginEncode(const uint8_t *shape, uint8_t nBits, bool repeat)
+        {
+            Begin(shape, nBits, repeat, false);
+        }
+
+        Symbol Expect() const { return m_symbol; }
+
+        /**
+         * @return  data bits so far, i.e. the index of the bit of a
+         *          BitSpace (from the start of the frame, or of the
+         *          repeated block)
+         */
+        uint8_t Bit() const { return m_bit; }
+
+        /**
+         * @return  width of a GapSpace
+         */
+        uint16_t GapUsecs() const { return m_operand * GapUnitUsecs; }
+
+        /**
+         * @return  true once a repeat space was passed
+         */
+        bool IsRepeating() const { return m_repeating; }
+
+        /**
+         * Moves past the expected width
+         */
+        void Advance()
+        {
+            switch(m_symbol)
+            {
+                case HeaderMark:
+                    m_symbol = HeaderSpace;
+                    break;
+
+                case BitMark:
+                    if(m_left == 0) Load();
+                    else m_symbol = BitSpace;
+                    break;
+
+                case BitSpace:
+                    m_bit++;
+                    if(m_left != Unknown) m_left--;
+                    m_symbol = BitMark;
+                    break;
+
+                case TrailSpace:
+                    m_left = 0;
+                    m_symbol = BitMark;
+                    break;
+
+                case RepeatSpace:
+                    m_repeating = true;
+                    m_pc = m_operand;
+                    m_bit = 0;
+                    Load();
+                    break;
+
+                case HeaderSpace:
+                case GapSpace:
+                    Load();
+                    break;
+
+                case Done:
+                    break;
+            }
+        }
+
+        /**
+         * Decoding, at a BitSpace of an AllBits op: the bits are over,
+         * i.e. the last mark closed them, and the space is the next op's.
+         *
+         * @return  false if the bits can't end here
+         */
+        bool EndBits()
+        {
+            if(m_symbol != BitSpace || m_left != Unknown || m_bit == m_opStart) return false;
+
+            Load();
+            return true;
+        }
+
+        /**
+         * Decoding: tells if the frame may end before the expected width,
+         * i.e. it's over, or only an optional repeated block is left
+         */
+        bool CanEnd() const
+        {
+            Cursor next = *this;
+
+            if(m_symbol == BitSpace && !next.EndBits()) return false;
+
+            return next.m_symbol == Done || next.m_symbol == RepeatSpace;
+        }
+
+    private:
+        static const uint8_t Unknown = 0xFF;    // m_left of AllBits, decoding
+
+        const uint8_t *m_shape;
+        uint8_t m_pc;           // offset of the next op
+        Symbol m_symbol;
+        uint8_t m_operand;
+        uint8_t m_left;         // bits left on the Bits op
+        uint8_t m_bit;
+        uint8_t m_opStart;      // m_bit at the start of the Bits op
+        uint8_t m_nBits;        // encoding: bits of the frame
+        bool m_decoding;
+        bool m_repeat;
+        bool m_repeating;
+
+        void Begin(const uint8_t *shape, uint8_t nBits, bool repeat, bool decoding)
+        {
+            m_shape = shape;
+            m_pc = 0;
+            m_operand = 0;
+            m_left = 0;
+            m_bit = 0;
+            m_opStart = 0;
+            m_nBits = nBits;
+            m_repeat = repeat;
+            m_repeating = false;
+            m_decoding = decoding;
+            Load();
+        }
+
+        /**
+         * Fetches the next op that has widths to expect
+         */
+        void Load()
+        {
+            while(1)
+            {
+                uint8_t op = pgm_read_byte(m_shape + m_pc++);
+
+                switch(op)
+                {
+                    case Header:
+                        m_symbol = HeaderMark;
+                        return;
+
+                    case Bits:
+                        m_operand = pgm_read_byte(m_shape + m_pc++);
+                        m_opStart = m_bit;
+
+                        if(m_decoding) m_left = m_operand == AllBits ? Unknown : m_operand;
+                        else
+                        {
+                            m_left = m_nBits - m_bit;
+                            if(m_operand != AllBits && m_operand < m_left) m_left = m_operand;
+                        }
+
+                        m_symbol = BitMark;
+                        return;
+
+                    case Gap:
+                        m_operand = pgm_read_byte(m_shape + m_pc++);
+                        m_symbol = GapSpace;
+                        return;
+
+                    case Trail:
+                        m_symbol = TrailSpace;
+                        return;
+
+                    case RepeatFrom:
+                        m_operand = pgm_read_byte(m_shape + m_pc++);
+
+                        // decoders take the repeat space if it's there
+                        if(m_decoding || (m_repeat && !m_repeating))
+                        {
+                            m_symbol = RepeatSpace;
+                            return;
+                        }
+                        break;
+
+                    default:
+                        m_pc--;     // stays on End
+                        m_symbol = Done;
+                        return;
+                }
+            }
+        }
+    };
+};
+
+/**
+ * Shapes of the protocols on g_irProtocolTable
+ */
+constexpr uint8_t g_irShapePlain[] PROGMEM =
+{
+    IRShape::Header, IRShape::Bits, IRShape::AllBits, IRShape::End
+};
+
+constexpr uint8_t g_irShapeTrail[] PROGMEM =
+{
+    IRShape::Header, IRShape::Bits, IRShape::AllBits, IRShape::Trail, IRShape::End
+};
+
+constexpr uint8_t g_irShapeRepeat[] PROGMEM =
+{
+    IRShape::Header, IRShape::Bits, IRShape::AllBits, IRShape::RepeatFrom, 0, IRShape::End
+};
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef IRShell_hpp
+#define IRShell_hpp
+
+#include <Arduino.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+#include "IRStorage.hpp"
+#include "IRCodeCache.hpp"
+#include "IRAsyncSender.hpp"
+#include "IRDecoder.hpp"
+#include "IRStats.hpp"
+
+/**
+ * Longest command line, e.g. "set 19 3 160 <40 hex digits> 10 1 35"
+ */
+#define IRSHELL_LINE_SIZE   72
+
+/**
+ * Serial command shell, to check and edit single codes of a programmed
+ * image:
+ *
+ *     list                                     all codes
+ *     get <remote> <code>                      a code, in the codes.txt format
+ *                                              (a line per frame)
+ *     set <remote> <code> <bits> <hex> <proto> <rep>
+ *                                              replaces a code, single frame
+ *     send <remote> <code>                     sends a code, after the
+ *                                              codes being sent
+ *     stats [reset]                            image and cache usage, and
+ *                                              decode and send counters
+ *
+ * Remotes are numbered from 0, the projector being the one after the
+ * last AC remote; codes are 0 (off) to 3 for AC remotes, 0 (power) to
+ * 2 for the projector (as in program()).
+ *
+ * Lines are read into a fixed buffer and split in place, so the shell
+ * (and program(), which uses its line reader) takes no heap at all.
+ *
+ * @see     IRStorage::ReplaceCode for what set writes to EEPROM
+ */
+class IRShell
+{
+public:
+
+    enum Error : char
+    {
+        None = 0,
+        MissingArgument,
+        InvalidNumber,
+        InvalidData,
+        InvalidProtocol,
+        LineTooLong,
+        UnknownCommand,
+        NoSuchCode,
+        EepromFull,
+        Busy,
+        MultiFrame
+    };
+
+    static String errorToString(Error error)
+    {
+        switch(error)
+        {
+            case None:              return F("none");
+            case MissingArgument:   return F("missing argument");
+            case InvalidNumber:     return F("invalid number");
+            case InvalidData:       return F("invalid data");
+            case InvalidProtocol:   return F("invalid protocol");
+            case LineTooLong:       return F("line too long");
+            case UnknownCommand:    return F("unknown command");
+            case NoSuchCode:        return F("no such code");
+            case EepromFull:        return F("eeprom full");
+            case Busy:              return F("busy");
+            case MultiFrame:        return F("multi-frame code");
+        }
+        return String();
+    }
+
+    IRShell()
+    {
+        m_send = NULL;
+        m_length = 0;
+        m_overflow = false;
+        m_line[0] = 0;
+    }
+
+    /**
+     * Reads what is available on serial, without waiting.
+     *
+     * @return  true when a whole line was read: it's on Line(), without
+     *          the line break and surrounding spaces, until the next call
+     */
+    bool ReadLine(Stream &serial)
+    {
+        while(serial.available())
+        {
+            char ch = serial.read();
+
+            if(ch == '\r') continue;
+
+            if(ch != '\n')
+            {
+                if(m_length < IRSHELL_LINE_SIZE - 1) m_line[m_length++] = ch;
+                else m_overflow = true;
+                continue;
+            }
+
+            while(m_length > 0 && m_line[m_length - 1] == ' ') m_length--;
+            m_line[m_length] = 0;
+            m_length = 0;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * @return  last line read, with leading spaces skipped
+     */
+    char *Line()
+    {
+        char *line = m_line;
+        while(*line == ' ') line++;
+        return line;
+    }
+
+    /**
+     * @return  true if the last line didn't fit on the buffer (and got
+     *          truncated). Cleared on read.
+     */
+    bool Overflowed()
+    {
+        bool overflow = m_overflow;
+        m_overflow = false;
+        return overflow;
+    }
+
+    /**
+     * Retrieves the next word of a line, separated by spaces, splitting
+     * the line in place. For example:
+     *
+     *     char *args = "set 0 1 ...";
+     *     char *next = NextArg(args);  // next = "set", args = "0 1 ..."
+     *
+     * @param   args    line, moved past the word
+     *
+     * @return  word retrieved, NULL if none found
+     */
+    static char *NextArg(char *&args)
+    {
+        while(*args == ' ') args++;
+        if(*args == 0) return NULL;
+
+        char *next = args;
+        while(*args != 0 && *args != ' ') args++;
+        if(*args != 0) *args++ = 0;
+
+        return next;
+    }
+
+    /**
+     * Parses the next word of a line as a decimal number
+     *
+     * @return  None, MissingArgument or InvalidNumber
+     */
+    static Error NextNumber(char *&args, uint8_t &value)
+    {
+        char *next = NextArg(args);
+        uint16_t number = 0;
+
+        if(next == NULL) return MissingArgument;
+
+        for(; *next != 0; next++)
+        {
+            if(*next < '0' || *next > '9') return InvalidNumber;
+
+            number = number * 10 + (*next - '0');
+            if(number > 0xFF) return InvalidNumber;
+        }
+
+        value = number;
+        return None;
+    }
+
+    /**
+     * Converts an hex string to byte array.
+     *
+     * @param   str         length must be double of capacity
+     * @param   dest        data destination, byte array
+     * @param   capacity    size of data (less than or equals to dest size)
+     *
+     * @return  true if successful
+     */
+    static bool HexToArray(const char *str, uint8_t *dest, uint8_t capacity)
+    {
+        if(strlen(str) != capacity * 2) return false;
+
+        for(uint8_t i = 0; i < capacity * 2; i++)
+        {
+            char ch = str[i];
+            uint8_t nibble;
+
+            if(ch >= '0' && ch <= '9') nibble = ch - '0';
+            else if(ch >= 'a' && ch <= 'f') nibble = ch - 'a' + 10;
+            else if(ch >= 'A' && ch <= 'F') nibble = ch - 'A' + 10;
+            else return false;
+
+            if(i % 2 == 0) dest[i / 2] = nibble << 4;
+            else dest[i / 2] |= nibble;
+        }
+
+        return true;
+    }
+
+    /**
+     * Parses a code in the codes.txt format: number of bits, hex data,
+     * protocol id and is repeated, separated by spaces. On frames of
+     * multi-frame codes but the last one, the gap before the next
+     * frame (in ms) follows.
+     *
+     * @param   args    line, moved past the code
+     * @param   irData  destination, valid if None is returned
+     */
+    static Error ParseCode(char *&args, IRData &irData)
+    {
+        uint8_t value = 0;
+        Error error;
+
+        irData.isValid = false;
+
+        if((error = NextNumber(args, irData.nBits)) != None) return error;
+        if(irData.nBits == 0 || irData.Length() > IRDATA_MAX_VALUE_SIZE) return InvalidNumber;
+
+        char *hex = NextArg(args);
+        if(hex == NULL) return MissingArgument;
+        if(!HexToArray(hex, irData.data, irData.Length())) return InvalidData;
+
+        if((error = NextNumber(args, value)) != None) return error;
+
+        irData.protocol = g_irProtocols.GetProtocol((IRProtocol::Id) value);
+        if(irData.protocol == NULL) return InvalidProtocol;
+
+        if((error = NextNumber(args, value)) != None) return error;
+
+        irData.isRepeated = value > 0;
+
+        irData.nextGap = 0;
+        error = NextNumber(args, irData.nextGap);
+        if(error != None && error != MissingArgument) return error;
+
+        irData.isValid = true;
+
+        return None;
+    }
+
+    /**
+     * @param   send    queues a code for the send command, along with
+     *                  the codes being sent; false if it can't take one
+     *                  now (the command then fails with Busy)
+     */
+    void SetSender(bool (*send)(uint8_t index)) { m_send = send; }
+
+    /**
+     * Reads and runs commands; call it on every loop. Each command is
+     * answered with its output, or "error: " and an Error.
+     */
+    void Poll(Stream &serial)
+    {
+        if(!ReadLine(serial)) return;
+
+        Error error = Overflowed() ? LineTooLong : Execute(serial, Line());
+
+        if(error != None)
+        {
+            serial.print(F("error: "));
+            serial.println(errorToString(error));
+        }
+    }
+
+private:
+    bool (*m_send)(uint8_t index);
+    char m_line[IRSHELL_LINE_SIZE];
+    uint8_t m_length;
+    bool m_overflow;
+
+    Error Execute(Stream &serial, char *args)
+    {
+        char *command = NextArg(args);
+        IRData irData;
+        uint8_t index = 0;
+        Error error;
+
+        if(command == NULL) return None;
+
+        if(!strcmp_P(command, PSTR("list")))
+        {
+            for(index = 0; index < g_irStorage.CodeCount(); index++)
+            {
+                // the projector takes 4 slots too, only 3 in use
+                serial.print(index / 4);
+                serial.print(' ');
+                serial.print(index % 4);
+                serial.print(F(": "));
+
+                if(g_irCodeCache.Get(index, irData)) PrintCode(serial, index, irData, F("      "));
+                else serial.println(F("invalid"));
+            }
+            return None;
+        }
+
+        if(!strcmp_P(command, PSTR("stats")))
+        {
+            serial.print(F("remotes "));
+            serial.print(g_irStorage.RemoteQty());
+            serial.print(F(", projector "));
+            serial.println(g_irStorage.HasProjector() ? F("yes") : F("no"));
+            serial.print(F("codes "));
+            serial.print(g_irCodeCache.Count());
+            serial.print(F(", image bytes "));
+            serial.print(g_irStorage.Length());
+            serial.print(F(", free "));
+            serial.print(g_irStorage.FreeSpace());
+            serial.print(F(", cached "));
+            serial.println(g_irCodeCache.PoolUsed());
+
+#if IRSTATS_ENABLED
+            char *option = NextArg(args);
+
+            if(option != NULL && !strcmp_P(option, PSTR("reset"))) g_irStats.Reset();
+            else if(option != NULL) return UnknownCommand;
+
+            PrintStats(serial);
+#endif
+            return None;
+        }
+
+        if(strcmp_P(command, PSTR("get")) && strcmp_P(command, PSTR("set"))
+            && strcmp_P(command, PSTR("send")))
+        {
+            return UnknownCommand;
+        }
+
+        if((error = NextIndex(args, index)) != None) return error;
+
+        if(!strcmp_P(command, PSTR("set")))
+        {
+            if((error = ParseCode(args, irData)) != None) return error;
+            if(irData.nextGap > 0) return MultiFrame;
+            if(!g_irStorage.ReplaceCode(index, irData)) return EepromFull;
+
+            // the cache mirrors the image, which just changed
+            g_irCodeCache.Load(IRStorage::PointerTable, g_irStorage.Length(),
+                               g_irStorage.CodeCount());
+        }
+
+        if(!g_irCodeCache.Get(index, irData)) return NoSuchCode;
+
+        if(!strcmp_P(command, PSTR("send")))
+        {
+            // queued along with the other codes, so it never lands
+            // between frames of a multi-frame code
+            if(m_send == NULL || !m_send(index)) return Busy;
+
+            serial.println(F("sending"));
+            return None;
+        }
+
+        PrintCode(serial, index, irData, F(""));
+        return None;
+    }
+
+    /**
+     * Prints all frames of a code, a line each
+     *
+     * @param   irData  first frame, already read
+     * @param   indent  before the frames after the first one
+     */
+    static void PrintCode(Stream &serial, uint8_t index, IRData &irData,
+                          const __FlashStringHelper *indent)
+    {
+        irData.PrintCode(serial);
+
+        for(uint8_t frame = 1; irData.nextGap > 0 && g_irCodeCache.Get(index, irData, frame); frame++)
+        {
+            serial.print(indent);
+            irData.PrintCode(serial);
+        }
+    }
+
+#if IRSTATS_ENABLED
+    /**
+     * Prints the IRStats counters, e.g.
+     *
+     *     decodes 12, avg 210 us, max 480 us
+     *     Junco 5/6 Pomander 0/1 ...       (matches/attempts)
+     *     decoded 5 header mismatch 3 ...  (results)
+     *     sent 40, sendIR 310 ms
+     */
+    static void PrintStats(Stream &serial)
+    {
+        serial.print(F("decodes "));
+        serial.print(g_irStats.decodes);
+        serial.print(F(", avg "));
+        serial.print(g_irStats.DecodeAverageMicros());
+        serial.print(F(" us, max "));
+        serial.print(g_irStats.decodeMaxMicros);
+        serial.println(F(" us"));
+
+        if(g_irStats.decodes > 0)
+        {
+            for(uint8_t i = 0; i < IRPROTOCOLS_COUNT; i++)
+            {
+                if(g_irStats.decodeAttempts[i] == 0) continue;
+
+                serial.print(g_irProtocols.At(i)->Name());
+                serial.print(' ');
+                serial.print(g_irStats.decodeMatches[i]);
+                serial.print('/');
+                serial.print(g_irStats.decodeAttempts[i]);
+                serial.print(' ');
+            }
+            serial.println();
+
+            for(uint8_t i = 0; i < IRSTATS_DECODE_ERRORS; i++)
+            {
+                if(g_irStats.decodeErrors[i] == 0) continue;
+
+                serial.print(i == IRDecoder::None ? String(F("decoded")) : IRDecoder::errorToString((IRDecoder::Error) i));
+                serial.print(' ');
+                serial.print(g_irStats.decodeErrors[i]);
+                serial.print(' ');
+            }
+            serial.println();
+        }
+
+        serial.print(F("sent "));
+        serial.print(g_irStats.framesSent);
+        serial.print(F(", sendIR "));
+        serial.print(g_irStats.sendMicros / 1000);
+        serial.println(F(" ms"));
+    }
+#endif
+
+    /**
+     * Parses "<remote> <code>" into a position on the pointer table
+     */
+    static Error NextIndex(char *&args, uint8_t &index)
+    {
+        uint8_t remote = 0, code = 0;
+        Error error;
+
+        if((error = NextNumber(args, remote)) != None) return error;
+        if((error = NextNumber(args, code)) != None) return error;
+
+        uint8_t remoteQty = g_irStorage.RemoteQty();
+
+        if(remote < remoteQty && code < 4) index = remote * 4 + code;
+        else if(remote == remoteQty && g_irStorage.HasProjector() && code < 3)
+        {
+            index = remote * 4 + code;
+        }
+        else return NoSuchCode;
+
+        return None;
+    }
+};
+
+/**
+ * Global instance of IRShell
+ */
+IRShell g_irShell;
+
+#endif
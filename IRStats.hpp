@@ -0,0 +1,93 @@
+#ifndef IRStats_hpp
+#define IRStats_hpp
+
+#include <Arduino.h>
+#include "IRProtocols.hpp"
+
+/**
+ * Set to 0 to compile out all counters
+ */
+#ifndef IRSTATS_ENABLED
+#define IRSTATS_ENABLED     1
+#endif
+
+/**
+ * Room for IRDecoder::Error values
+ */
+#define IRSTATS_DECODE_ERRORS   8
+
+/**
+ * Wraps instrumentation statements, so they vanish when IRSTATS_ENABLED
+ * is 0, e.g. IRSTATS(g_irStats.framesSent++);
+ */
+#if IRSTATS_ENABLED
+#define IRSTATS(statement)  statement
+#else
+#define IRSTATS(statement)
+#endif
+
+#if IRSTATS_ENABLED
+
+/**
+ * Decode and transmit counters, kept in RAM since boot (or the last
+ * Reset). Counts wrap around.
+ *
+ * Counters are plain members, incremented in place through IRSTATS(),
+ * so each one costs a few instructions. Decode times come from two
+ * micros() calls per decodeIR().
+ *
+ * @see     IRShell, whose stats command prints them
+ */
+class IRStats
+{
+public:
+
+    // decodeIR()
+    uint16_t decodeAttempts[IRPROTOCOLS_COUNT];     // protocol was a candidate
+    uint16_t decodeMatches[IRPROTOCOLS_COUNT];
+    uint16_t decodeErrors[IRSTATS_DECODE_ERRORS];   // per IRDecoder::Error
+    uint16_t decodes;
+    uint32_t decodeMicros;
+    uint16_t decodeMaxMicros;
+
+    // sendIR() and IRAsyncSender
+    uint16_t framesSent;
+    uint32_t sendMicros;                            // blocking sends only
+
+    IRStats()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    /**
+     * Accounts a decodeIR() call
+     */
+    void AddDecode(unsigned long micros)
+    {
+        decodes++;
+        decodeMicros += micros;
+        if(micros > decodeMaxMicros) decodeMaxMicros = micros > 0xFFFF ? 0xFFFF : micros;
+    }
+
+    /**
+     * @return  average decodeIR() time
+     */
+    uint16_t DecodeAverageMicros() const
+    {
+        return decodes ? decodeMicros / decodes : 0;
+    }
+};
+
+/**
+ * Global instance of IRStats
+ */
+IRStats g_irStats;
+
+#endif
+
+#endif
@@ -0,0 +1,536 @@
+#ifndef IRStorage_hpp
+#define IRStorage_hpp
+
+#include <Arduino.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+
+#define IRSTORAGE_VERSION   2
+
+/**
+ * EEPROM image of the programmed remotes.
+ *
+ * Layout (version 2), multi-byte values are little endian:
+ *
+ *     [0-1]    magic "AC"
+ *     [2]      version (IRSTORAGE_VERSION)
+ *     [3]      number of AC remotes
+ *     [4]      if not zero, a projector remote is programmed
+ *     [5]      reserved, zero
+ *     [6-7]    body length, in bytes
+ *     [8-9]    CRC-CCITT (0xFFFF initial value) of the body
+ *     [10-...] body: pointer table followed by code records
+ *
+ * The pointer table holds a 16-bit pointer to each code: 4 per AC
+ * remote (off, levels 1-3), then 3 for the projector (power, freeze,
+ * mute). A pointer is either:
+ *
+ *   - the EEPROM address of a full record, in the IRData::WriteToEEPROM
+ *     format. Identical codes share a single record.
+ *   - the EEPROM address of a patch, with PatchFlag set. A patch holds
+ *     the address of a full record (its base) with the same protocol,
+ *     number of bits and repeat, and the bytes where they differ:
+ *
+ *         [0-1]    base record address
+ *         [2]      number of changes
+ *         [3-...]  changes: data byte index, XOR mask
+ *
+ * Codes of a remote are nearly identical, so most of them take a few
+ * bytes as a patch instead of a whole record. Patches are never based
+ * on other patches, so reading a code takes at most two records.
+ *
+ * A multi-frame code is a chain of full records, each one (but the
+ * last) with IRData::NextFrameFlag set and followed by its gap byte.
+ * Multi-frame codes are never shared, patched, nor patched over.
+ * Images written before multi-frame codes never have the flag set.
+ *
+ * The header is written last, so an image that was not completely
+ * written, or that got corrupted afterwards, fails Validate() on boot.
+ */
+class IRStorage
+{
+public:
+
+    enum Error : char
+    {
+        None = 0,
+        NoImage,        // magic not found, e.g. never programmed
+        VersionMismatch,
+        BadHeader,
+        BadChecksum
+    };
+
+    struct Header
+    {
+        char magic[2];
+        uint8_t version;
+        uint8_t remoteQty;
+        uint8_t hasProjector;
+        uint8_t reserved;
+        uint16_t length;
+        uint16_t crc;
+    };
+
+    /**
+     * EEPROM address of the pointer table
+     */
+    static const uint16_t PointerTable = sizeof(Header);
+
+    /**
+     * Set on pointers to patches
+     */
+    static const uint16_t PatchFlag = 0x8000;
+
+    /**
+     * Reads an image straight from EEPROM.
+     *
+     * @see     ReadCode, for other sources (e.g. IRCodeCache)
+     */
+    struct EEPROMReader
+    {
+        bool Read(uint16_t address, void *destination, uint8_t size) const
+        {
+            if(address + size > E2END + 1) return false;
+
+            eeprom_read_block(destination, (const void *)(size_t) address, size);
+            return true;
+        }
+    };
+
+    static String errorToString(Error error)
+    {
+        switch(error)
+        {
+            case None:              return F("none");
+            case NoImage:           return F("no image");
+            case VersionMismatch:   return F("version mismatch");
+            case BadHeader:         return F("bad header");
+            case BadChecksum:       return F("bad checksum");
+        }
+        return String();
+    }
+
+    IRStorage()
+    {
+        m_header.remoteQty = 0;
+        m_header.hasProjector = 0;
+    }
+
+    /**
+     * Reads the header and checks the whole image.
+     *
+     * @param   maxRemoteQty    highest number of AC remotes accepted
+     *
+     * @return  None if the image is good
+     */
+    Error Validate(uint8_t maxRemoteQty)
+    {
+        eeprom_read_block((void *)&m_header, (const void *)0, sizeof(m_header));
+
+        if(m_header.magic[0] != 'A' || m_header.magic[1] != 'C') return NoImage;
+        if(m_header.version != IRSTORAGE_VERSION) return VersionMismatch;
+
+        if(m_header.remoteQty == 0 || m_header.remoteQty > maxRemoteQty
+            || m_header.length < PointerTableSize()
+            || m_header.length > E2END + 1 - sizeof(Header))
+        {
+            return BadHeader;
+        }
+
+        if(Checksum(PointerTable, m_header.length) != m_header.crc) return BadChecksum;
+
+        return None;
+    }
+
+    uint8_t RemoteQty() const { return m_header.remoteQty; }
+    uint16_t Length() const { return m_header.length; }
+    bool HasProjector() const { return m_header.hasProjector; }
+
+    /**
+     * @return  number of codes on the pointer table
+     */
+    uint8_t CodeCount() const
+    {
+        return m_header.remoteQty * 4 + (m_header.hasProjector ? 3 : 0);
+    }
+
+    /**
+     * @return  EEPROM address of the pointer to a code
+     */
+    static uint16_t PointerAddr(uint8_t index) { return PointerTable + index * 2; }
+
+    /**
+     * Starts writing a new image. The current one is invalidated right
+     * away, and stays so until Commit().
+     *
+     * @return  EEPROM address of the first record
+     */
+    uint16_t Begin(uint8_t remoteQty, bool hasProjector)
+    {
+        m_header.magic[0] = 0;
+        m_header.magic[1] = 0;
+        m_header.version = IRSTORAGE_VERSION;
+        m_header.remoteQty = remoteQty;
+        m_header.hasProjector = hasProjector ? 1 : 0;
+        m_header.reserved = 0;
+        m_header.length = 0;
+        m_header.crc = 0;
+
+        eeprom_update_block((const void *)&m_header, (void *)0, sizeof(m_header));
+
+        return PointerTable + PointerTableSize();
+    }
+
+    /**
+     * Writes a code's pointer
+     *
+     * @param   index       position on the pointer table
+     * @param   dataAddr    EEPROM address of the code's record
+     */
+    void SetPointer(uint8_t index, uint16_t dataAddr)
+    {
+        eeprom_update_block((const void *)&dataAddr, (void *)(size_t) PointerAddr(index), sizeof(dataAddr));
+    }
+
+    /**
+     * Writes a code, as compact as possible: a pointer to an identical
+     * code written before, a patch over the most similar full record
+     * written before, or a full record. Codes must be written in order.
+     *
+     * The first frame of a multi-frame code (irData.nextGap set) is
+     * always a full record, and the other frames must follow right
+     * away, with WriteFrame().
+     *
+     * @param   index       position on the pointer table
+     * @param   irData      code (or its first frame) to be written
+     * @param   dataAddr    EEPROM address of the free space, updated
+     *
+     * @return  false if irData is invalid, or the EEPROM is full
+     */
+    bool WriteCode(uint8_t index, IRData &irData, uint16_t &dataAddr)
+    {
+        return StoreCode(index, irData, dataAddr, index);
+    }
+
+    /**
+     * Writes the next frame of a multi-frame code, right after the
+     * frame before it (written by WriteCode or WriteFrame)
+     *
+     * @param   irData      frame to be written, nextGap set if not the last
+     * @param   dataAddr    EEPROM address of the free space, updated
+     *
+     * @return  false if irData is invalid, or the EEPROM is full
+     */
+    bool WriteFrame(IRData &irData, uint16_t &dataAddr)
+    {
+        if(!irData.WriteToEEPROM(dataAddr)) return false;
+
+        dataAddr += irData.SizeOnEEPROM();
+        return true;
+    }
+
+    /**
+     * Replaces a code of a valid image, e.g. to fix a single code
+     * without programming all remotes again.
+     *
+     * The new code goes after the last record (or shares, or patches
+     * over, a record of another code), so other records and patches
+     * are left untouched: only the new record, the code's pointer and
+     * the header are written. The old record's space is reclaimed on
+     * the next programming.
+     *
+     * @param   index   position on the pointer table
+     * @param   irData  new code, single frame
+     *
+     * @return  false if irData is invalid, or the EEPROM is full
+     */
+    bool ReplaceCode(uint8_t index, IRData &irData)
+    {
+        uint16_t dataAddr = PointerTable + m_header.length;
+
+        if(index >= CodeCount() || irData.nextGap > 0) return false;
+        if(!StoreCode(index, irData, dataAddr, CodeCount())) return false;
+
+        Commit(dataAddr);
+        return true;
+    }
+
+    /**
+     * @return  EEPROM bytes left after the image
+     */
+    uint16_t FreeSpace() const
+    {
+        return E2END + 1 - PointerTable - m_header.length;
+    }
+
+    /**
+     * Reads a code straight from EEPROM
+     *
+     * @param   index   position on the pointer table
+     * @param   irData  destination
+     * @param   frame   of a multi-frame code
+     *
+     * @return  false if the code (or frame) is invalid
+     */
+    static bool ReadCode(uint8_t index, IRData &irData, uint8_t frame = 0)
+    {
+        EEPROMReader reader;
+        return ReadCode(reader, index, irData, frame);
+    }
+
+    /**
+     * Reads a code, following its pointer and patch, or the records
+     * of the frames before the one requested.
+     *
+     * @param   reader  source of the image, with
+     *                  bool Read(uint16_t address, void *destination, uint8_t size)
+     * @param   index   position on the pointer table
+     * @param   irData  destination; nextGap tells if there's another frame
+     * @param   frame   of a multi-frame code, up to IRDATA_MAX_FRAMES - 1
+     *
+     * @return  false if the code (or frame) is invalid
+     */
+    template <class Reader> static bool ReadCode(const Reader &reader, uint8_t index, IRData &irData,
+                                                 uint8_t frame = 0)
+    {
+        uint16_t pointer = 0;
+        uint8_t patch[3];       // base address, number of changes
+
+        irData.isValid = false;
+
+        if(frame >= IRDATA_MAX_FRAMES) return false;
+        if(!reader.Read(PointerAddr(index), &pointer, sizeof(pointer))) return false;
+
+        if(!(pointer & PatchFlag))
+        {
+            for(uint8_t i = 0; i <= frame; i++)
+            {
+                if(i > 0)
+                {
+                    // no such frame
+                    if(irData.nextGap == 0)
+                    {
+                        irData.isValid = false;
+                        return false;
+                    }
+                    pointer += irData.SizeOnEEPROM();
+                }
+
+                if(!ReadRecord(reader, pointer, irData)) return false;
+            }
+            return true;
+        }
+
+        pointer &= ~PatchFlag;
+
+        if(frame > 0 || !reader.Read(pointer, patch, sizeof(patch))) return false;
+
+        uint16_t base = patch[0] | (patch[1] << 8);
+        if((base & PatchFlag) || !ReadRecord(reader, base, irData) || irData.nextGap > 0)
+        {
+            irData.isValid = false;
+            return false;
+        }
+
+        pointer += sizeof(patch);
+        for(uint8_t i = 0; i < patch[2]; i++, pointer += 2)
+        {
+            uint8_t change[2];      // data byte index, XOR mask
+
+            if(!reader.Read(pointer, change, sizeof(change)) || change[0] >= irData.Length())
+            {
+                irData.isValid = false;
+                return false;
+            }
+
+            irData.data[change[0]] ^= change[1];
+        }
+
+        return true;
+    }
+
+    /**
+     * Seals the image: the checksum is computed over what was actually
+     * written, and the header goes last.
+     *
+     * @param   endAddr     EEPROM address past the last record
+     */
+    void Commit(uint16_t endAddr)
+    {
+        m_header.length = endAddr - PointerTable;
+        m_header.crc = Checksum(PointerTable, m_header.length);
+        m_header.magic[0] = 'A';
+        m_header.magic[1] = 'C';
+
+        eeprom_update_block((const void *)&m_header, (void *)0, sizeof(m_header));
+    }
+
+    /**
+     * CRC-CCITT of an EEPROM region, read in blocks
+     */
+    static uint16_t Checksum(uint16_t address, uint16_t length)
+    {
+        uint8_t buffer[16];
+        uint16_t crc = 0xFFFF;
+
+        while(length > 0)
+        {
+            uint8_t size = length > sizeof(buffer) ? sizeof(buffer) : length;
+            eeprom_read_block((void *)buffer, (const void *)(size_t) address, size);
+
+            for(uint8_t i = 0; i < size; i++) crc = _crc_ccitt_update(crc, buffer[i]);
+
+            address += size;
+            length -= size;
+        }
+
+        return crc;
+    }
+
+private:
+    Header m_header;
+
+    uint16_t PointerTableSize() const { return CodeCount() * 2; }
+
+    /**
+     * Writes a code, for WriteCode and ReplaceCode.
+     *
+     * @param   known   codes before it are written, so they can be
+     *                  shared or patched over (except index itself)
+     */
+    bool StoreCode(uint8_t index, IRData &irData, uint16_t &dataAddr, uint8_t known)
+    {
+        EEPROMReader reader;
+        IRData other;
+        uint16_t base = 0;
+        uint8_t baseChanges = 0xFF;
+
+        if(!irData.isValid || irData.protocol == NULL) return false;
+
+        // multi-frame codes are always full records
+        if(irData.nextGap > 0) known = 0;
+
+        for(uint8_t i = 0; i < known; i++)
+        {
+            if(i == index) continue;
+
+            uint16_t pointer = 0;
+
+            if(!reader.Read(PointerAddr(i), &pointer, sizeof(pointer))
+                || !ReadCode(reader, i, other)
+                || other.protocol != irData.protocol || other.nBits != irData.nBits
+                || other.isRepeated != irData.isRepeated || other.nextGap > 0)
+            {
+                continue;
+            }
+
+            uint8_t changes = CountChanges(other, irData);
+
+            if(changes == 0)
+            {
+                SetPointer(index, pointer);
+                return true;
+            }
+
+            if(!(pointer & PatchFlag) && changes < baseChanges)
+            {
+                base = pointer;
+                baseChanges = changes;
+            }
+        }
+
+        // a patch only pays off if it's smaller than the record
+        if(baseChanges != 0xFF && PatchSize(baseChanges) < irData.SizeOnEEPROM())
+        {
+            uint8_t patch[3 + IRDATA_MAX_VALUE_SIZE];
+            uint8_t size = 3;
+
+            reader.Read(base + 3, other.data, irData.Length());
+
+            patch[0] = base & 0xFF;
+            patch[1] = base >> 8;
+            patch[2] = baseChanges;
+
+            for(uint8_t i = 0; i < irData.Length(); i++)
+            {
+                if(other.data[i] == irData.data[i]) continue;
+
+                patch[size++] = i;
+                patch[size++] = other.data[i] ^ irData.data[i];
+            }
+
+            if(dataAddr + size > E2END + 1) return false;
+
+            eeprom_update_block((const void *) patch, (void *)(size_t) dataAddr, size);
+            SetPointer(index, dataAddr | PatchFlag);
+            dataAddr += size;
+
+            return true;
+        }
+
+        if(!irData.WriteToEEPROM(dataAddr)) return false;
+
+        SetPointer(index, dataAddr);
+        dataAddr += irData.SizeOnEEPROM();
+
+        return true;
+    }
+
+    static uint8_t PatchSize(uint8_t changes) { return 3 + changes * 2; }
+
+    static uint8_t CountChanges(IRData &a, IRData &b)
+    {
+        uint8_t changes = 0;
+
+        for(uint8_t i = 0; i < a.Length(); i++)
+        {
+            if(a.data[i] != b.data[i]) changes++;
+        }
+        return changes;
+    }
+
+    /**
+     * Reads a full record, same format and checks as
+     * IRData::ReadFromEEPROM
+     */
+    template <class Reader> static bool ReadRecord(const Reader &reader, uint16_t address,
+                                                   IRData &irData)
+    {
+        uint8_t header[3];      // nBits, protocol id, flags
+
+        irData.isValid = false;
+
+        if(!reader.Read(address, header, sizeof(header))) return false;
+
+        uint8_t length = header[0] / 8 + (header[0] % 8 > 0);
+        if(length == 0 || length > IRDATA_MAX_VALUE_SIZE) return false;
+
+        irData.protocol = g_irProtocols.GetProtocol((IRProtocol::Id) header[1]);
+        if(irData.protocol == NULL) return false;
+
+        if(!reader.Read(address + sizeof(header), irData.data, length)) return false;
+
+        irData.nextGap = 0;
+        if((header[2] & IRData::NextFrameFlag)
+            && (!reader.Read(address + sizeof(header) + length, &irData.nextGap, 1)
+                || irData.nextGap == 0))
+        {
+            return false;
+        }
+
+        irData.nBits = header[0];
+        irData.isRepeated = header[2] & IRData::RepeatedFlag;
+        irData.isValid = true;
+
+        return true;
+    }
+};
+
+/**
+ * Global instance of IRStorage
+ */
+IRStorage g_irStorage;
+
+#endif
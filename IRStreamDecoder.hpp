@@ -0,0 +1,582 @@
+#ifndef IRStreamDecoder_hpp
+#define IRStreamDecoder_hpp
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+
+/**
+ * Number of protocols that can be followed at the same time. Header
+ * candidates beyond it are dropped, in protocol table order.
+ */
+#define IRSTREAM_SLOTS      3
+
+/**
+ * A space this long (in ticks) separates two transmissions.
+ */
+#define IRSTREAM_GAP_TICKS  GAP_TICKS
+
+/**
+ * Longest silence between frames of the same code, in ms. Frames
+ * further apart are separate codes (e.g. two presses).
+ */
+#define IRSTREAM_MAX_FRAME_GAP_MS   100
+
+/**
+ * Decodes IR data one mark/space width at a time, as edges arrive,
+ * using the same IRProtocol timings and rules as IRDecoder::tryDecodeIR.
+ *
+ * Every protocol whose header matches is followed in its own slot, with
+ * a cursor on its shape (see IRShape), and is dropped as soon as a
+ * width does not fit it. A frame ends where its shape does (e.g. on a
+ * trail mark), or when the space after the last mark outgrows the
+ * widest space its shape accepts at that point, i.e. there is no need
+ * to wait for a whole _GAP, nor to buffer raw data.
+ *
+ * Frames of multi-frame codes come one at a time, each in its own
+ * IRData, along with the silence before them (see FrameGap), so the
+ * caller may chain them: only the bits of the frame being received
+ * are kept, no matter how long the whole code is.
+ *
+ * Widths are in ticks (USECPERTICK), like decode_results::rawbuf.
+ */
+class IRStreamDecoder
+{
+public:
+
+    IRStreamDecoder()
+    {
+        m_state = Idle;
+        m_liveSlots = 0;
+        m_space = 0xFFFF;
+        m_frameGap = 0xFFFF;
+        m_resultGap = 0xFFFF;
+    }
+
+    /**
+     * Feeds the width of the mark or space that just ended.
+     * Spaces are ignored until the first mark of a frame.
+     *
+     * @param   isMark
+     * @param   ticks   width
+     *
+     * @return  true if a frame was completed, see Read()
+     */
+    bool Feed(bool isMark, uint16_t ticks);
+
+    /**
+     * Tells how long the space after the last mark has lasted so far.
+     * Must be called periodically while waiting for edges, since a
+     * frame only ends by the lack of them.
+     *
+     * @param   ticks   time since the last mark ended
+     *
+     * @return  true if a frame was completed, see Read()
+     */
+    bool Timeout(uint16_t ticks);
+
+    /**
+     * @return  true if a decoded frame is waiting to be read
+     */
+    bool Available() const { return m_state == Ready; }
+
+    /**
+     * Retrieves the decoded frame and starts listening for the next one,
+     * after the current transmission ends.
+     *
+     * @param   irData  destination
+     * @return  false if there is no frame available
+     */
+    bool Read(IRData &irData);
+
+    /**
+     * @return  silence before the frame last read, in ms, if it's short
+     *          enough for both frames to be part of the same code (see
+     *          IRSTREAM_MAX_FRAME_GAP_MS); otherwise 0
+     */
+    uint8_t FrameGap() const
+    {
+        uint32_t ms = ((uint32_t) m_resultGap * USECPERTICK + 500) / 1000;
+
+        return ms <= IRSTREAM_MAX_FRAME_GAP_MS ? ms : 0;
+    }
+
+    /**
+     * Drops whatever is being decoded and waits for a gap.
+     */
+    void Reset()
+    {
+        m_state = WaitGap;
+        m_liveSlots = 0;
+    }
+
+private:
+
+    enum State : char
+    {
+        Idle = 0,   // waiting for a header mark
+        Receiving,  // at least one slot alive
+        WaitGap,    // ignoring everything until a gap
+        Ready       // m_result holds a frame
+    };
+
+    struct Slot
+    {
+        const IRProtocol *protocol;
+        IRShape::Cursor cursor;     // bits so far are cursor.Bit()
+        bool skipping;              // repeated block is ignored, as in tryDecodeIR
+        bool isRepeated;
+        uint16_t maxSpace;  // widest space accepted, in ticks
+        uint8_t data[IRDATA_MAX_VALUE_SIZE];
+    };
+
+    State m_state;
+    uint8_t m_liveSlots;    // bit n set if m_slots[n] is alive
+    Slot m_slots[IRSTREAM_SLOTS];
+    IRData m_result;
+    uint16_t m_space;       // last space out of a frame, in ticks
+    uint16_t m_frameGap;    // space before the frame being received
+    uint16_t m_resultGap;   // space before m_result
+
+    static uint16_t Widest(uint16_t a, uint16_t b) { return a > b ? a : b; }
+
+    void Start(uint16_t ticks);
+    void FeedSlot(Slot &slot, bool isMark, uint16_t ticks);
+    static uint16_t SpaceHigh(const IRProtocol *protocol, IRShape::Cursor cursor);
+    bool CanEnd(const Slot &slot) const;
+    bool Finish();
+};
+
+
+/**
+ * @param   ticks   header mark width
+ */
+void IRStreamDecoder::Start(uint16_t ticks)
+{
+    uint16_t candidates = g_irProtocols.HeaderMarkCandidates(ticks);
+    uint8_t slot = 0;
+
+    m_liveSlots = 0;
+    m_frameGap = m_space;
+
+    for(uint8_t i = 0; candidates != 0 && slot < IRSTREAM_SLOTS; i++, candidates >>= 1)
+    {
+        if(!(candidates & 1)) continue;
+
+        const IRProtocol *protocol = g_irProtocols.At(i);
+        if(!protocol->MatchHeaderMark(ticks)) continue;
+
+        m_slots[slot].protocol = protocol;
+        m_slots[slot].cursor.BeginDecode(protocol->Shape());
+        m_slots[slot].cursor.Advance();     // past the header mark
+        m_slots[slot].skipping = false;
+        m_slots[slot].isRepeated = false;
+        m_liveSlots |= 1 << slot;
+        slot++;
+    }
+
+    m_state = m_liveSlots ? Receiving : WaitGap;
+}
+
+
+/**
+ * Advances a single slot, killing it on mismatch.
+ */
+void IRStreamDecoder::FeedSlot(Slot &slot, bool isMark, uint16_t ticks)
+{
+    const IRProtocol *protocol = slot.protocol;
+    IRShape::Cursor &cursor = slot.cursor;
+    bool match = false;
+
+    if(slot.skipping)
+    {
+        match = isMark || ticks <= slot.maxSpace;
+    }
+    else
+    {
+        IRShape::Symbol symbol = cursor.Expect();
+
+        // a space that is not a bit may be the one after the bits
+        if(!isMark && symbol == IRShape::BitSpace
+            && !protocol->MatchBitOneSpace(ticks) && !protocol->MatchBitZeroSpace(ticks)
+            && cursor.EndBits())
+        {
+            symbol = cursor.Expect();
+        }
+
+        if(isMark != IRShape::IsMark(symbol)) symbol = IRShape::Done;
+
+        switch(symbol)
+        {
+            case IRShape::HeaderSpace:
+                match = protocol->MatchHeaderSpace(ticks);
+                break;
+
+            case IRShape::BitMark:
+                match = protocol->MatchBitMark(ticks);
+                break;
+
+            case IRShape::BitSpace:
+            {
+                uint8_t nBits = cursor.Bit();
+                bool one = protocol->MatchBitOneSpace(ticks);
+                bool zero = protocol->MatchBitZeroSpace(ticks);
+
+                // as IRDecoder, the closest one if both match
+                if(one && zero) one = protocol->BitOneSpaceDeviation(ticks) <= protocol->BitZeroSpaceDeviation(ticks);
+                else if(!one && !zero) break;
+
+                if(nBits == IRDATA_MAX_VALUE_SIZE * 8) break;     // overflow
+
+                uint8_t iData = nBits / 8;
+                if(nBits % 8 == 0) slot.data[iData] = 0;
+
+                slot.data[iData] = (slot.data[iData] << 1) | (one ? 1 : 0);
+                match = true;
+                break;
+            }
+
+            case IRShape::TrailSpace:
+                match = protocol->MatchTrailSpace(ticks);
+                break;
+
+            case IRShape::RepeatSpace:
+                // the repeated block is not checked, just skipped until
+                // the widest space it may have is exceeded
+                if(cursor.Bit() == 0 || !protocol->MatchRepeatSpace(ticks)) break;
+
+                slot.isRepeated = true;
+                slot.skipping = true;
+                slot.maxSpace = Widest(protocol->HeaderSpaceHigh(), slot.maxSpace);
+                match = true;
+                break;
+
+            case IRShape::GapSpace:
+                match = IRProtocol::MatchGap(cursor.GapUsecs(), ticks);
+                break;
+
+            default:
+                break;
+        }
+
+        if(match && !slot.skipping)
+        {
+            cursor.Advance();
+            slot.maxSpace = SpaceHigh(protocol, cursor);
+        }
+    }
+
+    if(!match) m_liveSlots &= ~(1 << (&slot - m_slots));
+}
+
+
+/**
+ * @param   cursor  a copy, so ending the bits doesn't move the slot's
+ *
+ * @return  widest space accepted at the cursor, in ticks: after the
+ *          last mark of the bits, that is a bit space or whatever
+ *          comes after them (e.g. a trail or repeat space)
+ */
+uint16_t IRStreamDecoder::SpaceHigh(const IRProtocol *protocol, IRShape::Cursor cursor)
+{
+    uint16_t high = 0;
+
+    if(cursor.Expect() == IRShape::BitSpace)
+    {
+        high = protocol->BitSpaceHigh();
+        if(!cursor.EndBits()) return high;
+    }
+
+    switch(cursor.Expect())
+    {
+        case IRShape::HeaderSpace:  return Widest(high, protocol->HeaderSpaceHigh());
+        case IRShape::TrailSpace:   return Widest(high, protocol->TrailSpaceHigh());
+        case IRShape::RepeatSpace:  return Widest(high, protocol->RepeatSpaceHigh());
+        case IRShape::GapSpace:     return Widest(high, IRProtocol::GapHigh(cursor.GapUsecs()));
+        default:                    return high;
+    }
+}
+
+
+bool IRStreamDecoder::Feed(bool isMark, uint16_t ticks)
+{
+    // the silence before a header, i.e. between frames
+    if(!isMark && m_state != Receiving) m_space = ticks;
+
+    switch(m_state)
+    {
+        case Idle:
+            if(isMark) Start(ticks);
+            return false;
+
+        case WaitGap:
+            if(!isMark && ticks >= IRSTREAM_GAP_TICKS) m_state = Idle;
+            return false;
+
+        case Ready:
+            return false;
+
+        case Receiving:
+            // a space the frame can't take ends it, as Timeout() would
+            // have while it grew, had Poll() run meanwhile
+            if(!isMark && (Timeout(ticks) || m_state != Receiving))
+            {
+                m_space = ticks;
+                if(m_state == WaitGap && ticks >= IRSTREAM_GAP_TICKS) m_state = Idle;
+                return m_state == Ready;
+            }
+            break;
+    }
+
+    uint8_t done = 0;
+
+    for(uint8_t i = 0; i < IRSTREAM_SLOTS; i++)
+    {
+        if(!(m_liveSlots & (1 << i))) continue;
+
+        FeedSlot(m_slots[i], isMark, ticks);
+
+        if((m_liveSlots & (1 << i)) && !m_slots[i].skipping
+            && m_slots[i].cursor.Expect() == IRShape::Done)
+        {
+            done |= 1 << i;
+        }
+    }
+
+    // The end of a shape (e.g. a trail mark) ends the frame right away, unless another
+    // protocol is still going on
+    if(m_liveSlots == 0)
+    {
+        m_state = WaitGap;
+        return false;
+    }
+
+    if(done == m_liveSlots) return Finish();
+
+    return false;
+}
+
+
+bool IRStreamDecoder::Timeout(uint16_t ticks)
+{
+    if(m_state == WaitGap && ticks >= IRSTREAM_GAP_TICKS)
+    {
+        m_state = Idle;
+        return false;
+    }
+
+    if(m_state != Receiving) return false;
+
+    // the frame is over only when no live protocol could still take
+    // this space
+    for(uint8_t i = 0; i < IRSTREAM_SLOTS; i++)
+    {
+        if(!(m_liveSlots & (1 << i))) continue;
+        if(CanEnd(m_slots[i]) && m_slots[i].cursor.Expect() != IRShape::Done
+            && ticks <= m_slots[i].maxSpace)
+        {
+            return false;
+        }
+        if(!CanEnd(m_slots[i]) && ticks < IRSTREAM_GAP_TICKS) return false;
+    }
+
+    return Finish();
+}
+
+
+/**
+ * @return  true if the slot holds a complete frame, should no more
+ *          widths arrive
+ */
+bool IRStreamDecoder::CanEnd(const Slot &slot) const
+{
+    return slot.skipping || (slot.cursor.Bit() > 0 && slot.cursor.CanEnd());
+}
+
+
+/**
+ * Picks the first live slot holding a complete frame, in protocol
+ * table order, and moves it into m_result. decodeIR() takes the closest
+ * match instead, which may be another protocol of the same shape; the
+ * bits are the same.
+ *
+ * @return  true if there was one
+ */
+bool IRStreamDecoder::Finish()
+{
+    for(uint8_t i = 0; i < IRSTREAM_SLOTS; i++)
+    {
+        Slot &slot = m_slots[i];
+
+        if(!(m_liveSlots & (1 << i)) || !CanEnd(slot)) continue;
+
+        for(uint8_t j = 0; j < IRDATA_MAX_VALUE_SIZE; j++)
+        {
+            m_result.data[j] = slot.data[j];
+        }
+
+        // Align left last bits on last data byte
+        uint8_t nBits = slot.cursor.Bit();
+
+        if(nBits % 8 > 0)
+        {
+            m_result.data[nBits / 8] <<= 8 - (nBits % 8);
+        }
+
+        m_result.nBits = nBits;
+        m_result.protocol = slot.protocol;
+        m_result.isRepeated = slot.isRepeated;
+        m_result.nextGap = 0;
+        m_result.isValid = true;
+        m_resultGap = m_frameGap;
+
+        m_liveSlots = 0;
+        m_state = Ready;
+        return true;
+    }
+
+    m_liveSlots = 0;
+    m_state = WaitGap;
+    return false;
+}
+
+
+bool IRStreamDecoder::Read(IRData &irData)
+{
+    if(m_state != Ready) return false;
+
+    irData = m_result;
+    m_state = WaitGap;
+
+    return true;
+}
+
+
+/**
+ * Feeds an IRStreamDecoder from the IR sensor pin, with a pin change
+ * interrupt. The sensor output is active low, i.e. LOW is a mark.
+ *
+ * Poll() must be called from loop(), so frames can end by timeout.
+ */
+class IRStreamReceiver
+{
+public:
+
+    static void Begin(uint8_t pin)
+    {
+        s_pin = pin;
+        s_lastEdge = micros();
+        s_markEnded = false;
+        s_frameCount = 0;
+        attachInterrupt(digitalPinToInterrupt(pin), OnEdge, CHANGE);
+    }
+
+    static void End()
+    {
+        detachInterrupt(digitalPinToInterrupt(s_pin));
+    }
+
+    /**
+     * Pin change interrupt handler
+     */
+    static void OnEdge()
+    {
+        unsigned long now = micros();
+        unsigned long width = (now - s_lastEdge) / USECPERTICK;
+
+        s_lastEdge = now;
+
+        // pin is HIGH after a mark, and LOW after a space
+        s_markEnded = digitalRead(s_pin) == HIGH;
+        if(!s_markEnded && width >= IRSTREAM_GAP_TICKS) s_frameCount++;
+        s_decoder.Feed(s_markEnded, width > 0xFFFF ? 0xFFFF : width);
+    }
+
+    /**
+     * Ends frames by timeout. Call it as often as possible.
+     *
+     * @return  true if a frame is available
+     */
+    static bool Poll()
+    {
+        noInterrupts();
+
+        if(s_markEnded)
+        {
+            unsigned long width = (micros() - s_lastEdge) / USECPERTICK;
+            s_decoder.Timeout(width > 0xFFFF ? 0xFFFF : width);
+        }
+
+        bool available = s_decoder.Available();
+
+        interrupts();
+
+        return available;
+    }
+
+    /**
+     * @see     IRStreamDecoder::Read
+     */
+    static bool Read(IRData &irData)
+    {
+        noInterrupts();
+        bool success = s_decoder.Read(irData);
+        interrupts();
+
+        return success;
+    }
+
+    /**
+     * @see     IRStreamDecoder::FrameGap
+     */
+    static uint8_t FrameGap()
+    {
+        noInterrupts();
+        uint8_t gap = s_decoder.FrameGap();
+        interrupts();
+
+        return gap;
+    }
+
+    /**
+     * @return  frames seen on the pin since Begin(), i.e. marks after a
+     *          gap, decoded or not. Wraps around.
+     */
+    static uint16_t FrameCount()
+    {
+        noInterrupts();
+        uint16_t count = s_frameCount;
+        interrupts();
+
+        return count;
+    }
+
+    /**
+     * @return  microseconds since the last edge on the pin
+     */
+    static unsigned long SilenceMicros()
+    {
+        noInterrupts();
+        unsigned long silence = micros() - s_lastEdge;
+        interrupts();
+
+        return silence;
+    }
+
+private:
+    static IRStreamDecoder s_decoder;
+    static uint8_t s_pin;
+    static volatile unsigned long s_lastEdge;
+    static volatile bool s_markEnded;
+    static volatile uint16_t s_frameCount;
+};
+
+IRStreamDecoder IRStreamReceiver::s_decoder;
+uint8_t IRStreamReceiver::s_pin = 0;
+volatile unsigned long IRStreamReceiver::s_lastEdge = 0;
+volatile bool IRStreamReceiver::s_markEnded = false;
+volatile uint16_t IRStreamReceiver::s_frameCount = 0;
+
+#endif
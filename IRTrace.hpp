@@ -0,0 +1,219 @@
+#ifndef IRTrace_hpp
+#define IRTrace_hpp
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+
+#define IRTRACE_VERSION     1
+
+/**
+ * Compact binary trace of raw captures (decode_results), to keep
+ * libraries of captures and decode them again offline.
+ *
+ * Record format (records may be concatenated):
+ *
+ *     [0-1]    magic "IT"
+ *     [2]      version (IRTRACE_VERSION)
+ *     [3]      microseconds per tick (USECPERTICK)
+ *     [4]      flags: bit 0 set if the capture overflowed
+ *     varint   number of widths (rawlen)
+ *     varint   each width, in ticks, from rawbuf[0] (gap before
+ *              the frame) to rawbuf[rawlen - 1]
+ *
+ * Varints are unsigned LEB128: 7 bits per byte, least significant
+ * first, bit 7 set on all bytes but the last. Widths up to 6.35 ms
+ * (most of them) take a single byte.
+ *
+ * Write() and Read() work on any sink with write(uint8_t) (e.g. Serial)
+ * and any source with an int read() returning -1 at the end.
+ */
+class IRTrace
+{
+public:
+
+    enum Error : char
+    {
+        None = 0,
+        EndOfTrace,     // no more records
+        BadMagic,
+        VersionMismatch,
+        Truncated,
+        BadWidth,       // varint longer than 16 bits
+        TooLong         // more widths than the destination holds
+    };
+
+    static const uint8_t FlagOverflow = 0x01;
+
+    static String errorToString(Error error)
+    {
+        switch(error)
+        {
+            case None:              return F("none");
+            case EndOfTrace:        return F("end of trace");
+            case BadMagic:          return F("bad magic");
+            case VersionMismatch:   return F("version mismatch");
+            case Truncated:         return F("truncated");
+            case BadWidth:          return F("bad width");
+            case TooLong:           return F("too long");
+        }
+        return String();
+    }
+
+    /**
+     * Writes a capture as a single record.
+     *
+     * @param   sink        destination
+     * @param   results     raw data, from IRremote
+     */
+    template <class Sink> static void Write(Sink &sink, const decode_results *results)
+    {
+        sink.write((uint8_t) 'I');
+        sink.write((uint8_t) 'T');
+        sink.write((uint8_t) IRTRACE_VERSION);
+        sink.write((uint8_t) USECPERTICK);
+        sink.write((uint8_t) (results->overflow ? FlagOverflow : 0));
+
+        WriteVarint(sink, results->rawlen);
+
+        for(uint16_t i = 0; i < results->rawlen; i++)
+        {
+            WriteVarint(sink, results->rawbuf[i]);
+        }
+    }
+
+    /**
+     * @return  length of the record Write() makes of a capture, in bytes
+     */
+    static uint16_t Size(const decode_results *results)
+    {
+        uint16_t size = HeaderSize + VarintSize(results->rawlen);
+
+        for(uint16_t i = 0; i < results->rawlen; i++)
+        {
+            size += VarintSize(results->rawbuf[i]);
+        }
+        return size;
+    }
+
+    /**
+     * Reads the next record. Widths recorded with another tick length
+     * are converted to USECPERTICK.
+     *
+     * @param   source      origin
+     * @param   results     destination; rawbuf must be already set
+     * @param   maxLength   widths rawbuf holds. If there are more, the
+     *                      record is skipped, so the next one can be read
+     *
+     * @return  None if a capture was read, EndOfTrace at the end of source
+     */
+    template <class Source> static Error Read(Source &source, decode_results *results,
+                                              uint16_t maxLength)
+    {
+        int magic = source.read();
+        uint8_t header[4];
+        uint16_t length = 0;
+
+        if(magic < 0) return EndOfTrace;
+
+        for(uint8_t i = 0; i < sizeof(header); i++)
+        {
+            int value = source.read();
+            if(value < 0) return Truncated;
+            header[i] = value;
+        }
+
+        if(magic != 'I' || header[0] != 'T') return BadMagic;
+        if(header[1] != IRTRACE_VERSION) return VersionMismatch;
+
+        uint8_t usecsPerTick = header[2];
+        if(usecsPerTick == 0) return BadMagic;
+
+        Error error = ReadVarint(source, length);
+        if(error != None) return error;
+
+        for(uint16_t i = 0; i < length; i++)
+        {
+            uint16_t width = 0;
+
+            error = ReadVarint(source, width);
+            if(error != None) return error;
+
+            if(i >= maxLength) continue;
+
+            if(usecsPerTick != USECPERTICK)
+            {
+                width = ((uint32_t) width * usecsPerTick + USECPERTICK / 2) / USECPERTICK;
+            }
+            results->rawbuf[i] = width;
+        }
+
+        if(length > maxLength) return TooLong;
+
+        results->rawlen = length;
+        results->overflow = header[3] & FlagOverflow;
+
+        return None;
+    }
+
+    /**
+     * Prints a capture as a text line, "Trace: " followed by the record
+     * in hexadecimal, so it can be collected from a serial log.
+     */
+    static void PrintHex(const decode_results *results)
+    {
+        HexSink sink;
+
+        Serial.print(F("Trace: "));
+        Write(sink, results);
+        Serial.println();
+    }
+
+private:
+
+    static const uint8_t HeaderSize = 5;    // magic, version, tick, flags
+
+    static uint8_t VarintSize(uint16_t value)
+    {
+        return value < 0x80 ? 1 : value < 0x4000 ? 2 : 3;
+    }
+
+    struct HexSink
+    {
+        void write(uint8_t value)
+        {
+            if(value < 0x10) Serial.print('0');
+            Serial.print(value, HEX);
+        }
+    };
+
+    template <class Sink> static void WriteVarint(Sink &sink, uint16_t value)
+    {
+        while(value >= 0x80)
+        {
+            sink.write((uint8_t) (value | 0x80));
+            value >>= 7;
+        }
+        sink.write((uint8_t) value);
+    }
+
+    template <class Source> static Error ReadVarint(Source &source, uint16_t &value)
+    {
+        value = 0;
+
+        for(uint8_t shift = 0; ; shift += 7)
+        {
+            int byte = source.read();
+            if(byte < 0) return Truncated;
+
+            // 16 bits fit in 3 bytes, the last one with 2 bits
+            if(shift == 14 && byte > 0x03) return BadWidth;
+
+            value |= (uint16_t) (byte & 0x7F) << shift;
+
+            if(!(byte & 0x80)) return None;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef IRUpload_hpp
+#define IRUpload_hpp
+
+#include <Arduino.h>
+#include <util/crc16.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+#include "IRStorage.hpp"
+
+/**
+ * First byte of every frame. Text mode never starts with it.
+ */
+#define IRUPLOAD_SOF                0xA5
+
+#define IRUPLOAD_ACK                0x06
+#define IRUPLOAD_NAK                0x15
+
+#define IRUPLOAD_MAX_PAYLOAD        (5 + IRDATA_MAX_VALUE_SIZE)
+
+/**
+ * Longest wait between bytes of a frame, and for the next frame
+ */
+#define IRUPLOAD_BYTE_TIMEOUT_MS    100
+#define IRUPLOAD_FRAME_TIMEOUT_MS   10000
+
+/**
+ * Receives a whole code set over serial, in binary frames, and writes
+ * it to EEPROM. Faster and safer than programming a line at a time.
+ * Bytes are taken as they arrive, on each Poll(), so the sketch keeps
+ * running (and sleeping) meanwhile.
+ *
+ * Frame format:
+ *
+ *     [0]      IRUPLOAD_SOF
+ *     [1]      type
+ *     [2]      sequence number
+ *     [3]      payload length
+ *     [4-...]  payload
+ *     [+0-1]   CRC-CCITT (0xFFFF initial value) from type to the end
+ *              of the payload, little endian
+ *
+ * Types and payloads:
+ *
+ *     'B'  begin: number of AC remotes, has projector. Invalidates
+ *          the current image.
+ *     'C'  code: index on the pointer table, number of bits, protocol
+ *          id, flags (as on EEPROM, see IRData::WriteToEEPROM), data
+ *          bytes and, with IRData::NextFrameFlag, the gap before the
+ *          next frame. Codes go in order, from 0; frames of a
+ *          multi-frame code are sent one by one, with the same index.
+ *     'E'  end, no payload: seals the image, after all codes.
+ *
+ * Each frame is answered with IRUPLOAD_ACK or IRUPLOAD_NAK, followed by
+ * its sequence number and an Error. The sender may send a frame again
+ * (e.g. on NAK, or when no answer comes); a frame with the sequence
+ * number of the last one acknowledged is acknowledged again, but not
+ * written twice.
+ *
+ * @see     IRStorage for the image written
+ */
+class IRUploader
+{
+public:
+
+    enum Error : char
+    {
+        None = 0,
+        BadChecksum,
+        BadFrame,       // truncated, or unexpected length or type
+        OutOfOrder,     // e.g. code before begin, or end before all codes
+        InvalidCode,
+        EepromFull,
+        Timeout
+    };
+
+    static String errorToString(Error error)
+    {
+        switch(error)
+        {
+            case None:          return F("none");
+            case BadChecksum:   return F("bad checksum");
+            case BadFrame:      return F("bad frame");
+            case OutOfOrder:    return F("out of order");
+            case InvalidCode:   return F("invalid code");
+            case EepromFull:    return F("eeprom full");
+            case Timeout:       return F("timeout");
+        }
+        return String();
+    }
+
+    /**
+     * @param   maxRemoteQty    highest number of AC remotes accepted
+     */
+    IRUploader(uint8_t maxRemoteQty)
+    {
+        m_maxRemoteQty = maxRemoteQty;
+        m_state = WaitStart;
+        m_received = 0;
+        m_lastByteAt = millis();
+        m_begun = false;
+        m_acked = false;
+        m_sealed = false;
+        m_index = 0;
+        m_frame = 0;
+        m_dataAddr = 0;
+    }
+
+    /**
+     * Takes the bytes received so far, and answers the frame they
+     * complete, if any. Never waits for more bytes, so it runs as a
+     * Scheduler task.
+     *
+     * @param   serial  e.g. Serial
+     *
+     * @return  false once the upload is over: the image was sealed (see
+     *          IsSealed), or no frame came for IRUPLOAD_FRAME_TIMEOUT_MS
+     */
+    bool Poll(Stream &serial)
+    {
+        if(m_sealed) return false;
+
+        if(m_state == WaitStart)
+        {
+            if(millis() - m_lastByteAt >= IRUPLOAD_FRAME_TIMEOUT_MS) return false;
+        }
+        else if(millis() - m_lastByteAt >= IRUPLOAD_BYTE_TIMEOUT_MS)
+        {
+            // truncated frame
+            m_state = WaitStart;
+            Answer(serial, BadFrame);
+        }
+
+        while(serial.available())
+        {
+            Error error;
+
+            if(!ReadByte(serial.read(), error)) continue;
+
+            m_state = WaitStart;
+
+            // one frame per run, as writing it to EEPROM takes a while
+            if(error == None) Complete(serial);
+            else Answer(serial, error);
+            break;
+        }
+
+        return !m_sealed;
+    }
+
+    /**
+     * @return  true if a new image was written
+     */
+    bool IsSealed() const
+    {
+        return m_sealed;
+    }
+
+private:
+
+    /**
+     * Part of the frame expected next
+     */
+    enum State : char
+    {
+        WaitStart = 0,  // IRUPLOAD_SOF, anything else is ignored
+        Header,         // type, sequence, length
+        Payload,        // and CRC
+    };
+
+    uint8_t m_type;
+    uint8_t m_sequence;
+    uint8_t m_length;
+    uint8_t m_payload[IRUPLOAD_MAX_PAYLOAD];
+
+    uint8_t m_maxRemoteQty;
+    State m_state;
+    uint8_t m_received;     // bytes of the current part
+    uint16_t m_crc;
+    unsigned long m_lastByteAt;
+
+    bool m_begun;
+    bool m_acked;
+    bool m_sealed;
+    uint8_t m_lastSequence;
+    uint8_t m_index;        // next code expected
+    uint8_t m_frame;        // next frame of it
+    uint16_t m_dataAddr;
+
+    /**
+     * Adds a byte to the frame being received
+     *
+     * @param   error   None if the frame is complete, or why it's not valid
+     *
+     * @return  true once the frame ends, complete or not
+     */
+    bool ReadByte(uint8_t value, Error &error)
+    {
+        m_lastByteAt = millis();
+
+        switch(m_state)
+        {
+            case WaitStart:
+                if(value != IRUPLOAD_SOF) return false;
+
+                m_state = Header;
+                m_received = 0;
+                m_crc = 0xFFFF;
+                return false;
+
+            case Header:
+                if(m_received == 0) m_type = value;
+                else if(m_received == 1) m_sequence = value;
+                else m_length = value;
+
+                m_crc = _crc_ccitt_update(m_crc, value);
+                if(++m_received < 3) return false;
+
+                m_state = Payload;
+                m_received = 0;
+                error = BadFrame;
+                return m_length > IRUPLOAD_MAX_PAYLOAD;
+
+            case Payload:
+                if(m_received < m_length)
+                {
+                    m_payload[m_received++] = value;
+                    m_crc = _crc_ccitt_update(m_crc, value);
+                    return false;
+                }
+
+                error = value == ((m_crc >> (8 * (m_received - m_length))) & 0xFF) ? None : BadChecksum;
+                return error != None || ++m_received == m_length + 2;
+        }
+
+        error = BadFrame;
+        return true;
+    }
+
+    /**
+     * Handles a frame received, and answers it
+     */
+    void Complete(Stream &serial)
+    {
+        if(m_acked && m_sequence == m_lastSequence)
+        {
+            Answer(serial, None);   // retransmitted
+            return;
+        }
+
+        Error error = Handle(m_maxRemoteQty);
+
+        Answer(serial, error);
+
+        if(error != None) return;
+
+        m_acked = true;
+        m_lastSequence = m_sequence;
+
+        if(m_type == 'E') m_sealed = true;
+    }
+
+    Error Handle(uint8_t maxRemoteQty)
+    {
+        switch(m_type)
+        {
+            case 'B':
+                if(m_length != 2) return BadFrame;
+                if(m_payload[0] == 0 || m_payload[0] > maxRemoteQty) return InvalidCode;
+
+                m_dataAddr = g_irStorage.Begin(m_payload[0], m_payload[1]);
+                m_index = 0;
+                m_frame = 0;
+                m_begun = true;
+                return None;
+
+            case 'C':
+                return HandleCode();
+
+            case 'E':
+                if(m_length != 0) return BadFrame;
+                if(!m_begun || m_index != g_irStorage.CodeCount()) return OutOfOrder;
+
+                g_irStorage.Commit(m_dataAddr);
+                m_begun = false;
+                return None;
+        }
+
+        return BadFrame;
+    }
+
+    Error HandleCode()
+    {
+        IRData irData, written;
+
+        if(m_length < 4) return BadFrame;
+        if(!m_begun || m_payload[0] != m_index || m_index >= g_irStorage.CodeCount())
+        {
+            return OutOfOrder;
+        }
+
+        irData.nBits = m_payload[1];
+        irData.protocol = g_irProtocols.GetProtocol((IRProtocol::Id) m_payload[2]);
+        irData.isRepeated = m_payload[3] & IRData::RepeatedFlag;
+
+        bool hasNext = m_payload[3] & IRData::NextFrameFlag;
+
+        if(irData.protocol == NULL || irData.nBits == 0
+            || irData.Length() > IRDATA_MAX_VALUE_SIZE
+            || m_length - 4 - hasNext != irData.Length())
+        {
+            return InvalidCode;
+        }
+
+        for(uint8_t i = 0; i < irData.Length(); i++) irData.data[i] = m_payload[4 + i];
+        irData.nextGap = hasNext ? m_payload[4 + irData.Length()] : 0;
+        irData.isValid = true;
+
+        if(hasNext && (irData.nextGap == 0 || m_frame == IRDATA_MAX_FRAMES - 1)) return InvalidCode;
+
+        if(m_frame == 0 && !g_irStorage.WriteCode(m_index, irData, m_dataAddr)) return EepromFull;
+        if(m_frame > 0 && !g_irStorage.WriteFrame(irData, m_dataAddr)) return EepromFull;
+
+        // read back, as the text mode does
+        if(!IRStorage::ReadCode(m_index, written, m_frame) || written.nBits != irData.nBits
+            || written.nextGap != irData.nextGap
+            || memcmp(written.data, irData.data, irData.Length()))
+        {
+            return EepromFull;
+        }
+
+        if(hasNext) m_frame++;
+        else
+        {
+            m_frame = 0;
+            m_index++;
+        }
+        return None;
+    }
+
+    void Answer(Stream &serial, Error error)
+    {
+        serial.write((uint8_t) (error == None ? IRUPLOAD_ACK : IRUPLOAD_NAK));
+        serial.write(m_sequence);
+        serial.write((uint8_t) error);
+    }
+};
+
+#endif
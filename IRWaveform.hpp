@@ -0,0 +1,141 @@
+#ifndef IRWaveform_hpp
+#define IRWaveform_hpp
+
+#include <Arduino.h>
+#include "IRProtocols.hpp"
+#include "IRData.hpp"
+
+/**
+ * An IRData compiled for IRAsyncSender, which plays a frame one width
+ * at a time from its timer interrupt. Compile() runs as each frame
+ * starts: it copies the protocol's durations into a small table, and
+ * the frame is then played by walking the protocol's shape (see
+ * IRShape), the same program the decoders follow. The data bits are
+ * used as two-symbol indices into the table (0: zero space, 1: one
+ * space).
+ *
+ * Each step of the interrupt costs a shape step, with no divisions,
+ * variable shifts or flash reads of the protocol timings.
+ *
+ * Blocking sends (sendIR) don't use it: they play through a sender
+ * instantiated for each protocol (see IRSendSegment).
+ *
+ * The data bits are not copied, so the IRData must outlive the waveform.
+ */
+class IRWaveform
+{
+public:
+
+    /**
+     * Durations on the table, indexed as IRShape::Symbol, bit spaces
+     * being zero spaces. Gap spaces come from the shape.
+     */
+    enum Symbol : uint8_t
+    {
+        HeaderMark = IRShape::HeaderMark,
+        HeaderSpace = IRShape::HeaderSpace,
+        BitMark = IRShape::BitMark,
+        ZeroSpace = IRShape::BitSpace,
+        TrailSpace = IRShape::TrailSpace,
+        RepeatSpace = IRShape::RepeatSpace,
+        OneSpace,
+        SymbolCount
+    };
+
+    IRWaveform()
+    {
+        m_shape = NULL;
+        m_bits = NULL;
+        m_nBits = 0;
+        m_repeat = false;
+    }
+
+    /**
+     * @param   irData  must be valid
+     * @return  false if irData can't be sent
+     */
+    bool Compile(const IRData &irData)
+    {
+        const IRProtocol *protocol = irData.protocol;
+
+        m_bits = NULL;
+        if(!irData.isValid || protocol == NULL || irData.nBits == 0) return false;
+
+        m_durations[HeaderMark] = protocol->HeaderMark();
+        m_durations[HeaderSpace] = protocol->HeaderSpace();
+        m_durations[BitMark] = protocol->BitMark();
+        m_durations[ZeroSpace] = protocol->BitZeroSpace();
+        m_durations[OneSpace] = protocol->BitOneSpace();
+        m_durations[TrailSpace] = protocol->TrailSpace();
+        m_durations[RepeatSpace] = protocol->RepeatSpace();
+
+        m_shape = protocol->Shape();
+        m_repeat = irData.isRepeated;
+        m_bits = irData.data;
+        m_nBits = irData.nBits;
+
+        return true;
+    }
+
+    bool IsValid() const { return m_bits != NULL; }
+
+    /**
+     * Position on the frame, for Next()
+     */
+    typedef IRShape::Cursor Cursor;
+
+    void Rewind(Cursor &cursor) const
+    {
+        cursor.BeginEncode(m_shape, m_nBits, m_repeat);
+    }
+
+    /**
+     * Gets the next mark or space of the frame, one at a time, for
+     * senders that can't block (e.g. from a timer interrupt). Follows
+     * the same sequence as sendIR(), except for the final space(0).
+     *
+     * @param   cursor  position, see Rewind()
+     * @param   isMark  next is a mark (true) or space (false)
+     * @param   usecs   next duration
+     *
+     * @return  false when the frame is over
+     */
+    bool Next(Cursor &cursor, bool &isMark, uint16_t &usecs) const
+    {
+        IRShape::Symbol symbol = cursor.Expect();
+
+        if(!IsValid() || symbol == IRShape::Done) return false;
+
+        switch(symbol)
+        {
+            case IRShape::BitSpace:
+                usecs = (m_bits[cursor.Bit() >> 3] & (0x80 >> (cursor.Bit() & 7)))
+                    ? m_durations[OneSpace] : m_durations[ZeroSpace];
+                break;
+
+            case IRShape::GapSpace:
+                usecs = cursor.GapUsecs();
+                break;
+
+            default:
+                usecs = m_durations[symbol];
+                break;
+        }
+
+        isMark = IRShape::IsMark(symbol);
+        cursor.Advance();
+
+        return true;
+    }
+
+    uint16_t Duration(Symbol symbol) const { return m_durations[symbol]; }
+
+private:
+    uint16_t m_durations[SymbolCount];
+    const uint8_t *m_shape;
+    const uint8_t *m_bits;
+    uint8_t m_nBits;
+    bool m_repeat;
+};
+
+#endif
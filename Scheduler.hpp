@@ -0,0 +1,147 @@
+#ifndef Scheduler_hpp
+#define Scheduler_hpp
+
+#include <Arduino.h>
+
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#endif
+
+/**
+ * Max number of tasks
+ */
+#define SCHEDULER_MAX_TASKS     6
+
+/**
+ * Cooperative scheduler of timer tasks, based on millis().
+ *
+ * A task is a function that runs when its time comes, and returns the
+ * delay until its next run: periodic tasks return their period, and
+ * sequences (e.g. LED patterns) return the duration of each step. Tasks
+ * must not block; they run to completion, one at a time, from Run().
+ *
+ * Between runs, Idle() puts the CPU to sleep until the next interrupt:
+ * the millis() tick (every 1 ms), serial, pin changes or the IR send
+ * timer. Idle mode is used, as deeper modes would stop the timers and
+ * the UART.
+ */
+class Scheduler
+{
+public:
+
+    typedef uint16_t (*Task)();
+
+    /**
+     * Delay returned by a task to stop running, until Start() again
+     */
+    static const uint16_t Stop = 0;
+
+    /**
+     * Returned by Add() when there's no room for the task
+     */
+    static const uint8_t NoTask = 0xFF;
+
+    Scheduler()
+    {
+        m_count = 0;
+    }
+
+    /**
+     * Adds a task
+     *
+     * @param   task        function to run
+     * @param   delayMs     until its first run, or Stop to add it stopped
+     *
+     * @return  task id, or NoTask if there are SCHEDULER_MAX_TASKS already
+     */
+    uint8_t Add(Task task, uint16_t delayMs)
+    {
+        if(m_count == SCHEDULER_MAX_TASKS) return NoTask;
+
+        m_tasks[m_count].task = task;
+        m_tasks[m_count].runAt = millis() + delayMs;
+        m_tasks[m_count].running = delayMs != Stop;
+
+        return m_count++;
+    }
+
+    /**
+     * Schedules a task (again), replacing its current schedule
+     *
+     * @param   delayMs     until its next run, zero for right away
+     */
+    void Start(uint8_t id, uint16_t delayMs)
+    {
+        if(id >= m_count) return;
+
+        m_tasks[id].runAt = millis() + delayMs;
+        m_tasks[id].running = true;
+    }
+
+    void Cancel(uint8_t id)
+    {
+        if(id < m_count) m_tasks[id].running = false;
+    }
+
+    bool IsRunning(uint8_t id) const
+    {
+        return id < m_count && m_tasks[id].running;
+    }
+
+    /**
+     * Runs the tasks whose time has come, once each
+     */
+    void Run()
+    {
+        for(uint8_t i = 0; i < m_count; i++)
+        {
+            if(!IsDue(i)) continue;
+
+            uint16_t delayMs = m_tasks[i].task();
+
+            if(delayMs == Stop) m_tasks[i].running = false;
+            else m_tasks[i].runAt = millis() + delayMs;
+        }
+    }
+
+    /**
+     * Sleeps until the next interrupt, unless a task is due
+     */
+    void Idle()
+    {
+        for(uint8_t i = 0; i < m_count; i++)
+        {
+            if(IsDue(i)) return;
+        }
+
+#if defined(__AVR__)
+        set_sleep_mode(SLEEP_MODE_IDLE);
+        sleep_mode();
+#else
+        delay(1);   // the next millis() tick
+#endif
+    }
+
+private:
+    struct Entry
+    {
+        Task task;
+        unsigned long runAt;
+        bool running;
+    };
+
+    Entry m_tasks[SCHEDULER_MAX_TASKS];
+    uint8_t m_count;
+
+    bool IsDue(uint8_t id) const
+    {
+        return m_tasks[id].running && (long)(millis() - m_tasks[id].runAt) >= 0;
+    }
+};
+
+/**
+ * Global instance of Scheduler
+ */
+Scheduler g_scheduler;
+
+#endif
@@ -0,0 +1,335 @@
+#include <Arduino.h>
+
+#include <ctype.h>
+#include <stdio.h>
+
+#include <vector>
+
+HostSerial Serial;
+
+namespace
+{
+    unsigned long long s_micros = 0;
+    unsigned long long s_microsLimit = 0;
+    uint8_t s_pinMode[NUM_DIGITAL_PINS] = {0};
+    uint8_t s_pinOutput[NUM_DIGITAL_PINS] = {0};
+
+    struct PinLow
+    {
+        uint8_t pin;
+        unsigned long fromMs;
+        unsigned long toMs;
+    };
+
+    std::vector<PinLow> s_pinLows;
+
+    void (*s_interrupts[2])(void) = {NULL, NULL};
+}
+
+
+/******************************************************************************
+ * Digital I/O and time
+ */
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if(pin < NUM_DIGITAL_PINS) s_pinMode[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    if(pin < NUM_DIGITAL_PINS) s_pinOutput[pin] = value ? HIGH : LOW;
+}
+
+/**
+ * Inputs read HIGH (pull-ups) unless a scheduled press holds them LOW.
+ */
+int digitalRead(uint8_t pin)
+{
+    if(pin >= NUM_DIGITAL_PINS) return LOW;
+    if(s_pinMode[pin] == OUTPUT) return s_pinOutput[pin];
+
+    unsigned long now = millis();
+    for(size_t i = 0; i < s_pinLows.size(); i++)
+    {
+        const PinLow &low = s_pinLows[i];
+        if(low.pin == pin && now >= low.fromMs && now < low.toMs) return LOW;
+    }
+
+    return HIGH;
+}
+
+unsigned long millis() { return (unsigned long)(s_micros / 1000); }
+unsigned long micros() { return (unsigned long) s_micros; }
+
+void delay(unsigned long ms) { hostAdvanceMicros(ms * 1000); }
+void delayMicroseconds(unsigned int us) { hostAdvanceMicros(us); }
+
+void noInterrupts() {}
+void interrupts() {}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int)
+{
+    if(interruptNum < 2) s_interrupts[interruptNum] = userFunc;
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+    if(interruptNum < 2) s_interrupts[interruptNum] = NULL;
+}
+
+/**
+ * All virtual time goes through here. Sketches never return from some
+ * modes (e.g. dumper), so passing the time limit ends the host run.
+ */
+void hostAdvanceMicros(unsigned long us)
+{
+    s_micros += us;
+
+    if(s_microsLimit && s_micros > s_microsLimit)
+    {
+        Serial.flush();
+        exit(0);
+    }
+}
+
+void hostSetTimeLimit(unsigned long ms)
+{
+    s_microsLimit = (unsigned long long) ms * 1000;
+}
+
+void hostSchedulePinLow(uint8_t pin, unsigned long fromMs, unsigned long toMs)
+{
+    PinLow low = {pin, fromMs, toMs};
+    s_pinLows.push_back(low);
+}
+
+uint8_t hostPinOutput(uint8_t pin)
+{
+    return pin < NUM_DIGITAL_PINS ? s_pinOutput[pin] : LOW;
+}
+
+void hostTriggerInterrupt(uint8_t interruptNum)
+{
+    if(interruptNum < 2 && s_interrupts[interruptNum]) s_interrupts[interruptNum]();
+}
+
+
+/******************************************************************************
+ * String
+ */
+
+namespace
+{
+    std::string numberToString(unsigned long value, unsigned char base, bool negative)
+    {
+        char buffer[8 * sizeof(long) + 2];
+        char *p = &buffer[sizeof(buffer) - 1];
+        *p = '\0';
+
+        if(base < 2) base = 10;
+        do
+        {
+            unsigned long digit = value % base;
+            *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+            value /= base;
+        } while(value);
+
+        if(negative) *--p = '-';
+        return std::string(p);
+    }
+}
+
+String::String(int value, unsigned char base) : String((long) value, base) {}
+String::String(unsigned int value, unsigned char base) : String((unsigned long) value, base) {}
+
+String::String(long value, unsigned char base)
+{
+    if(base == DEC && value < 0) m_str = numberToString(-(unsigned long) value, base, true);
+    else m_str = numberToString((unsigned long) value, base, false);
+}
+
+String::String(unsigned long value, unsigned char base)
+    : m_str(numberToString(value, base, false)) {}
+
+String String::substring(unsigned int from, unsigned int to) const
+{
+    if(from > to)
+    {
+        unsigned int temp = from;
+        from = to;
+        to = temp;
+    }
+    if(from >= m_str.length()) return String();
+    if(to > m_str.length()) to = m_str.length();
+    return String(m_str.substr(from, to - from));
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+    size_t pos = m_str.find(c, from);
+    return pos == std::string::npos ? -1 : (int) pos;
+}
+
+void String::trim()
+{
+    size_t begin = 0, end = m_str.length();
+    while(begin < end && isspace((unsigned char) m_str[begin])) begin++;
+    while(end > begin && isspace((unsigned char) m_str[end - 1])) end--;
+    m_str = m_str.substr(begin, end - begin);
+}
+
+void String::replace(const String &find, const String &replace)
+{
+    if(find.length() == 0) return;
+
+    size_t pos = 0;
+    while((pos = m_str.find(find.m_str, pos)) != std::string::npos)
+    {
+        m_str.replace(pos, find.length(), replace.m_str);
+        pos += replace.length();
+    }
+}
+
+void String::toUpperCase()
+{
+    for(size_t i = 0; i < m_str.length(); i++)
+    {
+        m_str[i] = toupper((unsigned char) m_str[i]);
+    }
+}
+
+
+/******************************************************************************
+ * Print and Stream
+ */
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while(size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::print(const __FlashStringHelper *str)
+{
+    return write(reinterpret_cast<const char *>(str));
+}
+
+size_t Print::print(const String &str) { return write(str.c_str()); }
+size_t Print::print(const char str[]) { return write(str); }
+size_t Print::print(char c) { return write((uint8_t) c); }
+
+size_t Print::print(unsigned char value, int base) { return print((unsigned long) value, base); }
+size_t Print::print(int value, int base) { return print((long) value, base); }
+size_t Print::print(unsigned int value, int base) { return print((unsigned long) value, base); }
+
+size_t Print::print(long value, int base)
+{
+    if(base == 0) return write((uint8_t) value);
+    if(base == DEC && value < 0) return print('-') + printNumber(-(unsigned long) value, DEC);
+    return printNumber((unsigned long) value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    if(base == 0) return write((uint8_t) value);
+    return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits)
+{
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return write(buffer);
+}
+
+size_t Print::println() { return write("\r\n"); }
+
+size_t Print::printNumber(unsigned long value, uint8_t base)
+{
+    return write(numberToString(value, base, false).c_str());
+}
+
+int Stream::timedRead()
+{
+    // input is either there already or never will be
+    return available() ? read() : -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length)
+{
+    size_t count = 0;
+    while(count < length)
+    {
+        int c = timedRead();
+        if(c < 0) break;
+        *buffer++ = (char) c;
+        count++;
+    }
+    return count;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+    std::string ret;
+    int c = timedRead();
+    while(c >= 0 && c != terminator)
+    {
+        ret += (char) c;
+        c = timedRead();
+    }
+    return String(ret);
+}
+
+
+/******************************************************************************
+ * HostSerial
+ */
+
+int HostSerial::available()
+{
+    int c = getc(stdin);
+
+    if(c == EOF)
+    {
+        if(m_exitOnEof)
+        {
+            flush();
+            exit(0);
+        }
+        return 0;
+    }
+
+    ungetc(c, stdin);
+    return 1;
+}
+
+int HostSerial::read()
+{
+    int c = getc(stdin);
+    return c == EOF ? -1 : c;
+}
+
+int HostSerial::peek()
+{
+    int c = getc(stdin);
+    if(c == EOF) return -1;
+    ungetc(c, stdin);
+    return c;
+}
+
+size_t HostSerial::write(uint8_t c)
+{
+    // Serial line endings are \r\n, host terminals want \n
+    if(c != '\r') putchar(c);
+    return 1;
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size)
+{
+    for(size_t i = 0; i < size; i++) write(buffer[i]);
+    return size;
+}
+
+void HostSerial::flush() { fflush(stdout); }
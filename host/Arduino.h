@@ -0,0 +1,229 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+/**
+ * Host stand-in for the Arduino core.
+ *
+ * Provides just enough of the Arduino API (digital I/O, timing, String,
+ * Print and Serial) to build the IR core and the sketch on a desktop
+ * compiler. Time is virtual: delay() and the IR sender advance it
+ * instantly, so host runs are deterministic and never sleep.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "avr/pgmspace.h"
+
+#define HIGH            0x1
+#define LOW             0x0
+
+#define INPUT           0x0
+#define OUTPUT          0x1
+#define INPUT_PULLUP    0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define CHANGE  1
+#define FALLING 2
+#define RISING  3
+
+#define NUM_DIGITAL_PINS 20
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void noInterrupts();
+void interrupts();
+
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+void detachInterrupt(uint8_t interruptNum);
+
+/**
+ * Host-only hooks, used by host tools to drive the virtual board.
+ */
+void hostAdvanceMicros(unsigned long us);
+void hostSetTimeLimit(unsigned long ms);
+void hostSchedulePinLow(uint8_t pin, unsigned long fromMs, unsigned long toMs);
+uint8_t hostPinOutput(uint8_t pin);
+void hostTriggerInterrupt(uint8_t interruptNum);
+
+
+/**
+ * Flash strings are plain strings on the host.
+ */
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+
+/**
+ * Subset of Arduino's String class, backed by std::string.
+ */
+class String
+{
+    public:
+        String(const char *cstr = "") : m_str(cstr ? cstr : "") {}
+        String(const __FlashStringHelper *str)
+            : m_str(reinterpret_cast<const char *>(str)) {}
+        String(const std::string &str) : m_str(str) {}
+        explicit String(char c) : m_str(1, c) {}
+        explicit String(int value, unsigned char base = DEC);
+        explicit String(unsigned int value, unsigned char base = DEC);
+        explicit String(long value, unsigned char base = DEC);
+        explicit String(unsigned long value, unsigned char base = DEC);
+
+        unsigned int length() const { return m_str.length(); }
+        const char *c_str() const { return m_str.c_str(); }
+
+        char charAt(unsigned int index) const
+        {
+            return index < m_str.length() ? m_str[index] : 0;
+        }
+        char operator [] (unsigned int index) const { return charAt(index); }
+
+        String substring(unsigned int from) const
+        {
+            return from < m_str.length() ? String(m_str.substr(from)) : String();
+        }
+        String substring(unsigned int from, unsigned int to) const;
+
+        int indexOf(char c, unsigned int from = 0) const;
+        long toInt() const { return atol(m_str.c_str()); }
+
+        void trim();
+        void replace(const String &find, const String &replace);
+        void toUpperCase();
+
+        String & operator += (const String &rhs) { m_str += rhs.m_str; return *this; }
+        String & operator += (const char *rhs) { m_str += rhs; return *this; }
+        String & operator += (char c) { m_str += c; return *this; }
+
+        bool operator == (const String &rhs) const { return m_str == rhs.m_str; }
+        bool operator == (const char *rhs) const { return m_str == rhs; }
+        bool operator != (const String &rhs) const { return m_str != rhs.m_str; }
+        bool operator != (const char *rhs) const { return m_str != rhs; }
+
+        friend String operator + (const String &lhs, const String &rhs)
+        {
+            return String(lhs.m_str + rhs.m_str);
+        }
+
+    private:
+        std::string m_str;
+};
+
+
+/**
+ * Same overload set as Arduino's Print class.
+ */
+class Print
+{
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size);
+        size_t write(const char *str) { return write((const uint8_t *) str, strlen(str)); }
+
+        size_t print(const __FlashStringHelper *str);
+        size_t print(const String &str);
+        size_t print(const char str[]);
+        size_t print(char c);
+        size_t print(unsigned char value, int base = DEC);
+        size_t print(int value, int base = DEC);
+        size_t print(unsigned int value, int base = DEC);
+        size_t print(long value, int base = DEC);
+        size_t print(unsigned long value, int base = DEC);
+        size_t print(double value, int digits = 2);
+
+        size_t println();
+        template <class T> size_t println(T value)
+        {
+            size_t n = print(value);
+            return n + println();
+        }
+        template <class T> size_t println(T value, int format)
+        {
+            size_t n = print(value, format);
+            return n + println();
+        }
+
+    private:
+        size_t printNumber(unsigned long value, uint8_t base);
+};
+
+
+class Stream : public Print
+{
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        void setTimeout(unsigned long timeout) { m_timeout = timeout; }
+        size_t readBytes(char *buffer, size_t length);
+        size_t readBytes(uint8_t *buffer, size_t length)
+        {
+            return readBytes((char *) buffer, length);
+        }
+        String readStringUntil(char terminator);
+
+    protected:
+        int timedRead();
+        unsigned long m_timeout = 1000;
+};
+
+
+#define SERIAL_TX_BUFFER_SIZE   64
+
+/**
+ * Serial port backed by the process' standard streams: reads from
+ * stdin, writes to stdout.
+ *
+ * When exit on EOF is enabled, polling an exhausted input ends the
+ * process, so a scripted host run finishes where the sketch would
+ * otherwise wait forever for the next line.
+ */
+class HostSerial : public Stream
+{
+    public:
+        void begin(unsigned long) {}
+        void end() {}
+        void flush();
+        operator bool() const { return true; }
+
+        int available() override;
+        int read() override;
+        int peek() override;
+
+        using Print::write;
+        size_t write(uint8_t c) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+
+        // output is not timed, so the buffer never fills up
+        int availableForWrite() { return SERIAL_TX_BUFFER_SIZE - 1; }
+
+        void hostExitOnEof(bool enabled) { m_exitOnEof = enabled; }
+
+    private:
+        bool m_exitOnEof = false;
+};
+
+extern HostSerial Serial;
+
+#endif
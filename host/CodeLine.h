@@ -0,0 +1,59 @@
+#ifndef CodeLine_h
+#define CodeLine_h
+
+/**
+ * Parser of the code lines of codes.txt, for the host tools:
+ * number of bits, data bits in hex, protocol id, is repeated and,
+ * on frames of multi-frame codes, the gap before the next frame
+ * (the format printed by IRData::PrintCode).
+ */
+
+#include <Arduino.h>
+#include "../IRProtocols.hpp"
+#include "../IRData.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+/**
+ * @param   line    a line of codes.txt
+ * @param   data    destination
+ *
+ * @return  false if it's not a code line (e.g. brand names, blank
+ *          lines), or if the code is invalid
+ */
+inline bool parseCodeLine(const std::string &line, IRData &data)
+{
+    unsigned nBits = 0, id = 0, isRepeated = 0, nextGap = 0;
+    char hex[2 * IRDATA_MAX_VALUE_SIZE + 2];
+    char format[32];
+
+    snprintf(format, sizeof(format), "%%u %%%u[0-9A-Fa-f] %%u %%u %%u", (unsigned) sizeof(hex) - 1);
+
+    data.isValid = false;
+
+    if(sscanf(line.c_str(), format, &nBits, hex, &id, &isRepeated, &nextGap) < 4) return false;
+
+    data.protocol = g_irProtocols.GetProtocol((IRProtocol::Id) id);
+    data.nBits = nBits;
+    data.isRepeated = isRepeated;
+    data.nextGap = nextGap;
+
+    if(data.protocol == NULL || nBits == 0 || nBits > 8 * IRDATA_MAX_VALUE_SIZE || nextGap > 0xFF
+        || strlen(hex) != 2 * (size_t) data.Length())
+    {
+        return false;
+    }
+
+    for(uint8_t i = 0; i < data.Length(); i++)
+    {
+        data.data[i] = strtoul(std::string(hex + 2 * i, 2).c_str(), NULL, 16);
+    }
+
+    data.isValid = true;
+    return true;
+}
+
+#endif
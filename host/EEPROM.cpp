@@ -0,0 +1,65 @@
+#include <EEPROM.h>
+#include <avr/eeprom.h>
+
+EEPROMClass EEPROM;
+
+uint8_t g_hostEeprom[E2END + 1];
+
+namespace
+{
+    unsigned long s_writeCount = 0;
+    unsigned long s_readCount = 0;
+
+    // erased cells read 0xFF, as on a fresh chip
+    struct EraseOnStartup
+    {
+        EraseOnStartup() { memset(g_hostEeprom, 0xFF, sizeof(g_hostEeprom)); }
+    } s_eraseOnStartup;
+
+    inline size_t cell(const void *addr) { return (size_t) addr & E2END; }
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+    s_readCount++;
+    return g_hostEeprom[cell(addr)];
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+    g_hostEeprom[cell(addr)] = value;
+    s_writeCount++;
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+    if(eeprom_read_byte(addr) != value) eeprom_write_byte(addr, value);
+}
+
+void eeprom_read_block(void *dest, const void *src, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        ((uint8_t *) dest)[i] = eeprom_read_byte((const uint8_t *) src + i);
+    }
+}
+
+void eeprom_write_block(const void *src, void *dest, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        eeprom_write_byte((uint8_t *) dest + i, ((const uint8_t *) src)[i]);
+    }
+}
+
+void eeprom_update_block(const void *src, void *dest, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        eeprom_update_byte((uint8_t *) dest + i, ((const uint8_t *) src)[i]);
+    }
+}
+
+unsigned long hostEepromWriteCount() { return s_writeCount; }
+
+unsigned long hostEepromReadCount() { return s_readCount; }
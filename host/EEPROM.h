@@ -0,0 +1,35 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+/**
+ * Host stand-in for Arduino's EEPROM library: 1 KB kept in memory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "avr/eeprom.h"
+
+class EEPROMClass
+{
+    public:
+        uint8_t read(int idx) { return eeprom_read_byte((const uint8_t *)(size_t) idx); }
+        void write(int idx, uint8_t val) { eeprom_write_byte((uint8_t *)(size_t) idx, val); }
+        void update(int idx, uint8_t val) { eeprom_update_byte((uint8_t *)(size_t) idx, val); }
+        uint16_t length() { return E2END + 1; }
+
+        template <class T> T & get(int idx, T &t)
+        {
+            eeprom_read_block(&t, (const void *)(size_t) idx, sizeof(T));
+            return t;
+        }
+
+        template <class T> const T & put(int idx, const T &t)
+        {
+            eeprom_update_block(&t, (void *)(size_t) idx, sizeof(T));
+            return t;
+        }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
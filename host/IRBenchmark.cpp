@@ -0,0 +1,394 @@
+/**
+ * Micro-benchmark of the IR encode and decode paths, over the codes
+ * of codes.txt.
+ *
+ * For each code, a raw capture is synthesized from its protocol timings
+ * (as IRremote would fill rawbuf), and then decodeIR(), tryDecodeIR()
+ * with the code's protocol, and sendIRBlock() are timed one call at a
+ * time. Results are grouped by protocol and frame length, as frames
+ * per second and worst-case latency of a single call.
+ *
+ * Then IRCodeCache::Get() is timed on an image of IRCACHE_REMOTES AC
+ * remotes, the remotes of codes.txt (4 codes each) over and over, as
+ * programming would store them: shared, patched or full records, in
+ * the pool or past it, on EEPROM. Results are grouped by how the code
+ * is stored, with the EEPROM bytes a Get() reads.
+ *
+ * usage: ir-bench [-n iterations] [-s baseline.txt] [-c baseline.txt] [codes.txt]
+ *
+ *   -n     calls per code and operation (default 2000)
+ *   -s     saves the results as a baseline
+ *   -c     compares the results with a baseline saved before
+ *
+ * codes.txt defaults to the one on the current directory.
+ */
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+
+#include "../IRProtocols.hpp"
+#include "../IRData.hpp"
+#include "../IRDecoder.hpp"
+#include "../IRSender.hpp"
+#include "../IRWaveform.hpp"
+#include "../IRStorage.hpp"
+#include "../IRCodeCache.hpp"
+#include "CodeLine.h"
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * AC remotes on the image IRCodeCache::Get() is timed on, as many as
+ * fit in EEPROM
+ */
+#define IRCACHE_REMOTES     20
+
+enum Operation
+{
+    DecodeIR = 0,
+    TryDecodeIR,
+    SendIRBlock,
+    OperationCount
+};
+
+static const char *s_operationNames[OperationCount] = {"decodeIR", "tryDecodeIR", "sendIRBlock"};
+
+struct Measure
+{
+    unsigned long calls;
+    double totalNs;
+    double worstNs;
+};
+
+/**
+ * Results of a protocol and frame length
+ */
+struct Group
+{
+    std::string protocol;
+    unsigned nBits;
+    unsigned codes;
+    unsigned failed;    // codes that didn't decode back
+    Measure measures[OperationCount];
+};
+
+typedef std::map<std::string, double> Baseline;     // "protocol bits op" to frames/s
+
+static std::string groupKey(const std::string &protocol, unsigned nBits, int operation)
+{
+    return protocol + " " + std::to_string(nBits) + " " + s_operationNames[operation];
+}
+
+/**
+ * Fills rawbuf with a frame as received by IRremote: rawbuf[0] is the
+ * gap before it, followed by marks and spaces in ticks, as the frame's
+ * waveform plays them.
+ */
+static void synthesize(IRData &data, decode_results &results)
+{
+    IRWaveform waveform;
+    IRWaveform::Cursor cursor;
+    bool isMark;
+    uint16_t usecs;
+    uint16_t length = 0;
+
+    results.rawbuf[length++] = GAP_TICKS;
+
+    waveform.Compile(data);
+    waveform.Rewind(cursor);
+
+    while(waveform.Next(cursor, isMark, usecs))
+    {
+        results.rawbuf[length++] = (isMark ? usecs + MARK_EXCESS : usecs - MARK_EXCESS) / USECPERTICK;
+    }
+
+    results.rawlen = length;
+    results.overflow = 0;
+}
+
+template <class Call> static void measure(Measure &result, unsigned long iterations, Call call)
+{
+    for(unsigned long i = 0; i < iterations; i++)
+    {
+        Clock::time_point begin = Clock::now();
+        call();
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+
+        result.calls++;
+        result.totalNs += ns;
+        if(ns > result.worstNs) result.worstNs = ns;
+    }
+}
+
+/**
+ * Get() of the codes stored one way
+ */
+struct CacheGroup
+{
+    bool isPatch;
+    bool pastPool;          // some bytes are read from EEPROM
+    unsigned codes;
+    unsigned long eepromBytes;  // most read by a Get()
+    Measure measure;
+};
+
+/**
+ * Times IRCodeCache::Get(), see the top of the file
+ *
+ * @param   codes   of codes.txt, single frame, in order
+ */
+static void benchCache(const std::vector<IRData> &codes, unsigned long iterations)
+{
+    std::vector<CacheGroup> groups;
+    uint8_t remoteQty = IRCACHE_REMOTES;
+    uint16_t dataAddr;
+    uint8_t count;
+
+    if(codes.size() < 4) return;
+
+    // as many remotes as fit
+    for(;; remoteQty--)
+    {
+        dataAddr = g_irStorage.Begin(remoteQty, false);
+        count = g_irStorage.CodeCount();
+
+        uint8_t index;
+        for(index = 0; index < count; index++)
+        {
+            IRData code = codes[index % (codes.size() / 4 * 4)];
+
+            // other copies of a remote are other remotes
+            code.data[0] ^= index / (codes.size() / 4 * 4);
+            if(!g_irStorage.WriteCode(index, code, dataAddr)) break;
+        }
+
+        if(index == count || remoteQty == 1) break;
+    }
+
+    g_irStorage.Commit(dataAddr);
+    if(g_irStorage.Validate(remoteQty) != IRStorage::None) return;
+
+    g_irCodeCache.Load(IRStorage::PointerTable, g_irStorage.Length(), count);
+
+    for(uint8_t index = 0; index < count; index++)
+    {
+        IRData code;
+        uint16_t pointer = 0;
+        unsigned long reads = hostEepromReadCount();
+
+        g_irCodeCache.Get(index, code);
+
+        CacheGroup key = {};
+        g_irCodeCache.Read(IRStorage::PointerAddr(index), &pointer, sizeof(pointer));
+        key.isPatch = pointer & IRStorage::PatchFlag;
+        key.pastPool = hostEepromReadCount() > reads;
+
+        CacheGroup *group = NULL;
+        for(size_t i = 0; i < groups.size(); i++)
+        {
+            if(groups[i].isPatch == key.isPatch && groups[i].pastPool == key.pastPool) group = &groups[i];
+        }
+        if(group == NULL)
+        {
+            groups.push_back(key);
+            group = &groups.back();
+        }
+
+        group->codes++;
+        if(hostEepromReadCount() - reads > group->eepromBytes) group->eepromBytes = hostEepromReadCount() - reads;
+
+        measure(group->measure, iterations, [&]() { g_irCodeCache.Get(index, code); });
+    }
+
+    printf("\nIRCodeCache::Get(), %u remotes, %u codes, image %u bytes, pool %u bytes\n\n",
+        remoteQty, count, g_irStorage.Length(), IRCACHE_POOL_SIZE);
+    printf("%-8s %-10s %5s %12s %12s %10s\n", "record", "from", "codes", "eeprom bytes", "gets/s", "worst us");
+
+    for(size_t i = 0; i < groups.size(); i++)
+    {
+        CacheGroup &group = groups[i];
+        Measure &m = group.measure;
+
+        printf("%-8s %-10s %5u %12lu %12.0f %10.2f\n", group.isPatch ? "patch" : "full",
+            group.pastPool ? "EEPROM" : "pool", group.codes, group.eepromBytes,
+            m.totalNs > 0 ? m.calls * 1e9 / m.totalNs : 0, m.worstNs / 1000);
+    }
+}
+
+static bool loadBaseline(const char *path, Baseline &baseline)
+{
+    std::ifstream file(path);
+    std::string protocol, operation;
+    unsigned nBits;
+    double fps, worst;
+
+    if(!file) return false;
+
+    while(file >> protocol >> nBits >> operation >> fps >> worst)
+    {
+        baseline[protocol + " " + std::to_string(nBits) + " " + operation] = fps;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    const char *codesPath = "codes.txt";
+    const char *savePath = NULL;
+    const char *comparePath = NULL;
+    unsigned long iterations = 2000;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            iterations = strtoul(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+        {
+            savePath = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            comparePath = argv[++i];
+        }
+        else if(argv[i][0] != '-')
+        {
+            codesPath = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-n iterations] [-s baseline.txt] [-c baseline.txt] [codes.txt]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::ifstream codesFile(codesPath);
+    if(!codesFile)
+    {
+        fprintf(stderr, "can't read %s\n", codesPath);
+        return 1;
+    }
+
+    Baseline baseline;
+    if(comparePath != NULL && !loadBaseline(comparePath, baseline))
+    {
+        fprintf(stderr, "can't read %s\n", comparePath);
+        return 1;
+    }
+
+    static unsigned int rawbuf[RAWBUF];
+    std::vector<Group> groups;
+    std::vector<IRData> codes;
+    bool chained = false;       // the last line was a frame with another after it
+    std::string line;
+    IRsend irSender;
+
+    while(std::getline(codesFile, line))
+    {
+        IRData code, decoded;
+        decode_results results;
+
+        if(!parseCodeLine(line, code)) continue;
+
+        // single frame codes, for benchCache
+        if(code.nextGap == 0 && !chained) codes.push_back(code);
+        chained = code.nextGap > 0;
+
+        results.rawbuf = rawbuf;
+        synthesize(code, results);
+
+        std::string protocol = code.protocol->Name().c_str();
+        Group *group = NULL;
+        for(size_t i = 0; i < groups.size(); i++)
+        {
+            if(groups[i].protocol == protocol && groups[i].nBits == code.nBits) group = &groups[i];
+        }
+        if(group == NULL)
+        {
+            Group empty = {protocol, code.nBits, 0, 0, {}};
+            groups.push_back(empty);
+            group = &groups.back();
+        }
+
+        group->codes++;
+
+        decodeIR(&results, decoded, 0);
+        if(!decoded.isValid || decoded.nBits != code.nBits || decoded.protocol != code.protocol
+            || memcmp(decoded.data, code.data, code.Length()))
+        {
+            group->failed++;
+        }
+
+        measure(group->measures[DecodeIR], iterations,
+            [&]() { decodeIR(&results, decoded, 0); });
+        measure(group->measures[TryDecodeIR], iterations,
+            [&]() { IRDecoder::tryDecodeIR(&results, decoded, code.protocol); });
+        measure(group->measures[SendIRBlock], iterations,
+            [&]() { irSender.hostClear(); sendIRBlock(irSender, code); });
+    }
+
+    FILE *save = NULL;
+    if(savePath != NULL && (save = fopen(savePath, "w")) == NULL)
+    {
+        fprintf(stderr, "can't write %s\n", savePath);
+        return 1;
+    }
+
+    printf("%-10s %4s %5s  %-12s %12s %10s%s\n", "protocol", "bits", "codes", "operation",
+        "frames/s", "worst us", comparePath ? "   vs base" : "");
+
+    for(size_t i = 0; i < groups.size(); i++)
+    {
+        Group &group = groups[i];
+
+        for(int op = 0; op < OperationCount; op++)
+        {
+            Measure &m = group.measures[op];
+            double fps = m.totalNs > 0 ? m.calls * 1e9 / m.totalNs : 0;
+
+            printf("%-10s %4u %5u  %-12s %12.0f %10.2f", group.protocol.c_str(), group.nBits,
+                group.codes, s_operationNames[op], fps, m.worstNs / 1000);
+
+            if(comparePath != NULL)
+            {
+                Baseline::iterator base = baseline.find(groupKey(group.protocol, group.nBits, op));
+                if(base != baseline.end() && base->second > 0)
+                {
+                    printf(" %+9.1f%%", (fps / base->second - 1) * 100);
+                }
+                else
+                {
+                    printf(" %10s", "new");
+                }
+            }
+            printf("\n");
+
+            if(save != NULL)
+            {
+                fprintf(save, "%s %u %s %.0f %.2f\n", group.protocol.c_str(), group.nBits,
+                    s_operationNames[op], fps, m.worstNs / 1000);
+            }
+        }
+
+        if(group.failed > 0)
+        {
+            printf("%-10s %4u  %u of %u codes don't decode back\n", group.protocol.c_str(),
+                group.nBits, group.failed, group.codes);
+        }
+    }
+
+    if(save != NULL) fclose(save);
+
+    benchCache(codes, iterations);
+
+    return 0;
+}
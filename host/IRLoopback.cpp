@@ -0,0 +1,419 @@
+/**
+ * Encode/decode loopback over a noisy virtual IR channel, to tell how
+ * much timing margin the protocol table has.
+ *
+ * Codes are sent with sendIR(), their marks and spaces go through the
+ * channel, which adds the noise below, and are sampled in ticks as
+ * IRremote's receive ISR does; then decodeIR() must give the same code
+ * back. Every code is sent many times at each jitter level, with fresh
+ * random noise, and the rate of codes decoded back is printed per
+ * protocol, along with the widest jitter each protocol takes.
+ *
+ * Codes are random, for every protocol of g_irProtocolTable: random
+ * data bits, on frames from 1 bit to the longest IRremote can capture
+ * whole, repeated and not on shapes with a repeat (see RandomCode.h).
+ * The codes of codes.txt, if there's one, are sent too.
+ *
+ * The channel, in order:
+ *   - dropped marks: the mark is lost, and the spaces around it merge
+ *   - split marks: a short space (two ticks) opens in the middle
+ *   - mark stretching: marks grow and spaces shrink (MARK_EXCESS)
+ *   - jitter: every edge moves, uniformly within +-jitter
+ *   - tick sampling, at a random phase: widths shorter than a tick may
+ *     vanish, merging their neighbours
+ *
+ * Accepted ranges are computed at compile time from TOLERANCE, so each
+ * ir-loopback-tolNN binary is built with TOLERANCE NN (see
+ * CMakeLists.txt); ir-loopback has the project's.
+ *
+ * usage: ir-loopback [-n trials] [-j max:step] [-e stretch] [-d drop] [-s split]
+ *                    [-g codes] [-m margin] [-r seed] [codes.txt]
+ *
+ *   -n     round-trips per code and jitter level (default 1000)
+ *   -j     jitter levels, from 0 to max, in us (default 300:25)
+ *   -e     mark stretching, in us (default 0)
+ *   -d     chance of a mark to be dropped, in % (default 0)
+ *   -s     chance of a mark to be split, in % (default 0)
+ *   -g     random codes per protocol, and per repeat on shapes with one
+ *          (default 8)
+ *   -m     exits with an error if a protocol's margin is under this
+ *          jitter, in us (default none)
+ *   -r     random seed (default 1)
+ *
+ * codes.txt defaults to the one on the current directory, and is
+ * skipped if there's none there.
+ */
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+
+#include "../IRProtocols.hpp"
+#include "../IRData.hpp"
+#include "../IRDecoder.hpp"
+#include "../IRSender.hpp"
+#include "CodeLine.h"
+#include "RandomCode.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+
+/**
+ * Lowest rate of codes decoded back for a jitter level to be within
+ * the margin of a protocol, in %
+ */
+#define IRLOOPBACK_MIN_SUCCESS  99.0
+
+/**
+ * Width of the space that splits a mark
+ */
+#define IRLOOPBACK_SPLIT_USECS  (2 * USECPERTICK)
+
+struct Noise
+{
+    int jitter;         // us
+    int stretch;        // us
+    double drop;        // 0-1
+    double split;       // 0-1
+};
+
+/**
+ * Outcomes of the round-trips of a protocol at a jitter level
+ */
+struct Tally
+{
+    unsigned long trials;
+    unsigned long decoded;      // same code back
+    unsigned long wrong;        // another code
+};
+
+typedef std::mt19937 Random;
+
+/**
+ * Applies the noise to a frame, in microseconds. Pulses may end up
+ * empty, or next to one of the same kind; sample() merges them.
+ *
+ * @param   pulses  marks and spaces, starting with a mark
+ */
+static void distort(std::vector<IRPulse> &pulses, const Noise &noise, Random &random)
+{
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::uniform_int_distribution<int> jitter(-noise.jitter, noise.jitter);
+    std::vector<IRPulse> out;
+    int edge = 0;   // shift of the edge before the pulse
+
+    for(size_t i = 0; i < pulses.size(); i++)
+    {
+        IRPulse pulse = pulses[i];
+
+        // the spaces around it become one
+        if(pulse.isMark && noise.drop > 0 && chance(random) < noise.drop) pulse.isMark = false;
+
+        if(pulse.isMark && noise.split > 0 && pulse.usec > 3 * IRLOOPBACK_SPLIT_USECS
+            && chance(random) < noise.split)
+        {
+            unsigned int half = (pulse.usec - IRLOOPBACK_SPLIT_USECS) / 2;
+            IRPulse first = {true, half}, gap = {false, IRLOOPBACK_SPLIT_USECS};
+
+            out.push_back(first);
+            out.push_back(gap);
+            pulse.usec -= half + IRLOOPBACK_SPLIT_USECS;
+        }
+
+        out.push_back(pulse);
+    }
+
+    for(size_t i = 0; i < out.size(); i++)
+    {
+        int next = jitter(random);
+        int usecs = out[i].usec + (out[i].isMark ? noise.stretch : -noise.stretch) + next - edge;
+
+        out[i].usec = usecs > 0 ? usecs : 0;
+        edge = next;
+    }
+
+    pulses.swap(out);
+}
+
+/**
+ * Samples a frame as the receive ISR does, every USECPERTICK from a
+ * random phase: each edge falls on a tick, and pulses between edges
+ * on the same tick vanish.
+ */
+static void sample(const std::vector<IRPulse> &pulses, Random &random, decode_results &results)
+{
+    std::uniform_int_distribution<int> phase(0, USECPERTICK - 1);
+    unsigned long at = phase(random);
+    uint16_t length = 0;
+
+    results.rawbuf[length++] = GAP_TICKS;
+    results.overflow = 0;
+
+    for(size_t i = 0; i < pulses.size(); i++)
+    {
+        unsigned long end = at + pulses[i].usec;
+        unsigned int ticks = end / USECPERTICK - at / USECPERTICK;
+
+        at = end;
+
+        if(ticks == 0) continue;
+
+        // marks are on odd offsets
+        if(pulses[i].isMark != (length % 2 == 1))
+        {
+            if(length > 1) results.rawbuf[length - 1] += ticks;
+            continue;
+        }
+
+        if(length == RAWBUF)
+        {
+            results.overflow = 1;
+            break;
+        }
+
+        results.rawbuf[length++] = ticks;
+    }
+
+    // a trailing space is the gap after the frame
+    if(length % 2 == 1 && length > 1) length--;
+
+    results.rawlen = length;
+}
+
+static bool sameCode(IRData &decoded, IRData &code)
+{
+    return decoded.isValid && decoded.protocol == code.protocol && decoded.nBits == code.nBits
+        && decoded.isRepeated == code.isRepeated && !memcmp(decoded.data, code.data, code.Length());
+}
+
+int main(int argc, char **argv)
+{
+    const char *codesPath = "codes.txt";
+    bool defaultCodes = true;
+    unsigned long trials = 1000;
+    int maxJitter = 300, jitterStep = 25;
+    Noise noise = {0, 0, 0, 0};
+    unsigned long randomCodes = 8;
+    int minMargin = -1;
+    unsigned long seed = 1;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            trials = strtoul(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "-j") && i + 1 < argc)
+        {
+            if(sscanf(argv[++i], "%d:%d", &maxJitter, &jitterStep) != 2) jitterStep = 0;
+        }
+        else if(!strcmp(argv[i], "-e") && i + 1 < argc)
+        {
+            noise.stretch = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "-d") && i + 1 < argc)
+        {
+            noise.drop = atof(argv[++i]) / 100;
+        }
+        else if(!strcmp(argv[i], "-s") && i + 1 < argc)
+        {
+            noise.split = atof(argv[++i]) / 100;
+        }
+        else if(!strcmp(argv[i], "-g") && i + 1 < argc)
+        {
+            randomCodes = strtoul(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "-m") && i + 1 < argc)
+        {
+            minMargin = atoi(argv[++i]);
+        }
+        else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+        {
+            seed = strtoul(argv[++i], NULL, 10);
+        }
+        else if(argv[i][0] != '-')
+        {
+            codesPath = argv[i];
+            defaultCodes = false;
+        }
+        else
+        {
+            jitterStep = 0;
+            break;
+        }
+    }
+
+    if(jitterStep <= 0)
+    {
+        fprintf(stderr, "usage: %s [-n trials] [-j max:step] [-e stretch] [-d drop] [-s split]"
+            " [-g codes] [-m margin] [-r seed] [codes.txt]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<IRData> codes;
+    std::string line;
+    bool used[IRPROTOCOLS_COUNT] = {};
+    Random random(seed);
+    IRsend irSender;
+
+    for(uint8_t p = 0; p < IRPROTOCOLS_COUNT && randomCodes > 0; p++)
+    {
+        const IRProtocol *protocol = g_irProtocols.At(p);
+
+        for(uint8_t repeat = 0; repeat <= hasRepeat(protocol); repeat++)
+        {
+            uint8_t maxBits = maxFrameBits(protocol, repeat);
+            std::uniform_int_distribution<int> nBits(1, maxBits);
+
+            // the longest and shortest frames, then any
+            for(unsigned long i = 0; i < randomCodes && maxBits > 0; i++)
+            {
+                IRData code;
+
+                randomCode(code, protocol, i == 0 ? maxBits : i == 1 ? 1 : nBits(random), repeat, random);
+                codes.push_back(code);
+                used[p] = true;
+            }
+        }
+    }
+
+    std::ifstream codesFile(codesPath);
+    if(!codesFile && !defaultCodes)
+    {
+        fprintf(stderr, "can't read %s\n", codesPath);
+        return 1;
+    }
+
+    while(std::getline(codesFile, line))
+    {
+        IRData code;
+
+        if(!parseCodeLine(line, code)) continue;
+
+        codes.push_back(code);
+        used[code.protocol - g_irProtocols.At(0)] = true;
+    }
+
+    if(codes.empty())
+    {
+        fprintf(stderr, "no codes\n");
+        return 1;
+    }
+
+    // sent once, the channel works on copies
+    std::vector<std::vector<IRPulse> > sent(codes.size());
+    for(size_t i = 0; i < codes.size(); i++)
+    {
+        irSender.hostClear();
+        sendIR(irSender, codes[i]);
+
+        for(const IRPulse &pulse : irSender.hostPulses())
+        {
+            if(pulse.usec > 0) sent[i].push_back(pulse);
+        }
+    }
+
+    printf("TOLERANCE %d%%, stretch %d us, drop %.1f%%, split %.1f%%, %lu codes, %lu trials per code\n\n",
+        TOLERANCE, noise.stretch, noise.drop * 100, noise.split * 100, (unsigned long) codes.size(), trials);
+
+    printf("%9s", "jitter us");
+    for(uint8_t p = 0; p < IRPROTOCOLS_COUNT; p++)
+    {
+        if(used[p]) printf(" %9s", g_irProtocols.At(p)->Name().c_str());
+    }
+    printf(" %9s %9s\n", "all", "wrong");
+
+    static unsigned int rawbuf[RAWBUF];
+    int margin[IRPROTOCOLS_COUNT];
+    bool withinMargin[IRPROTOCOLS_COUNT];
+    unsigned long roundTrips = 0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+    for(uint8_t p = 0; p < IRPROTOCOLS_COUNT; p++)
+    {
+        margin[p] = -1;
+        withinMargin[p] = true;
+    }
+
+    for(int jitter = 0; jitter <= maxJitter; jitter += jitterStep)
+    {
+        Tally tallies[IRPROTOCOLS_COUNT] = {};
+        Tally all = {};
+
+        noise.jitter = jitter;
+
+        for(size_t i = 0; i < codes.size(); i++)
+        {
+            Tally &tally = tallies[codes[i].protocol - g_irProtocols.At(0)];
+
+            for(unsigned long n = 0; n < trials; n++)
+            {
+                std::vector<IRPulse> pulses = sent[i];
+                decode_results results;
+                IRData decoded;
+
+                results.rawbuf = rawbuf;
+                distort(pulses, noise, random);
+                sample(pulses, random, results);
+
+                decodeIR(&results, decoded, 0);
+
+                tally.trials++;
+                if(sameCode(decoded, codes[i])) tally.decoded++;
+                else if(decoded.isValid) tally.wrong++;
+            }
+        }
+
+        printf("%9d", jitter);
+        for(uint8_t p = 0; p < IRPROTOCOLS_COUNT; p++)
+        {
+            if(!used[p]) continue;
+
+            double rate = tallies[p].decoded * 100.0 / tallies[p].trials;
+
+            withinMargin[p] = withinMargin[p] && rate >= IRLOOPBACK_MIN_SUCCESS;
+            if(withinMargin[p]) margin[p] = jitter;
+
+            all.trials += tallies[p].trials;
+            all.decoded += tallies[p].decoded;
+            all.wrong += tallies[p].wrong;
+
+            printf(" %8.1f%%", rate);
+        }
+        printf(" %8.1f%% %8.2f%%\n", all.decoded * 100.0 / all.trials, all.wrong * 100.0 / all.trials);
+
+        roundTrips += all.trials;
+    }
+
+    bool underMargin = false;
+
+    printf("%9s", "margin us");
+    for(uint8_t p = 0; p < IRPROTOCOLS_COUNT; p++)
+    {
+        if(!used[p]) continue;
+
+        if(margin[p] < 0) printf(" %9s", "none");
+        else printf(" %9d", margin[p]);
+
+        if(margin[p] < minMargin) underMargin = true;
+    }
+    printf("\n\n");
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("margin: widest jitter with at least %.0f%% of codes decoded back\n", IRLOOPBACK_MIN_SUCCESS);
+    printf("%lu round-trips in %.1f s (%.1f million per minute)\n", roundTrips, seconds,
+        seconds > 0 ? roundTrips * 60 / seconds / 1e6 : 0);
+
+    if(underMargin)
+    {
+        fprintf(stderr, "margin under %d us\n", minMargin);
+        return 1;
+    }
+
+    return 0;
+}
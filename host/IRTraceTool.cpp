@@ -0,0 +1,289 @@
+/**
+ * Decodes libraries of raw captures offline, with the same decodeIR()
+ * and protocol table as the firmware.
+ *
+ * Every capture found is decoded and printed in the format of codes.txt
+ * (number of bits, data in hex, protocol id, is repeated) on stdout.
+ * Captures that don't decode are reported as comment lines ("# ...").
+ * A summary goes to stderr.
+ *
+ * usage: ir-trace [-v] file...
+ *        ir-trace -e codes.txt > traces.irt
+ *
+ *   file   binary trace (see IRTrace.hpp), or a serial log of the
+ *          dumper mode, from which "Trace: " lines are taken; "-" is stdin
+ *   -v     prints the decoder debug output of failed captures
+ *   -e     instead of decoding, writes a trace of each code of a codes.txt
+ *          file, as sent by sendIR(), to stdout
+ */
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+
+#include "../IRProtocols.hpp"
+#include "../IRData.hpp"
+#include "../IRDecoder.hpp"
+#include "../IRSender.hpp"
+#include "../IRTrace.hpp"
+#include "CodeLine.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+/**
+ * IRTrace source over a memory buffer
+ */
+struct BufferSource
+{
+    const std::vector<uint8_t> &buffer;
+    size_t position;
+
+    BufferSource(const std::vector<uint8_t> &b) : buffer(b), position(0) {}
+
+    int read() { return position < buffer.size() ? buffer[position++] : -1; }
+};
+
+/**
+ * IRTrace sink to a file
+ */
+struct FileSink
+{
+    FILE *file;
+
+    void write(uint8_t value) { fputc(value, file); }
+};
+
+static bool s_verbose = false;
+static unsigned long s_captures = 0, s_decoded = 0, s_failed = 0;
+
+static bool readFile(const char *path, std::vector<uint8_t> &content)
+{
+    FILE *file = strcmp(path, "-") ? fopen(path, "rb") : stdin;
+    if(file == NULL) return false;
+
+    uint8_t buffer[4096];
+    size_t size;
+    while((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        content.insert(content.end(), buffer, buffer + size);
+    }
+
+    if(file != stdin) fclose(file);
+    return true;
+}
+
+static void decodeCapture(decode_results *results, const char *path, unsigned long record)
+{
+    IRData data;
+
+    s_captures++;
+
+    if(decodeIR(results, data, 0))
+    {
+        s_decoded++;
+        data.PrintCode(Serial);
+        return;
+    }
+
+    s_failed++;
+    Serial.flush();
+    printf("# %s:%lu no match, %u widths\n", path, record, (unsigned) results->rawlen);
+
+    if(s_verbose)
+    {
+        decodeIR(results, data, 1);
+        Serial.flush();
+    }
+}
+
+/**
+ * Decodes all records of a binary trace
+ */
+static void decodeTrace(const std::vector<uint8_t> &content, const char *path)
+{
+    static unsigned int rawbuf[RAWBUF];
+    decode_results results;
+    BufferSource source(content);
+
+    results.rawbuf = rawbuf;
+
+    for(unsigned long record = 1; ; record++)
+    {
+        IRTrace::Error error = IRTrace::Read(source, &results, RAWBUF);
+
+        if(error == IRTrace::EndOfTrace) return;
+
+        if(error != IRTrace::None)
+        {
+            Serial.flush();
+            printf("# %s:%lu %s\n", path, record, IRTrace::errorToString(error).c_str());
+            s_failed++;
+
+            // the rest of the file can't be trusted, except for a
+            // record that was skipped as a whole
+            if(error != IRTrace::TooLong) return;
+            continue;
+        }
+
+        decodeCapture(&results, path, record);
+    }
+}
+
+/**
+ * Decodes the "Trace: " lines of a text log
+ */
+static void decodeLog(const std::vector<uint8_t> &content, const char *path)
+{
+    static const char prefix[] = "Trace: ";
+    std::string text(content.begin(), content.end());
+    size_t start = 0;
+    unsigned long line = 0;
+
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos) end = text.size();
+        line++;
+
+        size_t found = text.find(prefix, start);
+        if(found < end)
+        {
+            std::vector<uint8_t> record;
+
+            for(size_t i = found + sizeof(prefix) - 1; i + 1 < end; i += 2)
+            {
+                if(!isxdigit(text[i]) || !isxdigit(text[i + 1])) break;
+                record.push_back(strtoul(text.substr(i, 2).c_str(), NULL, 16));
+            }
+
+            std::string where = std::string(path) + ":" + std::to_string(line);
+            decodeTrace(record, where.c_str());
+        }
+
+        start = end + 1;
+    }
+}
+
+/**
+ * Writes a trace of each code on a codes.txt file, using the pulses
+ * recorded by the host IRsend.
+ */
+static int encodeCodes(const char *path)
+{
+    static unsigned int rawbuf[RAWBUF];
+    std::vector<uint8_t> content;
+    IRsend irSender;
+    FileSink sink = {stdout};
+
+    if(!readFile(path, content))
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        return 1;
+    }
+
+    std::string text(content.begin(), content.end());
+    size_t start = 0;
+    unsigned long codes = 0;
+
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos) end = text.size();
+        std::string line = text.substr(start, end - start);
+        start = end + 1;
+
+        IRData data;
+
+        // other lines are brand names or blank
+        if(!parseCodeLine(line, data)) continue;
+
+        irSender.hostClear();
+        sendIR(irSender, data);
+
+        decode_results results;
+        results.rawbuf = rawbuf;
+        results.rawlen = 0;
+        results.overflow = 0;
+        rawbuf[results.rawlen++] = GAP_TICKS;
+
+        const std::vector<IRPulse> &pulses = irSender.hostPulses();
+        for(size_t i = 0; i < pulses.size() && results.rawlen < RAWBUF; i++)
+        {
+            if(pulses[i].usec == 0) continue;     // LED off at the end
+            rawbuf[results.rawlen++] = (pulses[i].usec + USECPERTICK / 2) / USECPERTICK;
+        }
+
+        IRTrace::Write(sink, &results);
+        codes++;
+    }
+
+    fprintf(stderr, "%lu codes\n", codes);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<const char *> paths;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-e") && i + 1 < argc)
+        {
+            return encodeCodes(argv[i + 1]);
+        }
+        else if(!strcmp(argv[i], "-v"))
+        {
+            s_verbose = true;
+        }
+        else if(argv[i][0] != '-' || !strcmp(argv[i], "-"))
+        {
+            paths.push_back(argv[i]);
+        }
+        else
+        {
+            paths.clear();
+            break;
+        }
+    }
+
+    if(paths.empty())
+    {
+        fprintf(stderr, "usage: %s [-v] file...\n       %s -e codes.txt\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < paths.size(); i++)
+    {
+        std::vector<uint8_t> content;
+
+        if(!readFile(paths[i], content))
+        {
+            fprintf(stderr, "can't read %s\n", paths[i]);
+            return 1;
+        }
+
+        if(content.size() >= 2 && content[0] == 'I' && content[1] == 'T')
+        {
+            decodeTrace(content, paths[i]);
+        }
+        else
+        {
+            decodeLog(content, paths[i]);
+        }
+    }
+
+    Serial.flush();
+
+    double elapsed = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - begin).count();
+
+    fprintf(stderr, "%lu captures, %lu decoded, %lu failed, %.1f ms\n",
+        s_captures, s_decoded, s_failed, elapsed);
+
+    return s_failed ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+/**
+ * Programs a whole code set at once, with the binary upload mode of
+ * the remote (see IRUpload.hpp).
+ *
+ * Codes are read in order from a file in the format of codes.txt
+ * (other lines, like brand names, are ignored): 4 per AC remote, then
+ * 3 for the projector, if any. Frames of multi-frame codes (a line
+ * each, with the gap to the next one) count as a single code.
+ *
+ * usage: ir-upload -r remotes [-j] -d /dev/ttyUSB0 codes.txt
+ *        ir-upload -r remotes [-j] -o frames.bin codes.txt
+ *
+ *   -r     number of AC remotes
+ *   -j     there's a projector remote
+ *   -d     serial port of the remote (115200 baud). Each frame waits for
+ *          its ACK, and is sent again on NAK or when no answer comes.
+ *   -o     only writes the frames to a file ("-" for stdout), e.g. to
+ *          pipe into simple-ac-remote-host
+ */
+
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#include "../IRProtocols.hpp"
+#include "../IRData.hpp"
+#include "../IRUpload.hpp"
+#include "CodeLine.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <vector>
+
+#define RETRIES     5
+#define ANSWER_MS   1000
+
+typedef std::vector<uint8_t> Frame;
+
+static Frame makeFrame(uint8_t type, uint8_t sequence, const std::vector<uint8_t> &payload)
+{
+    Frame frame;
+    uint16_t crc = 0xFFFF;
+
+    frame.push_back(IRUPLOAD_SOF);
+    frame.push_back(type);
+    frame.push_back(sequence);
+    frame.push_back(payload.size());
+    frame.insert(frame.end(), payload.begin(), payload.end());
+
+    for(size_t i = 1; i < frame.size(); i++) crc = _crc_ccitt_update(crc, frame[i]);
+
+    frame.push_back(crc & 0xFF);
+    frame.push_back(crc >> 8);
+
+    return frame;
+}
+
+static int openPort(const char *path)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if(fd < 0) return -1;
+
+    struct termios tty;
+    if(tcgetattr(fd, &tty) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(fd, TCSANOW, &tty);
+
+    return fd;
+}
+
+/**
+ * Waits for the answer of a frame, skipping any text printed before it.
+ *
+ * @return  IRUploader::Error of a NAK, None on ACK, Timeout if none came
+ */
+static IRUploader::Error waitAnswer(int fd, uint8_t sequence)
+{
+    uint8_t answer[3];
+    size_t received = 0;
+
+    while(1)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if(poll(&pfd, 1, ANSWER_MS) <= 0) return IRUploader::Timeout;
+
+        uint8_t value;
+        if(read(fd, &value, 1) != 1) return IRUploader::Timeout;
+
+        if(received == 0 && value != IRUPLOAD_ACK && value != IRUPLOAD_NAK) continue;
+
+        answer[received++] = value;
+        if(received < sizeof(answer)) continue;
+
+        received = 0;
+        if(answer[1] != sequence) continue;     // answer to an old frame
+
+        return answer[0] == IRUPLOAD_ACK ? IRUploader::None : (IRUploader::Error) answer[2];
+    }
+}
+
+static bool sendFrame(int fd, const Frame &frame)
+{
+    for(int attempt = 0; attempt < RETRIES; attempt++)
+    {
+        if(write(fd, frame.data(), frame.size()) != (ssize_t) frame.size()) return false;
+
+        IRUploader::Error error = waitAnswer(fd, frame[2]);
+        if(error == IRUploader::None) return true;
+
+        fprintf(stderr, "frame %u: %s\n", frame[2], IRUploader::errorToString(error).c_str());
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    const char *device = NULL, *output = NULL, *codesPath = NULL;
+    unsigned remotes = 0;
+    bool hasProjector = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-r") && i + 1 < argc) remotes = strtoul(argv[++i], NULL, 10);
+        else if(!strcmp(argv[i], "-j")) hasProjector = true;
+        else if(!strcmp(argv[i], "-d") && i + 1 < argc) device = argv[++i];
+        else if(!strcmp(argv[i], "-o") && i + 1 < argc) output = argv[++i];
+        else if(argv[i][0] != '-') codesPath = argv[i];
+        else codesPath = NULL, i = argc;
+    }
+
+    if(remotes == 0 || codesPath == NULL || (device == NULL) == (output == NULL))
+    {
+        fprintf(stderr, "usage: %s -r remotes [-j] (-d port | -o file) codes.txt\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream codesFile(codesPath);
+    std::vector<std::vector<IRData> > codes;
+    std::string line;
+    bool hasNext = false;
+
+    while(std::getline(codesFile, line))
+    {
+        IRData data;
+        if(!parseCodeLine(line, data)) continue;
+
+        if(!hasNext) codes.push_back(std::vector<IRData>());
+        codes.back().push_back(data);
+        hasNext = data.nextGap > 0;
+
+        if(codes.back().size() > IRDATA_MAX_FRAMES)
+        {
+            fprintf(stderr, "%s: code %u has more than %u frames\n", codesPath,
+                (unsigned) codes.size() - 1, IRDATA_MAX_FRAMES);
+            return 1;
+        }
+    }
+
+    size_t expected = remotes * 4 + (hasProjector ? 3 : 0);
+    if(codes.size() != expected || hasNext)
+    {
+        fprintf(stderr, "%s: %u codes, %u expected\n", codesPath,
+            (unsigned) codes.size(), (unsigned) expected);
+        return 1;
+    }
+
+    std::vector<Frame> frames;
+    uint8_t sequence = 0;
+
+    frames.push_back(makeFrame('B', sequence++, {(uint8_t) remotes, (uint8_t) hasProjector}));
+
+    for(size_t i = 0; i < codes.size(); i++)
+    {
+        for(size_t j = 0; j < codes[i].size(); j++)
+        {
+            IRData &code = codes[i][j];
+
+            std::vector<uint8_t> payload = {(uint8_t) i, code.nBits,
+                (uint8_t) code.protocol->GetId(), code.Flags()};
+            payload.insert(payload.end(), code.data, code.data + code.Length());
+            if(code.nextGap > 0) payload.push_back(code.nextGap);
+
+            frames.push_back(makeFrame('C', sequence++, payload));
+        }
+    }
+
+    frames.push_back(makeFrame('E', sequence++, {}));
+
+    if(output != NULL)
+    {
+        FILE *file = strcmp(output, "-") ? fopen(output, "wb") : stdout;
+        if(file == NULL)
+        {
+            fprintf(stderr, "can't write %s\n", output);
+            return 1;
+        }
+
+        for(size_t i = 0; i < frames.size(); i++) fwrite(frames[i].data(), 1, frames[i].size(), file);
+
+        if(file != stdout) fclose(file);
+        return 0;
+    }
+
+    int fd = openPort(device);
+    if(fd < 0)
+    {
+        fprintf(stderr, "can't open %s\n", device);
+        return 1;
+    }
+
+    for(size_t i = 0; i < frames.size(); i++)
+    {
+        if(!sendFrame(fd, frames[i]))
+        {
+            fprintf(stderr, "upload failed at frame %u\n", (unsigned) i);
+            close(fd);
+            return 1;
+        }
+    }
+
+    close(fd);
+    fprintf(stderr, "%u codes uploaded\n", (unsigned) codes.size());
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include <IRremote.h>
+
+/******************************************************************************
+ * Timing matchers, same as IRremote.cpp
+ */
+
+int MATCH(int measured, int desired)
+{
+    return measured >= TICKS_LOW(desired) && measured <= TICKS_HIGH(desired);
+}
+
+int MATCH_MARK(int measured_ticks, int desired_us)
+{
+    return measured_ticks >= TICKS_LOW(desired_us + MARK_EXCESS)
+        && measured_ticks <= TICKS_HIGH(desired_us + MARK_EXCESS);
+}
+
+int MATCH_SPACE(int measured_ticks, int desired_us)
+{
+    return measured_ticks >= TICKS_LOW(desired_us - MARK_EXCESS)
+        && measured_ticks <= TICKS_HIGH(desired_us - MARK_EXCESS);
+}
+
+
+/******************************************************************************
+ * IRrecv
+ */
+
+void IRrecv::hostInject(const uint16_t *ticks, uint16_t count)
+{
+    m_pending.push_back(std::vector<uint16_t>(ticks, ticks + count));
+}
+
+/**
+ * Like the real decode(), returns the same capture until resume() is called.
+ */
+int IRrecv::decode(decode_results *results)
+{
+    if(!m_enabled) return 0;
+
+    if(!m_stopped)
+    {
+        if(m_pending.empty()) return 0;
+
+        const std::vector<uint16_t> &capture = m_pending.front();
+        uint16_t rawlen = 1;
+
+        m_rawbuf[0] = GAP_TICKS * 2;    // leading gap, ignored by decoders
+        results->overflow = 0;
+
+        for(size_t i = 0; i < capture.size(); i++)
+        {
+            if(rawlen == RAWBUF)
+            {
+                results->overflow = 1;
+                break;
+            }
+            m_rawbuf[rawlen++] = capture[i];
+        }
+
+        results->rawlen = rawlen;
+        m_pending.erase(m_pending.begin());
+        m_stopped = true;
+    }
+
+    results->rawbuf = m_rawbuf;
+    results->decode_type = -1;     // UNKNOWN
+    results->value = 0;
+    results->bits = 0;
+
+    return 1;
+}
+
+
+/******************************************************************************
+ * IRsend
+ */
+
+void IRsend::mark(unsigned int usec)
+{
+    IRPulse pulse = {true, usec};
+    m_pulses.push_back(pulse);
+    hostAdvanceMicros(usec);
+}
+
+void IRsend::space(unsigned int usec)
+{
+    IRPulse pulse = {false, usec};
+    m_pulses.push_back(pulse);
+    hostAdvanceMicros(usec);
+}
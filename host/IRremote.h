@@ -0,0 +1,96 @@
+#ifndef IRremote_h
+#define IRremote_h
+
+/**
+ * Host stand-in for Shirriff's IRremote library.
+ *
+ * IRrecv replays captures queued with hostInject(), and IRsend records
+ * every mark and space instead of driving the IR LED, so both ends of
+ * the IR core can be exercised and profiled without hardware.
+ */
+
+#include <stdint.h>
+#include <vector>
+
+#include "IRremoteInt.h"
+
+int MATCH(int measured, int desired);
+int MATCH_MARK(int measured_ticks, int desired_us);
+int MATCH_SPACE(int measured_ticks, int desired_us);
+
+class decode_results
+{
+    public:
+        int decode_type;
+        unsigned int address;
+        unsigned long value;
+        int bits;
+        volatile unsigned int *rawbuf;  // raw intervals in 50 usec ticks
+        uint16_t rawlen;                // patched, see README
+        int overflow;
+};
+
+class IRrecv
+{
+    public:
+        IRrecv(int recvpin) : m_pin(recvpin) {}
+
+        void enableIRIn() { m_enabled = true; }
+        int decode(decode_results *results);
+        void resume() { m_stopped = false; }
+        bool isIdle() { return !m_stopped; }
+        void blink13(int) {}
+
+        /**
+         * Queues a capture as it would be measured by the receive ISR.
+         *
+         * @param   ticks   mark/space widths in ticks, starting with the
+         *                  header mark (the leading gap is added here)
+         * @param   count   number of widths
+         */
+        void hostInject(const uint16_t *ticks, uint16_t count);
+
+    private:
+        int m_pin;
+        bool m_enabled = false;
+        bool m_stopped = false;
+        std::vector<std::vector<uint16_t> > m_pending;
+        unsigned int m_rawbuf[RAWBUF];
+};
+
+/**
+ * One recorded call to IRsend::mark() or IRsend::space()
+ */
+struct IRPulse
+{
+    bool isMark;
+    unsigned int usec;
+};
+
+class IRsend
+{
+    public:
+        void enableIROut(int khz) { m_khz = khz; }
+        void mark(unsigned int usec);
+        void space(unsigned int usec);
+
+        /**
+         * Records a pulse played by other means (e.g. a timer interrupt),
+         * without advancing the virtual time
+         */
+        void hostRecord(bool isMark, unsigned int usec)
+        {
+            IRPulse pulse = {isMark, usec};
+            m_pulses.push_back(pulse);
+        }
+
+        const std::vector<IRPulse> &hostPulses() const { return m_pulses; }
+        void hostClear() { m_pulses.clear(); }
+        int hostCarrierKhz() const { return m_khz; }
+
+    private:
+        int m_khz = 0;
+        std::vector<IRPulse> m_pulses;
+};
+
+#endif
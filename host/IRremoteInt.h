@@ -0,0 +1,30 @@
+#ifndef IRremoteint_h
+#define IRremoteint_h
+
+/**
+ * Host stand-in for IRremote's internal definitions, with the values
+ * patched as described in the README.
+ */
+
+#define RAWBUF          300     // Maximum length of raw duration buffer
+#define USECPERTICK     50      // microseconds per clock interrupt tick
+#define _GAP            10000   // Minimum gap between IR transmissions
+#define GAP_TICKS       (_GAP/USECPERTICK)
+
+#define MARK_EXCESS     0
+// percent tolerance in measurements; other values are only for the
+// ir-loopback-tolNN builds
+#ifndef TOLERANCE
+#define TOLERANCE       10
+#endif
+
+#define LTOL            (1.0 - (TOLERANCE/100.))
+#define UTOL            (1.0 + (TOLERANCE/100.))
+
+#define TICKS_LOW(us)   ((int)(((us)*LTOL/USECPERTICK)))
+#define TICKS_HIGH(us)  ((int)(((us)*UTOL/USECPERTICK + 1)))
+
+#define MARK   1
+#define SPACE  0
+
+#endif
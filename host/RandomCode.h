@@ -0,0 +1,108 @@
+#ifndef RandomCode_h
+#define RandomCode_h
+
+/**
+ * Random codes of the protocols on g_irProtocolTable, for the host
+ * tools and tests: random data bits, on frames as long as the shape of
+ * the protocol and IRremote's RAWBUF allow.
+ */
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+#include "../IRProtocols.hpp"
+#include "../IRData.hpp"
+#include "../IRSender.hpp"
+
+#include <string.h>
+#include <random>
+
+/**
+ * @return  true if the shape of the protocol has a RepeatFrom op, i.e.
+ *          its frames may be repeated
+ */
+inline bool hasRepeat(const IRProtocol *protocol)
+{
+    const uint8_t *shape = protocol->Shape();
+
+    for(uint8_t pc = 0; pgm_read_byte(shape + pc) != IRShape::End; )
+    {
+        uint8_t op = pgm_read_byte(shape + pc);
+
+        if(op == IRShape::RepeatFrom) return true;
+        pc += 1 + IRShape::OperandCount(op);
+    }
+
+    return false;
+}
+
+/**
+ * @return  marks and spaces of a frame, as IRremote captures it: runs
+ *          of pulses of the same kind are a width, and the space after
+ *          the frame isn't one
+ */
+inline size_t frameWidths(const IRData &code)
+{
+    IRsend irSender;
+    IRData frame = code;
+    size_t widths = 0;
+    bool isMark = false;
+
+    sendIR(irSender, frame);
+
+    for(const IRPulse &pulse : irSender.hostPulses())
+    {
+        if(pulse.usec == 0 || pulse.isMark == isMark) continue;
+
+        isMark = pulse.isMark;
+        widths++;
+    }
+
+    return isMark ? widths : widths - 1;
+}
+
+/**
+ * @return  most data bits of a frame of the protocol that IRremote can
+ *          capture whole, 0 if none
+ */
+inline uint8_t maxFrameBits(const IRProtocol *protocol, bool repeat)
+{
+    IRData code;
+
+    code.protocol = protocol;
+    code.isRepeated = repeat;
+    code.nextGap = 0;
+    code.isValid = true;
+    memset(code.data, 0, sizeof(code.data));
+
+    for(code.nBits = IRDATA_MAX_VALUE_SIZE * 8; code.nBits > 0; code.nBits--)
+    {
+        // rawbuf[0] is the gap before the frame
+        if(1 + frameWidths(code) <= RAWBUF) break;
+    }
+
+    return code.nBits;
+}
+
+/**
+ * Fills a code with random data bits
+ *
+ * @param   repeat  ignored if the shape has no repeat
+ */
+template <class Random>
+void randomCode(IRData &code, const IRProtocol *protocol, uint8_t nBits, bool repeat, Random &random)
+{
+    code.protocol = protocol;
+    code.nBits = nBits;
+    code.isRepeated = repeat && hasRepeat(protocol);
+    code.nextGap = 0;
+    code.isValid = true;
+    memset(code.data, 0, sizeof(code.data));
+
+    for(uint8_t i = 0; i < nBits; i++)
+    {
+        if(random() & 1) code.data[i / 8] |= 0x80 >> (i % 8);
+    }
+}
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * Runs simple-ac-remote.ino on the host.
+ *
+ * Serial input comes from stdin and output goes to stdout. Every frame
+ * sent through g_irSender is printed to stderr as signed microsecond
+ * widths (+mark -space), in the same notation used by dumpRaw().
+ *
+ * usage: simple-ac-remote-host [-e eeprom.bin] [-n loops] [-t ms] [-p pin:from:to]...
+ *
+ *   -e     EEPROM image, loaded if it exists and saved on exit
+ *   -n     number of loop() iterations after setup() (default 0), each
+ *          one taking at least 1 ms of virtual time
+ *   -t     virtual time limit in milliseconds (default 60000)
+ *   -p     holds an input pin LOW from..to milliseconds of virtual time,
+ *          e.g. -p 10:0:150 presses the level button at boot
+ *
+ * The run also ends when the time limit is reached, or when setup()
+ * polls an exhausted stdin (e.g. waiting for programming).
+ */
+
+#include <Arduino.h>
+
+#include "../simple-ac-remote.ino"
+
+#include <stdio.h>
+
+static const char *s_eepromPath = NULL;
+static bool s_flushAtExit = false;
+
+static void saveEeprom()
+{
+    if(s_eepromPath == NULL) return;
+
+    FILE *file = fopen(s_eepromPath, "wb");
+    if(file == NULL) return;
+    fwrite(g_hostEeprom, 1, sizeof(g_hostEeprom), file);
+    fclose(file);
+}
+
+static void loadEeprom()
+{
+    FILE *file = fopen(s_eepromPath, "rb");
+    if(file == NULL) return;
+    if(fread(g_hostEeprom, 1, sizeof(g_hostEeprom), file) != sizeof(g_hostEeprom))
+    {
+        fprintf(stderr, "short EEPROM image %s\n", s_eepromPath);
+    }
+    fclose(file);
+}
+
+static std::vector<IRPulse> s_frame;
+
+/**
+ * Moves the pulses recorded by the IR sender to s_frame, and prints
+ * each frame when it ends: on space(0) (end of a blocking send), on a
+ * space of _GAP or longer (queued sends), or at exit.
+ */
+static void flushSentPulses()
+{
+    std::vector<IRPulse> pulses = g_irSender.hostPulses();
+    g_irSender.hostClear();
+
+    for(size_t i = 0; i <= pulses.size(); i++)
+    {
+        bool atExit = i == pulses.size();
+        bool frameEnd = atExit
+            || (!pulses[i].isMark && (pulses[i].usec == 0 || pulses[i].usec >= _GAP));
+
+        if(!frameEnd)
+        {
+            s_frame.push_back(pulses[i]);
+            continue;
+        }
+
+        // frames may span several calls, so only flush at exit
+        // if asked to
+        if(s_frame.empty() || (atExit && !s_flushAtExit)) continue;
+
+        fprintf(stderr, "ir[%u]:", (unsigned) s_frame.size());
+        for(size_t j = 0; j < s_frame.size(); j++)
+        {
+            fprintf(stderr, " %c%u", s_frame[j].isMark ? '+' : '-', s_frame[j].usec);
+        }
+        fprintf(stderr, "\n");
+
+        s_frame.clear();
+    }
+}
+
+static void flushAtExit()
+{
+    s_flushAtExit = true;
+    flushSentPulses();
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long loops = 0;
+    unsigned long timeLimit = 60000;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-e") && i + 1 < argc)
+        {
+            s_eepromPath = argv[++i];
+        }
+        else if(!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            loops = strtoul(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            timeLimit = strtoul(argv[++i], NULL, 10);
+        }
+        else if(!strcmp(argv[i], "-p") && i + 1 < argc)
+        {
+            unsigned pin = 0;
+            unsigned long from = 0, to = 0;
+            if(sscanf(argv[++i], "%u:%lu:%lu", &pin, &from, &to) != 3)
+            {
+                fprintf(stderr, "invalid press %s\n", argv[i]);
+                return 2;
+            }
+            hostSchedulePinLow(pin, from, to);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-e eeprom.bin] [-n loops] [-t ms] [-p pin:from:to]...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if(s_eepromPath != NULL)
+    {
+        loadEeprom();
+        atexit(saveEeprom);
+    }
+    atexit(flushAtExit);
+
+    Serial.hostExitOnEof(true);
+    hostSetTimeLimit(timeLimit);
+
+    setup();
+    flushSentPulses();
+
+    // loop() polls the command shell; the number of loops ends the run
+    Serial.hostExitOnEof(false);
+
+    for(unsigned long i = 0; i < loops; i++)
+    {
+        loop();
+        flushSentPulses();
+        hostAdvanceMicros(1000);
+    }
+
+    Serial.flush();
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef eeprom_h
+#define eeprom_h
+
+/**
+ * Host stand-in for avr-libc's EEPROM block functions, operating on the
+ * same in-memory image as the EEPROM object.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END 0x3FF     // ATmega328P: 1 KB
+
+extern uint8_t g_hostEeprom[E2END + 1];
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dest, const void *src, size_t n);
+void eeprom_write_block(const void *src, void *dest, size_t n);
+void eeprom_update_block(const void *src, void *dest, size_t n);
+
+/**
+ * Host-only: number of EEPROM cells actually written (i.e. changed or
+ * rewritten), to compare wear and write time between storage schemes.
+ */
+unsigned long hostEepromWriteCount();
+
+/**
+ * Host-only: number of EEPROM cells read, to tell how much of a code
+ * comes from EEPROM instead of RAM (e.g. IRCodeCache's pool).
+ */
+unsigned long hostEepromReadCount();
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef pgmspace_h
+#define pgmspace_h
+
+/**
+ * Host stand-in for avr-libc's program memory helpers. There is a single
+ * address space on the host, so reads from "flash" are plain loads.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)     (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)    (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr)      (*(void * const *)(addr))
+
+#define memcpy_P    memcpy
+#define strlen_P    strlen
+#define strcmp_P    strcmp
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef Capture_h
+#define Capture_h
+
+/**
+ * Raw frames for the host tests, in ticks (USECPERTICK): marks on even
+ * offsets, spaces on odd ones, without the gap before the frame. The
+ * same capture can be handed to decodeIR(), as IRremote's rawbuf, and
+ * fed to an IRStreamDecoder, as the receive ISR does.
+ */
+
+#include <Arduino.h>
+#include <IRremote.h>
+#include <IRremoteInt.h>
+
+#include "../../IRProtocols.hpp"
+#include "../../IRData.hpp"
+#include "../../IRStreamDecoder.hpp"
+
+#include <vector>
+
+typedef std::vector<uint16_t> Capture;
+
+/**
+ * @return  widths recorded by an IRsend, rounded to ticks. Empty pulses
+ *          (e.g. the final space(0)) are left out, and pulses of the
+ *          same kind in a row are merged.
+ */
+inline Capture captureOf(IRsend &irSender)
+{
+    Capture capture;
+    unsigned long usecs = 0;
+    bool isMark = true;
+
+    for(const IRPulse &pulse : irSender.hostPulses())
+    {
+        // the frame starts on its first mark
+        if(pulse.usec == 0 || (capture.empty() && usecs == 0 && !pulse.isMark)) continue;
+
+        if(pulse.isMark != isMark && usecs > 0)
+        {
+            capture.push_back((usecs + USECPERTICK / 2) / USECPERTICK);
+            usecs = 0;
+        }
+
+        isMark = pulse.isMark;
+        usecs += pulse.usec;
+    }
+
+    if(usecs > 0) capture.push_back((usecs + USECPERTICK / 2) / USECPERTICK);
+
+    return capture;
+}
+
+/**
+ * Fills decode_results as IRremote does after a _GAP
+ *
+ * @param   rawbuf  room for RAWBUF widths
+ */
+inline void toResults(const Capture &capture, unsigned int *rawbuf, decode_results &results)
+{
+    uint16_t length = 0;
+
+    results.rawbuf = rawbuf;
+    results.rawbuf[length++] = GAP_TICKS;
+    for(size_t i = 0; i < capture.size() && length < RAWBUF; i++) results.rawbuf[length++] = capture[i];
+
+    // a trailing space is the gap after the frame
+    if(length % 2 == 1 && length > 1) length--;
+
+    results.rawlen = length;
+    results.overflow = capture.size() + 1 > RAWBUF;
+}
+
+/**
+ * Feeds a capture to a stream decoder, after a gap, and lets the space
+ * after it time out
+ *
+ * @param   used    widths of the frame that came out: a space the frame
+ *                  can't take ends it early, as a gap would, and the
+ *                  rest of the capture is ignored
+ *
+ * @return  true if a frame came out, on irData
+ */
+inline bool streamDecode(IRStreamDecoder &decoder, const Capture &capture, IRData &irData,
+                         size_t *used = NULL)
+{
+    size_t length = capture.size() - (capture.size() % 2 == 0);
+    size_t i;
+
+    decoder.Reset();
+    decoder.Feed(false, 0xFFFF);
+
+    // a trailing space is the gap after the frame, it only times out
+    for(i = 0; i < length && !decoder.Available(); i++) decoder.Feed(i % 2 == 0, capture[i]);
+
+    // a frame ended by a space doesn't take it
+    if(decoder.Available() && i % 2 == 0) i--;
+
+    // silence grows until the gap, as Poll() sees it
+    for(uint16_t ticks = 1; ticks <= IRSTREAM_GAP_TICKS && !decoder.Available(); ticks++)
+    {
+        decoder.Timeout(ticks);
+    }
+
+    if(used != NULL) *used = i;
+
+    irData.isValid = false;
+    return decoder.Read(irData);
+}
+
+inline bool sameCode(IRData &a, IRData &b)
+{
+    return a.isValid == b.isValid
+        && (!a.isValid || (a.protocol == b.protocol && a.nBits == b.nBits
+                           && a.isRepeated == b.isRepeated && !memcmp(a.data, b.data, a.Length())));
+}
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * Loopback of multi-frame codes, end to end: 3-frame codes are
+ * programmed with IRStorage::WriteCode() and WriteFrame(), loaded on
+ * IRCodeCache, queued on IRAsyncSender a frame at a time, as the sketch
+ * does, and what it plays is received by an IRStreamDecoder, as the
+ * pin interrupt and Poll() would feed it.
+ *
+ * Gaps are stored as given, and each frame must come back after its
+ * gap, or after the FrameGapMs() of its protocol if the gap is shorter:
+ * the sender stretches it, so receivers tell both frames apart. The
+ * protocol isn't compared: look-alike protocols give the same bits,
+ * and the stream decoder takes the first one on the table.
+ */
+
+#include "Capture.h"
+#include "Check.h"
+
+#include "../../IRStorage.hpp"
+#include "../../IRCodeCache.hpp"
+#include "../../IRAsyncSender.hpp"
+#include "../RandomCode.h"
+
+#include <random>
+
+/**
+ * Chains programmed and sent
+ */
+#define CHAIN_TRIALS    200
+
+/**
+ * Poll() period, as on loop(), in us
+ */
+#define CHAIN_POLL_USECS    1000
+
+static std::mt19937 s_random(1);
+
+/**
+ * @return  a random frame, of a random protocol
+ */
+static IRData anyFrame()
+{
+    const IRProtocol *protocol = g_irProtocols.At(s_random() % IRPROTOCOLS_COUNT);
+    IRData frame;
+
+    randomCode(frame, protocol, 1 + s_random() % 64, s_random() & 1, s_random);
+    return frame;
+}
+
+/**
+ * Programs a remote with the chain as its first code
+ *
+ * @return  false if it doesn't fit
+ */
+static bool program(std::vector<IRData> &chain)
+{
+    uint16_t dataAddr = g_irStorage.Begin(1, false);
+
+    for(uint8_t i = 0; i < g_irStorage.CodeCount(); i++)
+    {
+        IRData code = i == 0 ? chain[0] : anyFrame();
+
+        if(!g_irStorage.WriteCode(i, code, dataAddr)) return false;
+
+        for(uint8_t frame = 1; i == 0 && frame < chain.size(); frame++)
+        {
+            if(!g_irStorage.WriteFrame(chain[frame], dataAddr)) return false;
+        }
+    }
+
+    g_irStorage.Commit(dataAddr);
+    return true;
+}
+
+/**
+ * Sends a code from the cache, as queueCodes() does
+ *
+ * @return  marks and spaces played
+ */
+static Capture send(uint8_t index)
+{
+    IRsend irSender;
+    IRData irData;
+
+    g_irAsyncSender.Begin(irSender);
+
+    for(uint8_t frame = 0; g_irCodeCache.Get(index, irData, frame); frame++)
+    {
+        g_irAsyncSender.Enqueue(irData, irData.nextGap);
+        if(irData.nextGap == 0) break;
+    }
+
+    while(g_irAsyncSender.IsBusy())
+    {
+        hostAdvanceMicros(CHAIN_POLL_USECS);
+        g_irAsyncSender.Poll();
+    }
+
+    return captureOf(irSender);
+}
+
+/**
+ * Receives marks and spaces: spaces time out as they grow, at each
+ * Poll(), and then end on the next edge
+ *
+ * @param   gaps    FrameGap() of each frame
+ */
+static std::vector<IRData> receive(const Capture &capture, std::vector<uint8_t> &gaps)
+{
+    IRStreamDecoder decoder;
+    std::vector<IRData> frames;
+    IRData irData;
+
+    decoder.Feed(false, 0xFFFF);
+
+    for(size_t i = 0; i <= capture.size(); i++)
+    {
+        bool isMark = i % 2 == 0;
+        uint16_t ticks = i < capture.size() ? capture[i] : 0xFFFF;
+
+        for(uint16_t t = 0; !isMark && t < ticks; t += CHAIN_POLL_USECS / USECPERTICK)
+        {
+            decoder.Timeout(t);
+            if(decoder.Read(irData))
+            {
+                frames.push_back(irData);
+                gaps.push_back(decoder.FrameGap());
+            }
+        }
+
+        if(i < capture.size()) decoder.Feed(isMark, ticks);
+        if(decoder.Read(irData))
+        {
+            frames.push_back(irData);
+            gaps.push_back(decoder.FrameGap());
+        }
+    }
+
+    return frames;
+}
+
+int main()
+{
+    for(unsigned trial = 0; trial < CHAIN_TRIALS; trial++)
+    {
+        std::vector<IRData> chain;
+        std::vector<uint8_t> gaps;
+
+        // gaps from too short for any protocol to longer than needed
+        for(uint8_t frame = 0; frame < 3; frame++)
+        {
+            chain.push_back(anyFrame());
+            chain.back().nextGap = frame < 2 ? 1 + s_random() % 40 : 0;
+        }
+        if(trial == 0) chain[0].nextGap = 1;
+
+        memset(g_hostEeprom, 0xFF, sizeof(g_hostEeprom));
+
+        if(!program(chain))
+        {
+            CHECK(false, "chain %u: doesn't fit", trial);
+            continue;
+        }
+
+        CHECK(g_irCodeCache.Load(IRStorage::PointerTable, g_irStorage.Length(), g_irStorage.CodeCount()) == 0,
+              "chain %u: invalid codes on the cache", trial);
+
+        std::vector<IRData> frames = receive(send(0), gaps);
+
+        CHECK(frames.size() == chain.size(), "chain %u: %u frames received", trial, (unsigned) frames.size());
+
+        for(uint8_t frame = 0; frame < chain.size() && frame < frames.size(); frame++)
+        {
+            IRData &sent = chain[frame], &received = frames[frame];
+
+            CHECK(received.nBits == sent.nBits && received.isRepeated == sent.isRepeated
+                  && !memcmp(received.data, sent.data, sent.Length()),
+                  "chain %u, frame %u: %s, %u bits, another frame back", trial, frame,
+                  sent.protocol->Name().c_str(), sent.nBits);
+
+            if(frame == 0) continue;
+
+            IRData stored;
+            uint8_t gap = chain[frame - 1].nextGap;
+            uint8_t frameGapMs = sent.protocol->FrameGapMs();
+            uint8_t sentGap = gap < frameGapMs ? frameGapMs : gap;
+
+            CHECK(IRStorage::ReadCode(0, stored, frame - 1) && stored.nextGap == gap,
+                  "chain %u, frame %u: gap of %u ms stored as %u ms", trial, frame, gap, stored.nextGap);
+            CHECK(gaps[frame] == sentGap, "chain %u, frame %u: gap of %u ms received as %u ms",
+                  trial, frame, sentGap, gaps[frame]);
+        }
+    }
+
+    return checkResult();
+}
@@ -0,0 +1,43 @@
+#ifndef Check_h
+#define Check_h
+
+/**
+ * Checks of the host tests. A failed CHECK() prints where it was and
+ * the message, and the test goes on; main() returns checkResult(), so
+ * ctest sees the failures.
+ */
+
+#include <stdio.h>
+
+static unsigned long g_checks = 0;
+static unsigned long g_checkFailures = 0;
+
+/**
+ * @param   condition   must hold
+ * @param   ...         printf format and arguments, told on failure
+ */
+#define CHECK(condition, ...) \
+    do \
+    { \
+        g_checks++; \
+        if(!(condition)) \
+        { \
+            g_checkFailures++; \
+            fprintf(stderr, "%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+        } \
+    } while(0)
+
+/**
+ * Prints the totals
+ *
+ * @return  exit code of the test: 0 if all checks passed
+ */
+inline int checkResult()
+{
+    printf("%lu checks, %lu failed\n", g_checks, g_checkFailures);
+    return g_checkFailures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * Checks that the three readings of a frame shape agree, for every
+ * protocol of g_irProtocolTable: IRShape::Cursor (IRWaveform and
+ * IRStreamDecoder) and the kernels unrolled from it at compile time
+ * (sendIR() and decodeIR()).
+ *
+ * For each protocol, frames of several lengths, with and without
+ * repeat, and random data bits, are
+ *   - sent with sendIR() and played with IRWaveform, which must give
+ *     the same marks and spaces;
+ *   - decoded back by decodeIR() and IRStreamDecoder, which must both
+ *     give the frame that was sent;
+ *   - mutated, one width at a time, and cut short, and decoded again:
+ *     both decoders must take or reject them alike, and agree on the
+ *     bits when they take them.
+ *
+ * A space the frame can't take ends it early on the stream decoder, as
+ * a gap would; decodeIR() then gets the widths before it, as IRremote
+ * would have captured them. The protocol isn't compared: look-alike
+ * protocols give the same bits, and decodeIR() takes the closest one,
+ * while the stream decoder takes the first one on the table. Frames
+ * longer than RAWBUF are left to the stream decoder.
+ */
+
+#include "Capture.h"
+#include "Check.h"
+
+#include "../../IRDecoder.hpp"
+#include "../../IRSender.hpp"
+#include "../../IRWaveform.hpp"
+#include "../RandomCode.h"
+
+#include <random>
+
+static unsigned int s_rawbuf[RAWBUF];
+
+static const uint8_t s_frameBits[] = {1, 2, 7, 8, 9, 16, 28, 32, 48, 64, 100, 147, 148, 159, 160};
+
+/**
+ * @return  marks and spaces of a frame, as IRWaveform plays it
+ */
+static Capture playWaveform(IRData &irData)
+{
+    IRsend irSender;
+    IRWaveform waveform;
+    IRWaveform::Cursor cursor;
+    bool isMark;
+    uint16_t usecs;
+
+    if(!waveform.Compile(irData)) return Capture();
+
+    waveform.Rewind(cursor);
+    while(waveform.Next(cursor, isMark, usecs))
+    {
+        if(isMark) irSender.mark(usecs);
+        else irSender.space(usecs);
+    }
+
+    return captureOf(irSender);
+}
+
+static const char *describe(IRData &irData, char *text, size_t size)
+{
+    if(!irData.isValid) snprintf(text, size, "nothing");
+    else snprintf(text, size, "%s, %u bits%s", irData.protocol->Name().c_str(), irData.nBits,
+                  irData.isRepeated ? ", repeated" : "");
+
+    return text;
+}
+
+/**
+ * Decodes a capture both ways, and checks that they agree
+ *
+ * @param   what    told on failure
+ * @param   sent    frame that must come out, NULL if any (or none)
+ */
+static void checkDecoders(const char *what, const Capture &capture, IRData *sent)
+{
+    IRStreamDecoder decoder;
+    decode_results results;
+    IRData batch, stream;
+    size_t used;
+    char batchText[48], streamText[48];
+
+    streamDecode(decoder, capture, stream, &used);
+    if(sent != NULL)
+    {
+        CHECK(stream.isValid && stream.nBits == sent->nBits && stream.isRepeated == sent->isRepeated
+              && !memcmp(stream.data, sent->data, sent->Length()),
+              "%s: IRStreamDecoder gave %s", what, describe(stream, streamText, sizeof(streamText)));
+    }
+
+    Capture frame(capture.begin(), capture.begin() + (stream.isValid ? used : capture.size()));
+
+    // longer than IRremote captures
+    if(frame.size() + 1 > RAWBUF) return;
+
+    toResults(frame, s_rawbuf, results);
+    decodeIR(&results, batch, 0);
+
+    if(sent != NULL) CHECK(batch.isValid && batch.protocol == sent->protocol, "%s: decodeIR() gave %s",
+                           what, describe(batch, batchText, sizeof(batchText)));
+
+    CHECK(batch.isValid == stream.isValid
+          && (!batch.isValid || (batch.nBits == stream.nBits && batch.isRepeated == stream.isRepeated
+                                 && !memcmp(batch.data, stream.data, batch.Length()))),
+          "%s: decodeIR() gave %s, IRStreamDecoder gave %s", what,
+          describe(batch, batchText, sizeof(batchText)), describe(stream, streamText, sizeof(streamText)));
+}
+
+int main()
+{
+    std::mt19937 random(1);
+
+    // the stream decoder has no confidence threshold
+    IRDecoder::minConfidence = 0;
+
+    for(uint8_t p = 0; p < IRPROTOCOLS_COUNT; p++)
+    {
+        const IRProtocol *protocol = g_irProtocols.At(p);
+
+        for(uint8_t nBits : s_frameBits)
+        {
+            for(uint8_t repeat = 0; repeat < 2; repeat++)
+            {
+                IRsend irSender;
+                IRData irData;
+                char what[96];
+
+                irData.protocol = protocol;
+                irData.nBits = nBits;
+                irData.isRepeated = repeat;
+                irData.isValid = true;
+                memset(irData.data, 0, sizeof(irData.data));
+                for(uint8_t i = 0; i < nBits; i++)
+                {
+                    if(random() & 1) irData.data[i / 8] |= 0x80 >> (i % 8);
+                }
+
+                snprintf(what, sizeof(what), "%s, %u bits%s", protocol->Name().c_str(), nBits,
+                         repeat ? ", repeated" : "");
+
+                sendIR(irSender, irData);
+                Capture capture = captureOf(irSender);
+
+                CHECK(capture == playWaveform(irData), "%s: sendIR() and IRWaveform differ", what);
+
+                // decoders only tell repeats on shapes that have them
+                IRData expected = irData;
+                expected.isRepeated = repeat && hasRepeat(protocol);
+                checkDecoders(what, capture, &expected);
+
+                for(size_t offset = 0; offset < capture.size(); offset++)
+                {
+                    uint16_t ticks = capture[offset];
+                    const uint16_t widths[] = {1, (uint16_t) (ticks / 2), (uint16_t) (ticks * 3 / 2),
+                                               (uint16_t) (ticks * 2), 60, 600};
+
+                    for(uint16_t width : widths)
+                    {
+                        Capture mutated = capture;
+                        char mutation[128];
+
+                        mutated[offset] = width > 0 ? width : 1;
+
+                        snprintf(mutation, sizeof(mutation), "%s, width %u of %u ticks", what,
+                                 (unsigned) offset, mutated[offset]);
+                        checkDecoders(mutation, mutated, NULL);
+                    }
+                }
+
+                for(size_t length = 1; length < capture.size(); length++)
+                {
+                    Capture cut(capture.begin(), capture.begin() + length);
+                    char mutation[128];
+
+                    snprintf(mutation, sizeof(mutation), "%s, cut to %u widths", what, (unsigned) length);
+                    checkDecoders(mutation, cut, NULL);
+                }
+            }
+        }
+    }
+
+    return checkResult();
+}
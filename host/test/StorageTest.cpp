@@ -0,0 +1,354 @@
+/**
+ * Round-trips of the EEPROM image (see IRStorage): codes written by
+ * programming are read back the same, and an image that was not
+ * completely written, or that got corrupted, fails Validate().
+ *
+ * Codes of a remote are nearly identical, so they must be stored as
+ * shared records and patches, and come back the same from IRCodeCache,
+ * from its pool or past it, and after ReplaceCode().
+ *
+ * Multi-frame codes are full records, never shared nor patched over,
+ * and their gaps are kept as given.
+ */
+
+#include "Check.h"
+
+#include "../../IRStorage.hpp"
+#include "../../IRCodeCache.hpp"
+#include "../RandomCode.h"
+
+#include <random>
+
+static const uint8_t s_maxRemoteQty = 20;
+
+static std::mt19937 s_random(1);
+
+static void eraseEeprom()
+{
+    memset(g_hostEeprom, 0xFF, sizeof(g_hostEeprom));
+}
+
+static bool sameCode(IRData &a, IRData &b)
+{
+    return a.isValid && b.isValid && a.protocol == b.protocol && a.nBits == b.nBits
+        && a.isRepeated == b.isRepeated && a.nextGap == b.nextGap && !memcmp(a.data, b.data, a.Length());
+}
+
+/**
+ * @return  a random single frame code, of a random protocol
+ */
+static IRData anyCode()
+{
+    const IRProtocol *protocol = g_irProtocols.At(s_random() % IRPROTOCOLS_COUNT);
+    IRData code;
+
+    randomCode(code, protocol, 1 + s_random() % 64, s_random() & 1, s_random);
+    return code;
+}
+
+/**
+ * Adds the codes of a remote: a random code and three more like it,
+ * the last one the same as the first
+ */
+static void addRemote(std::vector<IRData> &codes)
+{
+    IRData code = anyCode();
+
+    for(uint8_t i = 0; i < 3; i++)
+    {
+        codes.push_back(code);
+        code.data[s_random() % code.Length()] ^= 1 << (s_random() % 8);
+    }
+    codes.push_back(codes[codes.size() - 3]);
+}
+
+static uint16_t pointerOf(uint8_t index)
+{
+    uint16_t pointer = 0;
+
+    eeprom_read_block(&pointer, (const void *)(size_t) IRStorage::PointerAddr(index), sizeof(pointer));
+    return pointer;
+}
+
+/**
+ * Programs an image
+ *
+ * @param   codes   4 per remote, as many as the pointer table has
+ *
+ * @return  false if it doesn't fit
+ */
+static bool program(std::vector<IRData> &codes, uint8_t remoteQty, bool hasProjector)
+{
+    uint16_t dataAddr = g_irStorage.Begin(remoteQty, hasProjector);
+
+    for(uint8_t i = 0; i < g_irStorage.CodeCount(); i++)
+    {
+        if(!g_irStorage.WriteCode(i, codes[i], dataAddr)) return false;
+    }
+
+    g_irStorage.Commit(dataAddr);
+    return true;
+}
+
+/**
+ * Codes come back as written, straight from EEPROM
+ */
+static void checkReadBack(const char *what, std::vector<IRData> &codes, uint8_t count)
+{
+    for(uint8_t i = 0; i < count; i++)
+    {
+        IRData code;
+
+        CHECK(IRStorage::ReadCode(i, code) && sameCode(code, codes[i]), "%s: code %u", what, i);
+    }
+}
+
+/**
+ * Header, checksum and the codes, on images of several sizes
+ */
+static void checkImage()
+{
+    for(uint8_t remoteQty = 1; remoteQty <= 4; remoteQty++)
+    {
+        std::vector<IRData> codes;
+        char what[32];
+
+        snprintf(what, sizeof(what), "%u remotes", remoteQty);
+
+        for(uint8_t i = 0; i < remoteQty * 4 + 3; i++) codes.push_back(anyCode());
+
+        eraseEeprom();
+        CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::NoImage, "%s: blank EEPROM", what);
+
+        CHECK(program(codes, remoteQty, true), "%s: doesn't fit", what);
+        CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::None, "%s: not valid", what);
+        CHECK(g_irStorage.RemoteQty() == remoteQty && g_irStorage.HasProjector()
+              && g_irStorage.CodeCount() == remoteQty * 4 + 3, "%s: header", what);
+
+        checkReadBack(what, codes, g_irStorage.CodeCount());
+
+        CHECK(g_irStorage.Validate(remoteQty - 1) == IRStorage::BadHeader, "%s: too many remotes", what);
+
+        // any byte of the body changed
+        uint16_t length = g_irStorage.Length();
+
+        for(uint16_t offset = 0; offset < length; offset++)
+        {
+            uint8_t *cell = &g_hostEeprom[IRStorage::PointerTable + offset];
+
+            *cell ^= 1 << (offset % 8);
+            CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::BadChecksum,
+                  "%s: body byte %u changed", what, offset);
+            *cell ^= 1 << (offset % 8);
+        }
+
+        CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::None, "%s: not valid again", what);
+
+        g_hostEeprom[2]++;
+        CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::VersionMismatch, "%s: version", what);
+        g_hostEeprom[2]--;
+
+        // programming again invalidates the image until it's committed
+        g_irStorage.Begin(remoteQty, true);
+        CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::NoImage, "%s: not committed", what);
+    }
+}
+
+/**
+ * Codes come back as written from IRCodeCache
+ */
+static void checkCache(const char *what, std::vector<IRData> &codes, uint8_t count)
+{
+    CHECK(g_irCodeCache.Load(IRStorage::PointerTable, g_irStorage.Length(), count) == 0,
+          "%s: invalid codes on the cache", what);
+
+    for(uint8_t i = 0; i < count; i++)
+    {
+        IRData code;
+
+        CHECK(g_irCodeCache.Get(i, code) && sameCode(code, codes[i]), "%s: code %u on the cache", what, i);
+        CHECK(!g_irCodeCache.Get(i, code, 1), "%s: code %u has a second frame", what, i);
+    }
+}
+
+/**
+ * Shared records and patches, on images past the cache pool
+ */
+static void checkCompression()
+{
+    std::vector<IRData> codes;
+    uint8_t remoteQty = 0;
+    uint16_t records = 0;       // bytes of a full record per code
+
+    eraseEeprom();
+
+    // as many remotes as fit, past the pool
+    while(remoteQty < s_maxRemoteQty)
+    {
+        std::vector<IRData> more = codes;
+
+        addRemote(more);
+        more.resize(more.size() + 3, anyCode());
+        if(!program(more, remoteQty + 1, true)) break;
+
+        codes.swap(more);
+        codes.resize(codes.size() - 3);
+        remoteQty++;
+    }
+
+    codes.resize(codes.size() + 3, anyCode());
+    CHECK(program(codes, remoteQty, true), "doesn't fit anymore");
+    CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::None, "not valid");
+    CHECK(g_irStorage.Length() > IRCACHE_POOL_SIZE, "%u bytes, within the pool", g_irStorage.Length());
+
+    for(IRData &code : codes) records += code.SizeOnEEPROM();
+    CHECK(g_irStorage.Length() < records, "%u bytes, as full records %u", g_irStorage.Length(), records);
+
+    checkReadBack("compressed", codes, g_irStorage.CodeCount());
+    checkCache("compressed", codes, g_irStorage.CodeCount());
+
+    for(uint8_t remote = 0; remote < remoteQty; remote++)
+    {
+        uint8_t first = remote * 4;
+
+        CHECK(pointerOf(first + 3) == pointerOf(first), "remote %u: same codes not shared", remote);
+
+        // a patch of a byte takes 5 bytes
+        CHECK((pointerOf(first + 1) & IRStorage::PatchFlag) || codes[first + 1].SizeOnEEPROM() <= 5,
+              "remote %u: code like another not patched", remote);
+    }
+
+    // replaced by a code like another, and by one like none
+    for(uint8_t i = 0; i < 2; i++)
+    {
+        uint8_t index = s_random() % g_irStorage.CodeCount();
+        IRData code = i == 0 ? codes[(index + 4) % g_irStorage.CodeCount()] : anyCode();
+        char what[32];
+
+        if(i == 0) code.data[0] ^= 0x80;
+        snprintf(what, sizeof(what), "code %u replaced", index);
+
+        CHECK(g_irStorage.ReplaceCode(index, code), "%s: doesn't fit", what);
+        codes[index] = code;
+
+        CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::None, "%s: not valid", what);
+        checkReadBack(what, codes, g_irStorage.CodeCount());
+        checkCache(what, codes, g_irStorage.CodeCount());
+    }
+
+    // a record that can't be read: its protocol is unknown
+    uint8_t index = 0;
+    while(pointerOf(index) & IRStorage::PatchFlag) index++;
+
+    g_hostEeprom[pointerOf(index) + 1] = 0;
+
+    CHECK(g_irCodeCache.Load(IRStorage::PointerTable, g_irStorage.Length(), g_irStorage.CodeCount()) > 0,
+          "unknown protocol is valid");
+
+    IRData code;
+    CHECK(!g_irCodeCache.Get(index, code), "unknown protocol on the cache");
+}
+
+/**
+ * @return  address of the record a patch is made over
+ */
+static uint16_t baseOf(uint16_t pointer)
+{
+    uint16_t base = 0;
+
+    eeprom_read_block(&base, (const void *)(size_t)(pointer & ~IRStorage::PatchFlag), sizeof(base));
+    return base;
+}
+
+/**
+ * Frames of multi-frame codes come back as written, from EEPROM and
+ * from IRCodeCache, and next to single frame codes just like them
+ */
+static void checkChains()
+{
+    std::vector<IRData> chain;
+
+    // gaps are kept as given, even too short for any protocol
+    for(uint8_t frame = 0; frame < 3; frame++) chain.push_back(anyCode());
+    chain[0].nextGap = 1;
+    chain[1].nextGap = 200;
+
+    IRData single = chain[0];
+    IRData likeSingle = chain[0];
+
+    single.nextGap = 0;
+    likeSingle.nextGap = 0;
+    likeSingle.data[0] ^= 0x80;
+
+    eraseEeprom();
+
+    // the same chain twice, with codes like its first frame
+    uint16_t dataAddr = g_irStorage.Begin(1, false);
+    bool fits = true;
+
+    for(uint8_t i = 0; i < g_irStorage.CodeCount(); i++)
+    {
+        if(i == 1) fits = fits && g_irStorage.WriteCode(i, single, dataAddr);
+        else if(i == 3) fits = fits && g_irStorage.WriteCode(i, likeSingle, dataAddr);
+        else
+        {
+            fits = fits && g_irStorage.WriteCode(i, chain[0], dataAddr);
+            for(uint8_t frame = 1; frame < chain.size(); frame++)
+            {
+                fits = fits && g_irStorage.WriteFrame(chain[frame], dataAddr);
+            }
+        }
+    }
+
+    g_irStorage.Commit(dataAddr);
+
+    CHECK(fits, "chains: don't fit");
+    CHECK(g_irStorage.Validate(s_maxRemoteQty) == IRStorage::None, "chains: not valid");
+
+    CHECK(g_irCodeCache.Load(IRStorage::PointerTable, g_irStorage.Length(), g_irStorage.CodeCount()) == 0,
+          "chains: invalid codes on the cache");
+
+    for(uint8_t i = 0; i < g_irStorage.CodeCount(); i += 2)
+    {
+        for(uint8_t frame = 0; frame < chain.size(); frame++)
+        {
+            IRData code;
+
+            CHECK(IRStorage::ReadCode(i, code, frame) && sameCode(code, chain[frame]),
+                  "chains: code %u, frame %u", i, frame);
+            CHECK(g_irCodeCache.Get(i, code, frame) && sameCode(code, chain[frame]),
+                  "chains: code %u, frame %u on the cache", i, frame);
+        }
+
+        IRData code;
+        CHECK(!IRStorage::ReadCode(i, code, chain.size()) && !g_irCodeCache.Get(i, code, chain.size()),
+              "chains: code %u has another frame", i);
+    }
+
+    std::vector<IRData> singles(4);
+    singles[1] = single;
+    singles[3] = likeSingle;
+
+    for(uint8_t i = 1; i < g_irStorage.CodeCount(); i += 2)
+    {
+        IRData code;
+
+        CHECK(IRStorage::ReadCode(i, code) && sameCode(code, singles[i]), "chains: code %u", i);
+        CHECK(g_irCodeCache.Get(i, code) && sameCode(code, singles[i]), "chains: code %u on the cache", i);
+    }
+
+    CHECK(pointerOf(2) != pointerOf(0), "chains: same chains shared");
+    CHECK(pointerOf(1) != pointerOf(0) && pointerOf(1) != pointerOf(2), "chains: first frame shared");
+    CHECK(!(pointerOf(3) & IRStorage::PatchFlag)
+          || (baseOf(pointerOf(3)) != pointerOf(0) && baseOf(pointerOf(3)) != pointerOf(2)),
+          "chains: first frame patched over");
+}
+
+int main()
+{
+    checkImage();
+    checkCompression();
+    checkChains();
+
+    return checkResult();
+}
@@ -0,0 +1,81 @@
+/**
+ * Checks that IRStreamDecoder and decodeIR() agree on captures with a
+ * bit space that is off the protocol timings: the first one can't end
+ * the frame, so both must reject it.
+ */
+
+#include "Capture.h"
+#include "Check.h"
+
+#include "../../IRDecoder.hpp"
+#include "../../IRSender.hpp"
+
+static unsigned int s_rawbuf[RAWBUF];
+
+/**
+ * @return  capture of a Junco frame, 28 bits
+ */
+static Capture juncoFrame()
+{
+    IRsend irSender;
+    IRData irData;
+    const uint8_t data[] = {0x88, 0x00, 0x95, 0xE0};
+
+    irData.protocol = g_irProtocols.GetProtocol(IRProtocol::Junco);
+    irData.nBits = 28;
+    irData.isRepeated = false;
+    irData.isValid = true;
+    memcpy(irData.data, data, sizeof(data));
+
+    sendIR(irSender, irData);
+    return captureOf(irSender);
+}
+
+/**
+ * Decodes a capture both ways. A space the frame can't take ends it
+ * early on the stream decoder, as a gap would, so decodeIR() gets the
+ * widths before it, as IRremote would have captured them.
+ *
+ * @param   what    told on failure
+ * @param   valid   if the capture must be decoded
+ */
+static void checkBoth(const char *what, const Capture &capture, bool valid)
+{
+    IRStreamDecoder decoder;
+    decode_results results;
+    IRData batch, stream;
+    size_t used;
+
+    streamDecode(decoder, capture, stream, &used);
+    toResults(Capture(capture.begin(), capture.begin() + (stream.isValid ? used : capture.size())),
+              s_rawbuf, results);
+    decodeIR(&results, batch, 0);
+
+    CHECK(batch.isValid == valid, "%s: decodeIR() %s it", what, batch.isValid ? "took" : "rejected");
+    CHECK(stream.isValid == valid, "%s: IRStreamDecoder %s it (%u bits)", what,
+          stream.isValid ? "took" : "rejected", stream.isValid ? stream.nBits : 0);
+    CHECK(sameCode(batch, stream), "%s: decoders disagree", what);
+}
+
+int main()
+{
+    Capture frame = juncoFrame();
+
+    checkBoth("Junco frame", frame, true);
+
+    // header mark, header space, bit mark, then bit spaces on odd offsets
+    for(size_t offset = 3; offset < frame.size(); offset += 2)
+    {
+        Capture capture = frame;
+        char what[64];
+
+        // neither a zero nor a one space: the frame can only end there
+        // (on the bits before it) if there are any
+        capture[offset] = 60;
+
+        snprintf(what, sizeof(what), "Junco, space %u of 60 ticks", (unsigned) offset);
+        checkBoth(what, capture, offset > 3);
+    }
+
+    return checkResult();
+}
@@ -0,0 +1,23 @@
+#ifndef crc16_h
+#define crc16_h
+
+/**
+ * Host stand-in for avr-libc's CRC helpers (same algorithms).
+ */
+
+#include <stdint.h>
+
+/**
+ * CRC-CCITT, polynomial x^16 + x^12 + x^5 + 1 (0x8408 reflected),
+ * usually initialized with 0xFFFF
+ */
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= crc & 0xFF;
+    data ^= data << 4;
+
+    return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4)
+            ^ ((uint16_t) data << 3));
+}
+
+#endif
@@ -15,10 +15,28 @@
 #include "IRData.hpp"
 #include "IRDecoder.hpp"
 #include "IRSender.hpp"
+#include "IRAsyncSender.hpp"
+#include "IRCodeCache.hpp"
+#include "IRStorage.hpp"
+#include "IRUpload.hpp"
+#include "IRShell.hpp"
+#include "Buttons.hpp"
+#include "Scheduler.hpp"
 #include "IRRawAnalyzer.hpp"
+#include "IRTrace.hpp"
+#include "IRStreamDecoder.hpp"
+#include "IRCaptureRing.hpp"
+#include "IRLearner.hpp"
 
 #define DUMPER_ENABLED 1
 
+/**
+ * Set to 1 for the dumper to print raw timings and analyze() output of
+ * each capture, besides its trace and code. IRremote waits while they're
+ * printed, so frames sent meanwhile are lost.
+ */
+#define DUMPER_VERBOSE 0
+
 /**
  * Arduino pins definition
  */
@@ -35,6 +53,24 @@ const struct
     char irSensor;
 } g_pins = {10, 11, 12, 9, 4, 5, 6, 7, 2};
 
+/**
+ * Button ids on g_buttons, in the order of g_buttonPins
+ */
+enum ButtonId
+{
+    ButtonLevel = 0,
+    ButtonOff,
+    ButtonProjPower,
+    ButtonProjMute
+};
+
+const uint8_t g_buttonPins[] = {
+    (uint8_t) g_pins.buttonLevel,
+    (uint8_t) g_pins.buttonOff,
+    (uint8_t) g_pins.buttonProjPower,
+    (uint8_t) g_pins.buttonProjMute
+};
+
 /**
  * IRremote library objects (receiver and sender)
  */
@@ -45,17 +81,90 @@ IRsend g_irSender; // IR LED must be connected to pin 3
  * Operation parameters
  */
 uint8_t g_ACLevel = 0;   // 0: off, 1-3: cooling level
-bool g_sendCode = false; // if the button was
+bool g_sendCode = false; // if an AC button was pressed
 uint8_t g_remoteQty = 1;
 uint8_t g_hasProjector = 0;
 uint8_t g_projectorStatus = 0; // 0: normal, 1: freeze, 2: mute
 
-#define MAX_REMOTE_QTY 10
+#define MAX_REMOTE_QTY 20
+
+#define NO_CODE 0xFF
+
+/**
+ * Codes being queued for transmission, as room is made on the send
+ * queue (see queueCodes): a code of all AC remotes, one remote at a
+ * time in g_queueOrder, and a single code (the projector's, or one
+ * sent from the shell), which goes ahead of them
+ */
+uint8_t g_queueCode = 0;
+uint8_t g_queueRemote = 0;
+uint8_t g_queueRemotes = 0;
+uint8_t g_queueOrder[MAX_REMOTE_QTY];
+uint8_t g_queueSingle = NO_CODE;
+
+/**
+ * Code whose frames are being queued, on the pointer table, and its
+ * next frame (0 when no code is half queued)
+ */
+uint8_t g_queueIndex = 0;
+uint8_t g_queueFrame = 0;
+
+/**
+ * AC code broadcast in progress, reported once sent (see pollSender)
+ */
+bool g_broadcasting = false;
+uint8_t g_broadcastFrames = 0;
+unsigned long g_broadcastStart = 0;
+
+/**
+ * Dumper LED patterns (see startPattern) and their tasks
+ */
+const uint16_t g_patternDecoded[] = {50, 50, 50, 0};
+const uint16_t g_patternUnknown[] = {500, 0};
+const uint16_t *g_pattern = g_patternDecoded;
+uint8_t g_patternStep = 0;
+uint8_t g_patternTask = Scheduler::NoTask;
+uint8_t g_blinkTask = Scheduler::NoTask;
+uint8_t g_blinkStatus = 0;
+
+/**
+ * Binary upload being received by pollUpload, while program() waits
+ */
+IRUploader *g_irUploader = NULL;
+
+/**
+ * Dumper captures waiting to be printed
+ */
+struct DumperCaptures
+{
+    decode_results raw;
+    bool held;              // raw is still on IRremote's buffer, not resumed
+    IRCaptureRing ring;
+    uint16_t captured;
+    int16_t lost;           // frames seen on the pin but not captured, so far
+};
 
 void program();
+bool learnOrReadLine(IRLearner &learner, IRData &data);
 void dumper();
+void captureFrame(DumperCaptures &captures);
+void waitSerial(DumperCaptures &captures, int bytes);
+void printQueued(DumperCaptures &captures);
+void printHeld(DumperCaptures &captures);
+void printCode(IRData &data);
+void reportLost(DumperCaptures &captures);
+void showCapture(bool decoded);
 void sendCode(char code);
 void sendProjector(char code);
+bool sendSingle(uint8_t index);
+void queueCodes();
+uint16_t pollButtons();
+uint16_t pollSerial();
+uint16_t pollSender();
+uint16_t pollUpload();
+uint16_t blinkLed();
+uint16_t playPattern();
+void startPattern(const uint16_t *pattern);
 
 void setup()
 {
@@ -85,8 +194,16 @@ void setup()
 #endif
 
     // Erase programming if both buttons are held on startup
-    // Or if the remote is not programmed
-    if ((digitalRead(g_pins.buttonOff) == LOW && digitalRead(g_pins.buttonLevel) == LOW) || EEPROM.read(0) != 'p')
+    // Or if the remote is not programmed (or the EEPROM image is corrupt)
+    IRStorage::Error storageError = g_irStorage.Validate(MAX_REMOTE_QTY);
+
+    if (storageError != IRStorage::None)
+    {
+        Serial.print(F("eeprom: "));
+        Serial.println(IRStorage::errorToString(storageError));
+    }
+
+    if ((digitalRead(g_pins.buttonOff) == LOW && digitalRead(g_pins.buttonLevel) == LOW) || storageError != IRStorage::None)
     {
         digitalWrite(g_pins.ledBlink, HIGH);
         delay(100);
@@ -98,66 +215,147 @@ void setup()
         delay(100);
 
         program();
+
+        storageError = g_irStorage.Validate(MAX_REMOTE_QTY);
     }
 
     digitalWrite(g_pins.ledBlink, HIGH);
 
-    // Second byte of EEPROM tells how many remotes are programmed
-    g_remoteQty = EEPROM.read(1);
+    // The EEPROM image header tells how many remotes are programmed
+    g_remoteQty = g_irStorage.RemoteQty();
+    g_hasProjector = g_irStorage.HasProjector();
 
-    Serial.print("remoteQty ");
+    Serial.print(F("remoteQty "));
     Serial.println(g_remoteQty);
 
-    if (g_remoteQty == 0 || g_remoteQty > MAX_REMOTE_QTY)
+    if (storageError != IRStorage::None)
     {
-        Serial.println("error");
+        Serial.println(F("error"));
+        g_remoteQty = 0;
     }
-    Serial.println("ready");
+
+    // All codes are loaded now, so sending a code doesn't need the EEPROM
+    uint8_t invalidCodes = 0;
+    if (storageError == IRStorage::None)
+    {
+        invalidCodes = g_irCodeCache.Load(IRStorage::PointerTable, g_irStorage.Length(),
+                                           g_irStorage.CodeCount());
+    }
+
+    Serial.print(F("codes "));
+    Serial.print(g_irCodeCache.Count());
+    Serial.print(F(", invalid "));
+    Serial.print(invalidCodes);
+    Serial.print(F(", cached bytes "));
+    Serial.println(g_irCodeCache.PoolUsed());
+
+    g_irAsyncSender.Begin(g_irSender);
+    g_irShell.SetSender(sendSingle);
+    g_buttons.Begin(g_buttonPins, sizeof(g_buttonPins));
+
+    g_scheduler.Add(pollButtons, 1);
+    g_scheduler.Add(pollSerial, 1);
+    g_scheduler.Add(pollSender, 1);
+
+    Serial.println(F("ready"));
 }
 
 void loop()
 {
-    if (digitalRead(g_pins.buttonLevel) == LOW)
-    {
-        delay(100);
-        while (digitalRead(g_pins.buttonLevel) == LOW) delay(1);
+    // Everything runs from timer tasks; the CPU sleeps in between
+    g_scheduler.Run();
+    g_scheduler.Idle();
+}
 
-        if (++g_ACLevel == 4) g_ACLevel = 1;
-        g_sendCode = 1;
-    }
+/**
+ * Moves codes to the send queue and reports the sender status on the
+ * blink LED. IR frames are sent in background, meanwhile buttons keep
+ * working.
+ */
+uint16_t pollSender()
+{
+    queueCodes();
+    g_irAsyncSender.Poll();
+    digitalWrite(g_pins.ledBlink, g_irAsyncSender.IsBusy() ? LOW : HIGH);
 
-    if (digitalRead(g_pins.buttonOff) == LOW)
+    if (g_broadcasting && g_queueRemote == g_queueRemotes && g_queueFrame == 0
+        && !g_irAsyncSender.IsBusy())
     {
-        delay(100);
-        while (digitalRead(g_pins.buttonOff) == LOW) delay(1);
+        Serial.print(F("sent "));
+        Serial.print(g_broadcastFrames);
+        Serial.print(F(" frames in "));
+        Serial.print(millis() - g_broadcastStart);
+        Serial.println(F(" ms"));
 
-        g_ACLevel = 0;
-        g_sendCode = 1;
+        g_broadcasting = false;
     }
 
-    if (digitalRead(g_pins.buttonProjPower) == LOW)
-    {
-        delay(100);
-        while (digitalRead(g_pins.buttonProjPower) == LOW) delay(1);
+    return 5;
+}
 
-        Serial.println(F("sending proj power"));
-        sendProjector(0);
-        delay(400);
-    }
+/**
+ * Runs commands of the serial shell. The period keeps the 64-byte
+ * receive buffer from filling up at 115200 baud.
+ */
+uint16_t pollSerial()
+{
+    g_irShell.Poll(Serial);
 
-    if (digitalRead(g_pins.buttonProjMute) == LOW)
-    {
-        delay(100);
-        while (digitalRead(g_pins.buttonProjMute) == LOW) delay(1);
+    return 2;
+}
 
-        Serial.println(F("sending proj mute/freeze"));
-        sendProjector(1);
-        delay(400);
+/**
+ * Takes the bytes of a binary upload, until it's over. The period keeps
+ * the receive buffer from filling up, as pollSerial's does.
+ */
+uint16_t pollUpload()
+{
+    if (g_irUploader == NULL || !g_irUploader->Poll(Serial)) return Scheduler::Stop;
+
+    return 1;
+}
+
+/**
+ * Handles button presses.
+ *
+ * Presses are queued in background, and take effect as soon as they
+ * settle. AC presses queued meanwhile are coalesced, so the codes of
+ * the last level are the ones sent.
+ */
+uint16_t pollButtons()
+{
+    uint8_t button;
+    g_buttons.Poll();
+
+    while (g_buttons.Read(button))
+    {
+        switch (button)
+        {
+            case ButtonLevel:
+                if (++g_ACLevel == 4) g_ACLevel = 1;
+                g_sendCode = 1;
+                break;
+
+            case ButtonOff:
+                g_ACLevel = 0;
+                g_sendCode = 1;
+                break;
+
+            case ButtonProjPower:
+                Serial.println(F("sending proj power"));
+                sendProjector(0);
+                break;
+
+            case ButtonProjMute:
+                Serial.println(F("sending proj mute/freeze"));
+                sendProjector(1);
+                break;
+        }
     }
 
     if (g_sendCode)
     {
-        Serial.print("sending ");
+        Serial.print(F("sending "));
         Serial.println(g_ACLevel, DEC);
 
         digitalWrite(g_pins.led1, LOW);
@@ -174,26 +372,25 @@ void loop()
 
         sendCode(g_ACLevel);
 
-        delay(400);
         g_sendCode = 0;
     }
+
+    return 1;
 }
 
 /**
- * Read line from Serial, terminated by '\n'
- * @param  ret  String to write to
- * @return      false if there is nothing on Serial
+ * Waits for a line on Serial and echoes it back
+ *
+ * @return  line read, valid until the next one
  */
-bool readLine(String &ret)
+char *readLine()
 {
-    if (!Serial.available()) return false;
+    while (!g_irShell.ReadLine(Serial)) g_scheduler.Idle();
 
-    ret = Serial.readStringUntil('\n');
-    ret.replace("\r", "");
-    ret.trim();
-    Serial.println(ret);
+    char *line = g_irShell.Line();
+    Serial.println(line);
 
-    return true;
+    return line;
 }
 
 /**
@@ -207,159 +404,78 @@ bool readLine(String &ret)
 uint8_t readInt(bool acceptZero)
 {
     uint8_t val = 0;
-    String inputStr;
 
     while (1)
     {
-        while (!readLine(inputStr)) delay(1);
-        val = inputStr.toInt();
+        char *args = readLine();
+        if (IRShell::NextNumber(args, val) != IRShell::None) val = 0;
         if (acceptZero || val > 0) break;
-        else Serial.println("invalid input");
+        else Serial.println(F("invalid input"));
     }
 
     return val;
 }
 
-/**
- * Converts an hex string to byte array.
- * 
- * @param  str          length must be double of capacity
- * @param  dest         data destination, byte array
- * @param  capacity     size of data (less than or equals to dest size)
- * @return              true if successful
- */
-bool hexStringToArray(String str, uint8_t *dest, uint8_t capacity)
-{
-    uint8_t val = 0, i = 0;
-    char ch = 0;
-
-    if ((str.length() % 2 != 0) || (str.length() / 2 != capacity))
-    {
-        Serial.println("capacity mismatch");
-        return false;
-    }
-
-    for (i = 0; i < capacity; i++)
-    {
-        val = 0;
-        ch = str.charAt(i * 2);
-        if (ch >= '0' && ch <= '9') val += ch - '0';
-        else if (ch >= 'a' && ch <= 'f') val += ch - 'a' + 10;
-        else if (ch >= 'A' && ch <= 'F') val += ch - 'A' + 10;
-        else
-        {
-            Serial.println("invalid char");
-            return false;
-        }
-
-        val *= 16;
-
-        ch = str.charAt(i * 2 + 1);
-        if (ch >= '0' && ch <= '9') val += ch - '0';
-        else if (ch >= 'a' && ch <= 'f') val += ch - 'a' + 10;
-        else if (ch >= 'A' && ch <= 'F') val += ch - 'A' + 10;
-        else
-        {
-            Serial.println("invalid char");
-            return false;
-        }
-
-        dest[i] = val;
-    }
-
-    return true;
-}
-
-/**
- * Retrieves and removes the next word (arg) from a string (args),
- * separated by spaces. For example:
- * args = "set hour 12 24";
- * next = nextArg(args);    // next = "set", args = "hour 12 24"
- * 
- * @param  args     string separated by spaces
- * @return String   word retrieved, empty if none found
- */
-String nextArg(String &args)
-{
-    String next("");
-    char length = args.length();
-    char init = -1, i;
-
-    if (length == 0) return next;
-
-    // find first occurrence of non-space character
-    for (i = 0; i < length && args[i] == ' '; ++i) ;
-
-    if (i == length) // if it's all spaces, there are no args
-    {
-        next = "";
-        args = "";
-        return next;
-    }
-
-    init = i;
-
-    // find first space after first argument
-    for (++i; i < length && args[i] != ' '; ++i) ;
-
-    next = args.substring(init, i);
-
-    if (i != length) // if there are characters left...
-    {
-        // find start of next argument
-        for (; i < length && args[i] == ' '; ++i) ;
-    }
-
-    // if it's all spaces, or if we've reached the end,
-    // there are no arguments left
-    args = (i == length) ? "" : args.substring(i);
-
-    return next;
-}
-
 /**
  * Program remote controls on EEPROM memory.
  *
- * EEPROM[0]: program status; if 'p', there are remotes programmed
- * EEPROM[1]: number of AC remote controls programmed (g_remoteQty)
- * EEPROM[2]: if not null, a projector remote is programmed (g_hasProjector)
+ * The number of AC remote controls (g_remoteQty) and if a projector
+ * remote is programmed (g_hasProjector) go on the image header.
+ *
+ * @see     IRStorage for the EEPROM image format
  *
  * For each AC remote, 4 codes are read:
  *     - 0 is to turn off
  *     - 1-3 are the cooling levels (3 being the coolest temp)
  *
+ * Codes may also come all at once, in binary frames (see IRUploader),
+ * instead of the text lines described below. The first byte received
+ * tells which mode is used.
+ *
  * Each code is made of 4 parameters, separated by space:
  *     - number of bits (int)
  *     - hex string of length equals to double the byte length (rounded up number of bits)
  *     - protocol id (int)
  *     - repeat: 1 if data is sent twice
  *
- * Each code is packed on an IRData object and written to EEPROM.
+ * Codes of more than one frame (up to IRDATA_MAX_FRAMES) take a line
+ * per frame, and every frame but the last has a 5th parameter: the gap
+ * before the next frame, in ms.
  *
- * Storage on EEPROM is made of two parts: the IRData address on EEPROM (dataAddr),
- * and the IRData itself. pointerAddr points to the EEPROM addr where dataAddr
- * value is stored. dataAddr's of each code are stored after the g_remoteQty,
- * in sequence for each remote, following the rule:
+ * Instead of typing a code, its button may be pressed on the remote,
+ * pointed at the IR sensor, IRLEARN_CAPTURES times: the code is learned
+ * from the captures by vote (see IRLearner). Learned codes are single
+ * frame.
+ *
+ * Each code is packed on an IRData object (one per frame) and written
+ * to EEPROM.
+ *
+ * Storage on EEPROM is made of two parts: the code address on EEPROM (dataAddr),
+ * and the code itself: a full IRData record, or a patch over a similar
+ * code written before (see IRStorage::WriteCode). pointerAddr points to the
+ * EEPROM addr where dataAddr value is stored. dataAddr's of each code are
+ * stored after the image header, in sequence for each remote, following the rule:
  * 
- *     pointerAddr = 3 + code * 2 + remote * 8;
- *                   |          |            |
- *                   |          |            +-- 4 codes per remote * 2 bytes address
- *                   |          +-- 2 bytes address
- *                   +-- starting offset of dataAddr's
+ *     pointerAddr = 10 + code * 2 + remote * 8;
+ *                   |           |            |
+ *                   |           |            +-- 4 codes per remote * 2 bytes address
+ *                   |           +-- 2 bytes address
+ *                   +-- starting offset of dataAddr's (IRStorage::PointerTable)
  *
  * Example: if g_remoteQty = 1, and g_hasProjector = 1:
- * EEPROM[3-4]:   address of remote 0, code 0 (AC off)
- * EEPROM[5-6]:   address of remote 0, code 1 (AC level 1)
- * EEPROM[7-8]:   address of remote 0, code 2 (AC level 2)
- * EEPROM[9-10]:  address of remote 0, code 3 (AC level 3)
- * EEPROM[11-12]: address of remote 1, code 0 (projector power)
- * EEPROM[13-14]: address of remote 1, code 1 (projector freeze)
- * EEPROM[15-16]: address of remote 1, code 2 (projector mute)
- * EEPROM[17-...]: data of remote 0, code 0 (variable length)
+ * EEPROM[10-11]: address of remote 0, code 0 (AC off)
+ * EEPROM[12-13]: address of remote 0, code 1 (AC level 1)
+ * EEPROM[14-15]: address of remote 0, code 2 (AC level 2)
+ * EEPROM[16-17]: address of remote 0, code 3 (AC level 3)
+ * EEPROM[18-19]: address of remote 1, code 0 (projector power)
+ * EEPROM[20-21]: address of remote 1, code 1 (projector freeze)
+ * EEPROM[22-23]: address of remote 1, code 2 (projector mute)
+ * EEPROM[24-...]: data of remote 0, code 0 (variable length)
  * ...
  * 
- * Each IRData packet is written and then read back to ensure it was written
- * correctly on EEPROM.
+ * Each code is written and then read back to ensure it was written
+ * correctly on EEPROM. The image only becomes valid when all codes are
+ * written, and its checksum is computed over what was read back.
  * 
  */
 void program()
@@ -367,35 +483,55 @@ void program()
     IRData data;
     signed char remote, code;
     bool error = false, success = false;
-    uint8_t answer;
-    uint16_t dataAddr = 0, pointerAddr = 3;
-    String next, args;
+    uint16_t dataAddr = 0;
+    uint8_t index = 0;      // on the pointer table
+    uint8_t frame = 0;      // of a multi-frame code
 
     Serial.print(F("remote qty: "));
+
+    // a binary upload may come instead of the answer
+    while (!Serial.available()) g_scheduler.Idle();
+
+    if (Serial.peek() == IRUPLOAD_SOF)
+    {
+        IRUploader uploader(MAX_REMOTE_QTY);
+        uint8_t uploadTask = g_scheduler.Add(pollUpload, 1);
+
+        g_irUploader = &uploader;
+        while (g_scheduler.IsRunning(uploadTask))
+        {
+            g_scheduler.Run();
+            g_scheduler.Idle();
+        }
+        g_irUploader = NULL;
+
+        if (uploader.IsSealed()) return;
+
+        Serial.print(F("\nremote qty: "));
+    }
+
     do
     {
         g_remoteQty = readInt(false);
-        error = g_remoteQty > 10;
-        if (error) Serial.println("error");
+        error = g_remoteQty > MAX_REMOTE_QTY;
+        if (error) Serial.println(F("error"));
 
     } while (error);
 
     Serial.print(F("projector? "));
     g_hasProjector = readInt(true);
-    Serial.println(g_hasProjector ? " yes" : " no");
+    Serial.println(g_hasProjector ? F(" yes") : F(" no"));
+
+    Serial.print(F("type each code, or press its button "));
+    Serial.print(IRLEARN_CAPTURES);
+    Serial.println(F(" times"));
 
-    // remotes programmed previously are now invalid
-    EEPROM.write(0, 0);
-    EEPROM.write(1, g_remoteQty);
-    EEPROM.write(2, g_hasProjector);
+    IRLearner learner;
+    IRStreamReceiver::Begin(g_pins.irSensor);
 
-    // After the number of remotes, stored on EEPROM[1], and after
-    // the projector flag on EEPROM[2] (hence the +3 at the end) follows
-    // the 16-bit address to each code of each remote.
-    // So, EEPROM[2-3] stores the addr of remote 1, code 0,
-    // EEPROM[4-5] stores remote 1, code 1, and so on.
-    // The +6 is for the projector remote addresses (power, freeze, mute)
-    dataAddr += 8 * g_remoteQty + 3 + 6;
+    // remotes programmed previously are now invalid. Records go
+    // right after the pointer table.
+    dataAddr = g_irStorage.Begin(g_remoteQty, g_hasProjector);
 
     // number of AC remotes + projector
     char maxRemote = g_remoteQty;
@@ -414,245 +550,536 @@ void program()
             Serial.print(remote);
             Serial.print(F(", code "));
             Serial.print(code);
+            if (frame > 0)
+            {
+                Serial.print(F(", frame "));
+                Serial.print(frame);
+            }
             Serial.print(F(" - pointerAddr "));
-            Serial.print(pointerAddr);
+            Serial.print(IRStorage::PointerAddr(index));
             Serial.print(F(", dataAddr "));
             Serial.println(dataAddr);
 
-            while (!Serial.available()) delay(1);
-
-            // read whole line from Serial
-            String args = Serial.readStringUntil('\n');
-            args.replace("\r", "");     // remove carriage return
-            args.trim();                // remove blank spaces from beginning and end
-
-            // print read line back to Serial
-            Serial.print("\"");
-            Serial.print(args);
-            Serial.println("\"");
-
-            // first argument: number of bits
-            next = nextArg(args);
-
-            if (!next.length())
-            {
-                Serial.println(F("invalid sequence 1"));
-                code -= 1;
-                continue;
-            }
-
-            data.nBits = next.toInt();
-            if (data.nBits == 0)
-            {
-                Serial.println(F("invalid n bits"));
-                code -= 1;
-                continue;
-            }
-
-            // second argument: hex data
-            next = nextArg(args);
-            if (!next.length())
-            {
-                Serial.println(F("invalid sequence 2"));
-                code -= 1;
-                continue;
-            }
-
-            success = hexStringToArray(next, data.data, data.Length());
-            if (!success)
-            {
-                Serial.println(F("invalid data"));
-                code -= 1;
-                continue;
-            }
-
-            // third argument: protocol ID
-            next = nextArg(args);
-            if (!next.length())
-            {
-                Serial.println(F("invalid sequence 3"));
-                code -= 1;
-                continue;
-            }
-
-            data.protocol = g_irProtocols.GetProtocol(next.toInt());
-            error = data.protocol == NULL;
-            if (error)
+            // read whole line from Serial, unless the code is learned
+            if (!learnOrReadLine(learner, data))
             {
-                Serial.println(F("invalid protocol"));
-                code -= 1;
-                continue;
+                char *args = g_irShell.Line();
+
+                // print read line back to Serial
+                Serial.print('"');
+                Serial.print(args);
+                Serial.println('"');
+
+                // number of bits, hex data, protocol ID, isRepeated
+                IRShell::Error parseError = g_irShell.Overflowed() ? IRShell::LineTooLong
+                                                                   : IRShell::ParseCode(args, data);
+                if (parseError != IRShell::None)
+                {
+                    Serial.print(F("invalid code: "));
+                    Serial.println(IRShell::errorToString(parseError));
+                    code -= 1;
+                    continue;
+                }
             }
 
-            // fourth argument: isRepeated
-            next = nextArg(args);
-            if (!next.length())
+            if (data.nextGap > 0 && frame == IRDATA_MAX_FRAMES - 1)
             {
-                Serial.println(F("invalid sequence 4"));
+                Serial.println(F("invalid code: too many frames"));
                 code -= 1;
                 continue;
             }
 
-            data.isRepeated = next.toInt() > 0;
-
             // print IRData to Serial
             Serial.print(F("Result:  "));
             data.ToString();
 
-            data.isValid = true;
-
-            // write to EEPROM
-            success = data.WriteToEEPROM(dataAddr);
+            // write to EEPROM, along with its address on first part
+            // of EEPROM (at pointerAddr). dataAddr is moved to the next
+            // blank space after the data that was just written, if any.
+            // Frames after the first one go right after it.
+            if (frame == 0) success = g_irStorage.WriteCode(index, data, dataAddr);
+            else success = g_irStorage.WriteFrame(data, dataAddr);
 
             if (!success)
             {
                 Serial.println(F("error while saving to eeprom"));
+                IRStreamReceiver::End();
                 return;
             }
 
             // read back from EEPROM
-            success = data.ReadFromEEPROM(dataAddr);
+            success = IRStorage::ReadCode(index, data, frame);
 
             if (!success)
             {
                 Serial.println(F("error while saving to eeprom"));
+                IRStreamReceiver::End();
                 return;
             }
             data.ToString();
 
-            Serial.println("saved");
+            Serial.println(F("saved"));
 
-            // write IRData address on first part of EEPROM (at pointerAddr)
-            eeprom_write_block((const void *)&dataAddr, (void *)pointerAddr, sizeof(dataAddr));
-            pointerAddr += sizeof(pointerAddr);
+            // the next line is the next frame of the same code
+            if (data.nextGap > 0)
+            {
+                frame++;
+                code -= 1;
+                continue;
+            }
 
-            // next dataAddr is the next blank space after the data that was just written
-            dataAddr += data.SizeOnEEPROM();
+            frame = 0;
+            index++;
         }
     }
 
-    EEPROM.write(0, 'p');
+    IRStreamReceiver::End();
+    g_irStorage.Commit(dataAddr);
 }
 
 /**
- * Enters in IR reader mode. When a IR packet is received, its timings
- * are analyzed and printed, and then decode follows, trying to find a
- * matching IRProtocol. If successful, the decoded data is printed.
+ * Waits for the next code to program: a line on Serial, or captures of
+ * its button, until the code is learned from them. Captures are decoded
+ * edge by edge (see IRStreamReceiver), so no raw buffer is needed; only
+ * the first frame of each press is taken.
  *
- * If no matching protocol was found, a new IRProtocol must be created
- * by analyzing the timing statistics printed. See the lengths of marks
- * and spaces from header and data, and if there is a repeat and
- * what is the space between them.
- * 
+ * @param   learner     votes the captures, reset on each line read
+ * @param   data        learned code
+ *
+ * @return  true if the code was learned, false if a line was read
+ *          instead (on g_irShell)
+ */
+bool learnOrReadLine(IRLearner &learner, IRData &data)
+{
+    IRData capture;
+
+    while (!g_irShell.ReadLine(Serial))
+    {
+        if (!IRStreamReceiver::Poll() || !IRStreamReceiver::Read(capture))
+        {
+            g_scheduler.Idle();
+            continue;
+        }
+
+        // later frames of a multi-frame code
+        if (IRStreamReceiver::FrameGap() > 0) continue;
+
+        IRLearner::Error error = learner.Add(capture, data);
+
+        if (error == IRLearner::None)
+        {
+            Serial.print(F("learned from "));
+            Serial.print(learner.Agreeing());
+            Serial.print(F(" captures, outvoted bits "));
+            Serial.println(learner.OutvotedBits());
+            return true;
+        }
+
+        if (error == IRLearner::Pending)
+        {
+            Serial.print(F("capture "));
+            Serial.print(learner.Count());
+            Serial.print('/');
+            Serial.print(IRLEARN_CAPTURES);
+            Serial.print(F(": "));
+            capture.PrintCode(Serial);
+            continue;
+        }
+
+        Serial.print(F("learn: "));
+        Serial.print(IRLearner::errorToString(error));
+        if (error != IRLearner::NotDecoded) Serial.print(F(", press the button again"));
+        Serial.println();
+    }
+
+    learner.Reset();
+    return false;
+}
+
+/**
+ * Enters in IR reader mode. Each IR packet received is decoded, trying
+ * to find a matching IRProtocol, and printed as a binary trace, in hex
+ * (see IRTrace), followed by the decoded code, in the codes.txt format,
+ * or "Unknown protocol". Serial logs can be decoded again offline with
+ * the ir-trace tool.
+ *
+ * Captures are queued on an IRCaptureRing, and IRremote is resumed
+ * right away, so frames that come while the previous ones are printed
+ * aren't lost. Printing only takes as much as fits on the serial buffer,
+ * and captures are taken while waiting for it. A capture that doesn't
+ * fit on the ring stays on IRremote's buffer until the ring empties;
+ * frames lost meanwhile are told apart by the edges seen on the pin,
+ * and reported once the line is quiet.
+ *
+ * With DUMPER_VERBOSE, timings are also printed and analyzed. If no
+ * matching protocol was found, a new IRProtocol can be created from the
+ * candidate printed by analyze(), inferred from the timing statistics
+ * (header, bit mark and spaces, trail and repeat spaces). Add it to
+ * g_irProtocolTable, with a new IRProtocol::Id.
  */
 void dumper()
 {
-    char blinkStatus = 1, received = 0;
-    unsigned long blinkTimer = 0;
-    decode_results irRawData;
+    // static, so it's counted on the RAM used by globals (about 220
+    // bytes), rather than taken from the stack
+    static DumperCaptures captures;
+    IRData frame;               // last frame decoded edge by edge
+    uint8_t frames = 0;         // frames of its code so far, 0 if none
+    unsigned long frameAt = 0;
+
+    captures.held = false;
+    captures.captured = 0;
+    captures.lost = 0;
 
-    Serial.println("dumper mode");
+    Serial.println(F("dumper mode"));
 
     g_irRecv.enableIRIn();
+    IRStreamReceiver::Begin(g_pins.irSensor);
+
+    g_blinkTask = g_scheduler.Add(blinkLed, 1);
+    g_patternTask = g_scheduler.Add(playPattern, Scheduler::Stop);
 
     while (1)
     {
         IRData data;
 
-        if (g_irRecv.decode(&irRawData)) received = 1;
+        g_scheduler.Run();
+        captureFrame(captures);
 
-        digitalWrite(g_pins.ledBlink, blinkStatus);
-
-        if (!received)
+        // Frames decoded edge by edge are ready as soon as they end,
+        // while raw data only comes after a whole _GAP. Each one is
+        // printed when it's known if another frame of the same code
+        // follows it, so multi-frame codes print as codes.txt lines.
+        if (IRStreamReceiver::Poll() && IRStreamReceiver::Read(data))
         {
-            if (++blinkTimer > 500)
+            uint8_t gap = IRStreamReceiver::FrameGap();
+
+            if (frames > 0)
             {
-                blinkStatus = blinkStatus ? 0 : 1;
-                blinkTimer = 0;
+                if (frames == IRDATA_MAX_FRAMES) gap = 0;
+
+                frame.nextGap = gap;
+                waitSerial(captures, SERIAL_TX_BUFFER_SIZE - 1);
+                Serial.print(F("Stream: "));
+                frame.ToString();
             }
 
-            delay(1);
-            continue; // return to loop beginning
+            frame = data;
+            frames = frames > 0 && gap > 0 ? frames + 1 : 1;
+            frameAt = millis();
         }
-
-        dumpRaw(&irRawData);
-        analyze(&irRawData);
-        decodeIR(&irRawData, data, 1);
-
-        if (data.isValid) // i.e. known protocol
+        else if (frames > 0 && millis() - frameAt > IRSTREAM_MAX_FRAME_GAP_MS)
         {
-            data.ToString();
+            waitSerial(captures, SERIAL_TX_BUFFER_SIZE - 1);
+            Serial.print(F("Stream: "));
+            frame.ToString();
+            frames = 0;
+        }
 
-            digitalWrite(g_pins.led1, HIGH);
-            delay(50);
-            digitalWrite(g_pins.led1, LOW);
-            delay(50);
-            digitalWrite(g_pins.led1, HIGH);
-            delay(50);
-            digitalWrite(g_pins.led1, LOW);
+        // held captures come after the queued ones
+        if (captures.ring.Count() > 0)
+        {
+            printQueued(captures);
+        }
+        else if (captures.held)
+        {
+            printHeld(captures);
         }
         else
         {
-            digitalWrite(g_pins.led1, HIGH);
-            delay(500);
-            digitalWrite(g_pins.led1, LOW);
+            reportLost(captures);
+            g_scheduler.Idle();
         }
+    }
+}
 
-        g_irRecv.resume(); // get another code
-        received = 0;
-        blinkTimer = 0;
-        blinkStatus = 1;
+/**
+ * Takes a capture from IRremote, if there's one, and queues it, so
+ * IRremote can receive the next frame right away. Verbose dumpers, or
+ * a full ring, hold it instead.
+ */
+void captureFrame(DumperCaptures &captures)
+{
+    IRData data;
 
-        digitalWrite(g_pins.led1, LOW);
+    if (captures.held || !g_irRecv.decode(&captures.raw)) return;
+
+    captures.captured++;
+
+#if DUMPER_VERBOSE
+    captures.held = true;
+#else
+    decodeIR(&captures.raw, data, 0);
+    showCapture(data.isValid);
+
+    if (captures.ring.Push(&captures.raw, data)) g_irRecv.resume();
+    else captures.held = true;
+#endif
+}
+
+/**
+ * Takes captures until the serial buffer has room for some bytes, so
+ * printing doesn't block
+ */
+void waitSerial(DumperCaptures &captures, int bytes)
+{
+    while (Serial.availableForWrite() < bytes) captureFrame(captures);
+}
+
+/**
+ * Prints the oldest capture on the ring, and removes it
+ */
+void printQueued(DumperCaptures &captures)
+{
+    IRData data;
+    int value;
+
+    captures.ring.Begin();
+
+    waitSerial(captures, SERIAL_TX_BUFFER_SIZE - 1);
+    Serial.print(F("Trace: "));
+    while ((value = captures.ring.read()) >= 0)
+    {
+        waitSerial(captures, 2);
+        if (value < 0x10) Serial.print('0');
+        Serial.print(value, HEX);
     }
+    waitSerial(captures, 2);
+    Serial.println();
+
+    captures.ring.Pop(data);
+
+    waitSerial(captures, SERIAL_TX_BUFFER_SIZE - 1);
+    printCode(data);
+}
+
+/**
+ * Prints the capture held on IRremote's buffer, and resumes it
+ */
+void printHeld(DumperCaptures &captures)
+{
+    IRData data;
+
+#if DUMPER_VERBOSE
+    dumpRaw(&captures.raw);
+    IRTrace::PrintHex(&captures.raw);
+    analyze(&captures.raw);
+    decodeIR(&captures.raw, data, 1);
+
+    if (data.isValid) data.ToString();
+    showCapture(data.isValid);
+#else
+    IRTrace::PrintHex(&captures.raw);
+    decodeIR(&captures.raw, data, 0);
+    printCode(data);
+#endif
+
+    captures.held = false;
+    g_irRecv.resume();
 }
 
+/**
+ * Prints a decoded frame as "<protocol name>: <codes.txt line>"
+ */
+void printCode(IRData &data)
+{
+    if (!data.isValid)
+    {
+        Serial.println(F("Unknown protocol"));
+        return;
+    }
+
+    Serial.print(data.protocol->Name());
+    Serial.print(F(": "));
+    data.PrintCode(Serial);
+}
+
+/**
+ * Prints how many frames were lost, i.e. seen on the pin but not
+ * captured, if there are new ones. Counts are only compared once the
+ * line is quiet, when IRremote is done with the last frame.
+ */
+void reportLost(DumperCaptures &captures)
+{
+    if (IRStreamReceiver::SilenceMicros() < 2UL * _GAP) return;
+
+    int16_t lost = IRStreamReceiver::FrameCount() - captures.captured;
+
+    if (lost <= captures.lost) return;
+
+    Serial.print(F("Dropped: "));
+    Serial.print(lost - captures.lost);
+    Serial.print(F(" frames, "));
+    Serial.print(lost);
+    Serial.println(F(" in total"));
+
+    captures.lost = lost;
+}
+
+/**
+ * Plays the LED pattern of a capture, and starts blinking over
+ */
+void showCapture(bool decoded)
+{
+    startPattern(decoded ? g_patternDecoded : g_patternUnknown);
+
+    // blinking starts over, LED on
+    g_blinkStatus = 0;
+    g_scheduler.Start(g_blinkTask, 0);
+}
+
+/**
+ * Toggles the blink LED, while the dumper waits for IR data
+ */
+uint16_t blinkLed()
+{
+    g_blinkStatus = !g_blinkStatus;
+    digitalWrite(g_pins.ledBlink, g_blinkStatus);
+
+    return 500;
+}
+
+/**
+ * Plays an LED pattern on LED 1 (see startPattern)
+ */
+uint16_t playPattern()
+{
+    uint16_t ms = g_pattern[g_patternStep];
+
+    // even steps are on, odd steps are off
+    digitalWrite(g_pins.led1, ms != 0 && g_patternStep % 2 == 0 ? HIGH : LOW);
+    if (ms == 0) return Scheduler::Stop;
+
+    g_patternStep++;
+    return ms;
+}
+
+/**
+ * Starts an LED pattern, replacing the one being played, if any
+ *
+ * @param   pattern     durations in ms, alternating on and off, ending with 0
+ */
+void startPattern(const uint16_t *pattern)
+{
+    g_pattern = pattern;
+    g_patternStep = 0;
+    g_scheduler.Start(g_patternTask, 0);
+}
+
+/**
+ * Sends a code of all AC remotes, in background. Remotes of a previous
+ * code not queued yet are skipped, i.e. the new code supersedes it.
+ *
+ * Remotes are sent in ascending order of the gap their protocol needs
+ * after a frame (see IRProtocol::FrameGapMs), so remotes of the same
+ * protocol go together, and each gap is as short as the protocols on
+ * both sides of it allow. Remotes after one with an invalid code are
+ * not sent.
+ *
+ * @param   code    0 (off) to 3
+ */
 void sendCode(char code)
 {
+    uint8_t gaps[MAX_REMOTE_QTY];
     IRData irData;
-    uint16_t pointerAddr, dataAddr;
-    char remote = 0, success;
 
-    for (remote = 0; remote < g_remoteQty; remote++)
+    g_queueCode = code;
+    g_queueRemote = 0;
+    g_queueRemotes = 0;
+
+    // insertion sort, the same gaps keep the remote order
+    while (g_queueRemotes < g_remoteQty
+        && g_irCodeCache.Get(g_queueRemotes * 4 + code, irData))
     {
-        pointerAddr = 3 + code * 2 + remote * 8;
-        eeprom_read_block((void *)&dataAddr, (void *)pointerAddr, sizeof(pointerAddr));
+        uint8_t gap = irData.protocol->FrameGapMs();
+        uint8_t i = g_queueRemotes;
+
+        for (; i > 0 && gaps[i - 1] > gap; i--)
+        {
+            gaps[i] = gaps[i - 1];
+            g_queueOrder[i] = g_queueOrder[i - 1];
+        }
 
-        success = irData.ReadFromEEPROM(dataAddr);
+        gaps[i] = gap;
+        g_queueOrder[i] = g_queueRemotes++;
+    }
 
-        if (!success) return;
+    g_broadcasting = true;
+    g_broadcastFrames = 0;
+    g_broadcastStart = millis();
 
-        digitalWrite(g_pins.ledBlink, LOW);
-        sendIR(g_irSender, irData);
-        delay(50);
-        digitalWrite(g_pins.ledBlink, HIGH);
-        delay(50);
+    queueCodes();
+}
+
+/**
+ * Moves the codes not sent yet (see sendCode and sendProjector) to the
+ * send queue, a frame at a time, as long as there's room for them.
+ * Frames of a multi-frame code are queued back to back, with their own
+ * gaps, before any other code. Codes are followed by the shortest gap
+ * their protocols allow (see IRAsyncSender).
+ */
+void queueCodes()
+{
+    IRData irData;
+
+    while (g_irAsyncSender.CanEnqueue())
+    {
+        if (g_queueFrame == 0)
+        {
+            if (g_queueSingle != NO_CODE)
+            {
+                g_queueIndex = g_queueSingle;
+                g_queueSingle = NO_CODE;
+            }
+            else if (g_queueRemote < g_queueRemotes)
+            {
+                g_queueIndex = g_queueOrder[g_queueRemote] * 4 + g_queueCode;
+                g_queueRemote++;
+            }
+            else return;
+        }
+
+        if (!g_irCodeCache.Get(g_queueIndex, irData, g_queueFrame))
+        {
+            // invalid code, the remaining remotes are skipped
+            if (g_queueIndex < g_remoteQty * 4) g_queueRemote = g_queueRemotes;
+            g_queueFrame = 0;
+            continue;
+        }
+
+        g_irAsyncSender.Enqueue(irData, irData.nextGap);
+        g_queueFrame = irData.nextGap > 0 ? g_queueFrame + 1 : 0;
+        if (g_queueIndex < g_remoteQty * 4) g_broadcastFrames++;
     }
 }
 
+/**
+ * Queues a single code, sent from the shell, ahead of the remotes not
+ * queued yet (see queueCodes)
+ *
+ * @param   index   on the pointer table
+ * @return  false if another single code is still waiting
+ */
+bool sendSingle(uint8_t index)
+{
+    if (g_queueSingle != NO_CODE) return false;
+
+    g_queueSingle = index;
+    queueCodes();
+    return true;
+}
+
 void sendProjector(char code)
 {
-    IRData irData;
-    uint16_t pointerAddr, dataAddr;
-    char success;
+    uint8_t index = g_remoteQty * 4;    // power
 
-    pointerAddr = 3 + g_remoteQty * 8; // power
     if (code != 0)
     {
         if (++g_projectorStatus == 3) g_projectorStatus = 0;
 
-        if (g_projectorStatus == 1) pointerAddr += 2; // freeze
-        else pointerAddr += 4; // mute (and unmute)
+        if (g_projectorStatus == 1) index += 1; // freeze
+        else index += 2; // mute (and unmute)
     }
 
-    eeprom_read_block((void *)&dataAddr, (void *)pointerAddr, sizeof(pointerAddr));
-    success = irData.ReadFromEEPROM(dataAddr);
-
-    if (!success) return;
-
-    digitalWrite(g_pins.ledBlink, LOW);
-    sendIR(g_irSender, irData);
-    delay(50);
-    digitalWrite(g_pins.ledBlink, HIGH);
-    delay(50);
+    g_queueSingle = index;
+    queueCodes();
 }